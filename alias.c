@@ -0,0 +1,364 @@
+#include "lsh.h"
+
+//Aliases. Each value is tokenized once, when it is defined. What a command word
+//finally expands to is worked out the first time the alias is used, following the
+//chain through the first word of each value, and kept until the next alias or
+//unalias changes the table. A chain stops at a name it has already gone through, so
+//alias ls='ls -F' and a loop like a -> b -> a end instead of expanding forever.
+
+static AliasTable aliases; //every alias
+static char **aliasRetired; //text of replaced and removed aliases, the running line may still point into it
+static int aliasNumRetired;
+static int aliasRetiredCap;
+
+static Alias *aliasSlot(AliasTable *t, const char *name) //the slot holding name, or the empty slot where it belongs
+{
+    size_t mask = t->capacity - 1;
+    size_t i = varHash(name, strlen(name)) & mask;
+
+    while(t->slots[i].name && strcmp(t->slots[i].name, name) != 0) //linear probing
+    {
+        i = (i + 1) & mask;
+    }
+    return &t->slots[i];
+}
+
+static void aliasGrow(AliasTable *t)
+{
+    AliasTable bigger = *t;
+    bigger.capacity = t->capacity ? t->capacity * 2 : ALIAS_TABLE_INITIAL;
+    bigger.slots = calloc(bigger.capacity, sizeof(Alias));
+
+    if(!bigger.slots)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < t->capacity; i++) //rehash every live entry into the new table
+    {
+        if(t->slots[i].name)
+        {
+            *aliasSlot(&bigger, t->slots[i].name) = t->slots[i];
+        }
+    }
+
+    free(t->slots);
+    *t = bigger;
+}
+
+static void aliasRetire(char *text) //freed by aliasRelease() once the line is done
+{
+    if(aliasNumRetired == aliasRetiredCap)
+    {
+        int capacity = aliasRetiredCap ? aliasRetiredCap * 2 : 8;
+        char **grown = realloc(aliasRetired, capacity * sizeof(char*));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        aliasRetired = grown;
+        aliasRetiredCap = capacity;
+    }
+    aliasRetired[aliasNumRetired++] = text;
+}
+
+static void aliasClear(Alias *a) //free what a holds, its text once the line is done
+{
+    free(a->name);
+    free(a->value);
+    aliasRetire(a->text);
+    free(a->toks);
+    free(a->expansion);
+    memset(a, 0, sizeof(*a));
+}
+
+static void aliasDefine(const char *name, size_t nameLen, const char *value)
+{
+    if((aliases.size + 1) * 4 > aliases.capacity * 3) //keep the load factor under 3/4
+    {
+        aliasGrow(&aliases);
+    }
+
+    int capacity = LSH_TOK_BUFSIZE;
+    Alias fresh = {
+        .name = strndup(name, nameLen),
+        .value = strdup(value),
+        .text = strdup(value),
+        .toks = malloc(capacity * sizeof(char*))
+    };
+    if(!fresh.name || !fresh.value || !fresh.text || !fresh.toks)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool subst = lshTokSubst, glob = lshTokGlob; //the line that is running still needs them
+    fresh.toks = lshTokenize(fresh.text, &fresh.toks, &capacity);
+    lshTokSubst = subst;
+    lshTokGlob = glob;
+
+    Alias *a = aliasSlot(&aliases, fresh.name);
+    if(a->name) aliasClear(a); //value may point into the old text, so it is copied first
+    else aliases.size++;
+    *a = fresh;
+    aliases.generation++;
+}
+
+static void aliasRemove(Alias *a)
+{
+    aliasClear(a);
+    aliases.size--;
+    aliases.generation++;
+
+    size_t mask = aliases.capacity - 1; //backward shift deletion keeps every probe chain unbroken
+    size_t hole = a - aliases.slots;
+    for(size_t i = (hole + 1) & mask; aliases.slots[i].name; i = (i + 1) & mask)
+    {
+        size_t home = varHash(aliases.slots[i].name, strlen(aliases.slots[i].name)) & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask))
+        {
+            aliases.slots[hole] = aliases.slots[i];
+            aliases.slots[i].name = NULL;
+            hole = i;
+        }
+    }
+}
+
+Alias *aliasFind(const char *word) //the alias named word, NULL if there is none; one probe
+{
+    if(aliases.size == 0) return NULL;
+
+    Alias *a = aliasSlot(&aliases, word);
+    return a->name ? a : NULL;
+}
+
+static Alias *aliasNext(Alias *a, unsigned long walk) //the alias a's first word names, NULL at the end of the chain
+{
+    a->visit = walk;
+    Alias *next = a->toks[0] && lshTokKind(a->toks[0]) == TOK_WORD ? aliasFind(a->toks[0]) : NULL;
+    return next && next->visit != walk ? next : NULL;
+}
+
+static int aliasCount(char **toks)
+{
+    int n = 0;
+    while(toks[n]) n++;
+    return n;
+}
+
+char **aliasExpansion(Alias *a, int *len) //the tokens a expands to, worked out again only after the table changed
+{
+    if(a->generation != aliases.generation)
+    {
+        int total = 0; //first walk: how long the expansion is
+        Alias *last = a;
+        unsigned long walk = ++aliases.walks;
+        for(Alias *c = a; c; c = aliasNext(c, walk))
+        {
+            last = c;
+            total += c->toks[0] ? aliasCount(c->toks) - 1 : 0; //every word after the first stays
+        }
+        total += last->toks[0] ? 1 : 0; //the first word of the last value stays as well
+
+        char **expansion = realloc(a->expansion, (total + 1) * sizeof(char*));
+        if(!expansion)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        int end = total; //second walk: the rest of each value goes in from the back
+        walk = ++aliases.walks;
+        for(Alias *c = a; c; c = aliasNext(c, walk))
+        {
+            int n = c->toks[0] ? aliasCount(c->toks) : 0;
+            if(c == last)
+            {
+                memcpy(expansion, c->toks, n * sizeof(char*));
+                break;
+            }
+            end -= n - 1;
+            memcpy(expansion + end, c->toks + 1, (n - 1) * sizeof(char*));
+        }
+        expansion[total] = NULL;
+
+        a->expansion = expansion;
+        a->expansionLen = total;
+        a->subst = false;
+        a->glob = false;
+        for(int i = 0; i < total; i++)
+        {
+            if(strpbrk(expansion[i], LSH_SUBST_MARKS)) a->subst = true;
+            if(globHasMagic(expansion[i])) a->glob = true;
+        }
+        a->generation = aliases.generation;
+    }
+
+    *len = a->expansionLen;
+    return a->expansion;
+}
+
+char **aliasExpand(char ***tokensPtr, int *capacity) //the first word replaced by what it expands to when it is an alias
+{
+    char **tokens = *tokensPtr;
+    if(!tokens[0] || lshTokKind(tokens[0]) != TOK_WORD) return tokens;
+
+    Alias *a = aliasFind(tokens[0]);
+    if(!a) return tokens;
+
+    int len;
+    char **expansion = aliasExpansion(a, &len);
+    int rest = aliasCount(tokens + 1);
+
+    if(len + rest + 1 > *capacity)
+    {
+        int bigger = (len + rest + 1) * 2;
+        char **grown = realloc(tokens, bigger * sizeof(char*));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        tokens = *tokensPtr = grown;
+        *capacity = bigger;
+    }
+    memmove(tokens + len, tokens + 1, (rest + 1) * sizeof(char*));
+    memcpy(tokens, expansion, len * sizeof(char*));
+
+    if(a->subst) lshTokSubst = true;
+    if(a->glob) lshTokGlob = true;
+    return tokens;
+}
+
+void aliasRelease(void) //the line is done, nothing points into retired text anymore
+{
+    for(int i = 0; i < aliasNumRetired; i++)
+    {
+        free(aliasRetired[i]);
+    }
+    aliasNumRetired = 0;
+}
+
+void aliasFree(void)
+{
+    for(size_t i = 0; i < aliases.capacity; i++)
+    {
+        if(aliases.slots[i].name) aliasClear(&aliases.slots[i]);
+    }
+    free(aliases.slots);
+    memset(&aliases, 0, sizeof(aliases));
+    aliasRelease();
+    free(aliasRetired);
+    aliasRetired = NULL;
+    aliasRetiredCap = 0;
+}
+
+static void aliasPrint(const Alias *a) //alias name='value', in a form that can be read back
+{
+    printf("alias %s='", a->name);
+    for(const char *s = a->value; *s; s++)
+    {
+        if(*s == '\'') fputs("'\\''", stdout);
+        else putchar(*s);
+    }
+    puts("'");
+}
+
+static int aliasCompare(const void *a, const void *b)
+{
+    return strcmp((*(Alias * const *) a)->name, (*(Alias * const *) b)->name);
+}
+
+int lshAlias(char **args)
+{
+    if(!args[1]) //list every alias, sorted
+    {
+        Alias **sorted = malloc((aliases.size + 1) * sizeof(Alias*));
+        if(!sorted)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        size_t n = 0;
+        for(size_t i = 0; i < aliases.capacity; i++)
+        {
+            if(aliases.slots[i].name) sorted[n++] = &aliases.slots[i];
+        }
+        qsort(sorted, n, sizeof(Alias*), aliasCompare);
+
+        for(size_t i = 0; i < n; i++)
+        {
+            aliasPrint(sorted[i]);
+        }
+        free(sorted);
+        return 1;
+    }
+
+    for(int i = 1; args[i]; i++)
+    {
+        const char *eq = strchr(args[i], '=');
+
+        if(!eq) //alias name shows it
+        {
+            Alias *a = aliasFind(args[i]);
+            if(a) aliasPrint(a);
+            else
+            {
+                fprintf(stderr, "alias: %s: not found\n", args[i]);
+                lshLastStatus = 1;
+            }
+            continue;
+        }
+
+        size_t len = eq - args[i];
+        bool valid = len > 0;
+        for(size_t j = 0; j < len && valid; j++)
+        {
+            unsigned char c = args[i][j];
+            valid = c > ' ' && !strchr("/$`'\"\\|&;<>()", c);
+        }
+        if(!valid)
+        {
+            fprintf(stderr, "alias: `%.*s': invalid alias name\n", (int) len, args[i]);
+            lshLastStatus = 1;
+            continue;
+        }
+        aliasDefine(args[i], len, eq + 1);
+    }
+    return 1;
+}
+
+int lshUnalias(char **args)
+{
+    if(!args[1])
+    {
+        fprintf(stderr, "unalias: usage: unalias [-a] name ...\n");
+        lshLastStatus = 2;
+        return 1;
+    }
+
+    for(int i = 1; args[i]; i++)
+    {
+        if(strcmp(args[i], "-a") == 0) //all of them
+        {
+            for(size_t j = 0; j < aliases.capacity; j++)
+            {
+                if(aliases.slots[j].name) aliasClear(&aliases.slots[j]);
+            }
+            aliases.size = 0;
+            aliases.generation++;
+            continue;
+        }
+
+        Alias *a = aliasFind(args[i]);
+        if(a) aliasRemove(a);
+        else
+        {
+            fprintf(stderr, "unalias: %s: not found\n", args[i]);
+            lshLastStatus = 1;
+        }
+    }
+    return 1;
+}
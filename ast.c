@@ -0,0 +1,1123 @@
+#include "lsh.h"
+
+//Compound commands: if, while, until, for, { ...; }, functions, and the ;, && and ||
+//lists that join commands. A command is parsed once into a tree of AstNodes and the
+//tree is what runs: the words of each plain command are copied out of the line with
+//their substitution and wildcard markers still in them, so the next iteration of a
+//loop or the next call of a function only expands and executes them, the tokenizer
+//never sees the text again. Sourced scripts are parsed whole and kept, keyed by
+//path, for as long as the file's mtime says it is unchanged.
+
+volatile sig_atomic_t lshInterrupted; //^C during a compound command, everything still running in it stops
+
+static AstFuncTable astFuncs; //defined functions
+static AstCacheEntry astCache[AST_CACHE_MAX]; //parsed sourced scripts
+static unsigned long astCacheClock; //for evicting the least recently used script
+static AstFlow astFlow; //a break, continue or return on its way out
+static int astFlowCount; //loops a break or continue still has to leave
+static int astLoopDepth; //loops running in the current function
+static int astCallDepth; //functions and sourced scripts running, return needs one
+static int astPrevStatus; //status before the current command, what a bare return returns
+static int astCatchDepth; //loops that installed the ^C handler
+static struct sigaction astSavedInterrupt; //what SIGINT did before
+static volatile sig_atomic_t astCaught; //the handler saw ^C, not a child
+
+static const char *const astReserved[] = { //words that start or end a compound command
+    "if", "then", "elif", "else", "fi", "for", "while", "until", "do", "done", "{", "}", "function", "!", NULL
+};
+
+static AstNode *astParseList(AstParser *p, const char *const *ends);
+static AstNode *astParseCommand(AstParser *p);
+static int astRun(AstNode *n);
+
+static bool astIsWord(const char *tok, const char *word) //tok is the reserved word word
+{
+    return tok && lshTokKind(tok) == TOK_WORD && strcmp(tok, word) == 0;
+}
+
+static bool astIsOneOf(const char *tok, const char *const *words)
+{
+    for(int i = 0; words[i]; i++)
+    {
+        if(astIsWord(tok, words[i])) return true;
+    }
+    return false;
+}
+
+static int astFuncHeader(char **toks) //number of tokens in a name() header at toks, 0 if there is none
+{
+    if(!toks[0] || lshTokKind(toks[0]) != TOK_WORD) return 0;
+
+    size_t len = strlen(toks[0]);
+    if(len > 2 && strcmp(toks[0] + len - 2, "()") == 0) return 1;
+    if(astIsWord(toks[1], "()")) return 2;
+    return 0;
+}
+
+bool astNeeded(char **tokens) //the line is a list, a compound command or a function definition, not one plain command
+{
+    if(!tokens[0]) return false;
+    if(astIsOneOf(tokens[0], astReserved) || astFuncHeader(tokens) > 0) return true;
+
+    for(int i = 0; tokens[i]; i++)
+    {
+        TokenKind kind = lshTokKind(tokens[i]);
+        if(kind == TOK_SEMI || kind == TOK_AND || kind == TOK_OR) return true;
+        if(kind == TOK_BG && tokens[i + 1]) return true; //cmd & cmd
+        if(kind == TOK_PIPE && !tokens[i + 1]) return true; //cmd | goes on on the next line
+    }
+    return false;
+}
+
+static AstNode *astNode(AstKind kind)
+{
+    AstNode *n = calloc(1, sizeof(AstNode));
+    if(!n)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    n->kind = kind;
+    n->refs = 1;
+    return n;
+}
+
+void astFree(AstNode *n) //drop a reference to every node of the list n
+{
+    while(n)
+    {
+        AstNode *next = n->next; //a shared function body is never part of a list
+        if(--n->refs == 0)
+        {
+            astFree(n->a);
+            astFree(n->b);
+            astFree(n->c);
+            free(n->words);
+            free(n->name);
+            free(n);
+        }
+        n = next;
+    }
+}
+
+static char *astDup(const char *s)
+{
+    char *copy = strdup(s);
+    if(!copy)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    return copy;
+}
+
+static char **astCopyWords(char **toks, int n, AstNode *node) //the tokens in one block, the array first and the text after it
+{
+    size_t text = 0;
+    for(int i = 0; i < n; i++)
+    {
+        if(lshTokKind(toks[i]) == TOK_WORD) text += strlen(toks[i]) + 1;
+    }
+
+    char **words = malloc((n + 1) * sizeof(char*) + text);
+    if(!words)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *w = (char *) (words + n + 1);
+    for(int i = 0; i < n; i++)
+    {
+        if(lshTokKind(toks[i]) != TOK_WORD) //operators keep pointing at lshOperatorText, that is how their kind is known
+        {
+            words[i] = toks[i];
+            continue;
+        }
+        size_t len = strlen(toks[i]) + 1;
+        memcpy(w, toks[i], len);
+        words[i] = w;
+        w += len;
+
+        if(strpbrk(toks[i], LSH_SUBST_MARKS)) node->subst = true;
+        if(globHasMagic(toks[i])) node->glob = true;
+    }
+    words[n] = NULL;
+    return words;
+}
+
+//Parsing. The parser works on the tokens of one line at a time and reads the next
+//line from its source only when a command is not finished yet: inside a compound
+//command, after && or ||, or after a | at the end of a line.
+
+static void astSyntax(AstParser *p, const char *tok) //report the first error only
+{
+    if(p->error) return;
+
+    if(tok) fprintf(stderr, "lsh: syntax error near unexpected token `%s'\n", tok);
+    else fprintf(stderr, "lsh: syntax error: unexpected end of file\n");
+    p->error = true;
+    lshLastStatus = 2;
+}
+
+static char *astPeek(AstParser *p) //the next token, NULL at the end of the line
+{
+    return p->toks[p->pos];
+}
+
+static bool astNextLine(AstParser *p) //move on to the next line that has tokens, false at the end of input
+{
+    while(p->src)
+    {
+        if(p->src->interactive)
+        {
+            fputs("> ", stdout); //continuation prompt
+            fflush(stdout);
+        }
+
+        char *line = lshNextLine(p->src); //valid until the command has run
+        if(!line) break;
+        if(isComment(line)) continue;
+
+        if(!p->buf)
+        {
+            p->cap = LSH_TOK_BUFSIZE;
+            p->buf = malloc(p->cap * sizeof(char*));
+            if(!p->buf)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        p->buf = lshTokenize(line, &p->buf, &p->cap);
+        p->toks = p->buf;
+        p->pos = 0;
+        if(p->toks[0]) return true;
+    }
+
+    astSyntax(p, NULL);
+    return false;
+}
+
+static char *astNeed(AstParser *p) //the next token, reading more lines to get one; NULL at the end of input
+{
+    while(!astPeek(p))
+    {
+        if(!astNextLine(p)) return NULL;
+    }
+    return astPeek(p);
+}
+
+static bool astExpect(AstParser *p, const char *word)
+{
+    char *tok = astNeed(p);
+
+    if(!astIsWord(tok, word))
+    {
+        if(tok) astSyntax(p, tok);
+        return false;
+    }
+    p->pos++;
+    return true;
+}
+
+static AstNode *astParseCmd(AstParser *p) //a command line up to the next ;, && or ||, or the end of the line, a trailing & included
+{
+    char **toks = NULL;
+    char **bodies = NULL; //here-document bodies, copied with the words
+    int n = 0, numBodies = 0;
+    AstNode *node = NULL;
+
+    while(true)
+    {
+        char *tok = astPeek(p);
+
+        if(!tok)
+        {
+            if(n > 0 && lshTokKind(toks[n - 1]) == TOK_PIPE && astNextLine(p)) continue; //cmd | at the end of a line goes on
+            break;
+        }
+
+        TokenKind kind = lshTokKind(tok);
+        if(kind == TOK_SEMI || kind == TOK_AND || kind == TOK_OR) break;
+        p->pos++;
+
+        char **grown = realloc(toks, (n + 2) * sizeof(char*));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        toks = grown;
+
+        if(kind == TOK_HEREDOC && astPeek(p) && lshTokKind(astPeek(p)) == TOK_WORD)
+        {
+            //The body follows this line in the input, so it is read now, while the
+            //command is parsed; running the command again must not read more input.
+            size_t len = 0;
+            char *body = p->src ? heredocReadBody(p->src, astPeek(p), &len) : NULL;
+            char *text = malloc(len + 1);
+            if(!text)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            if(len > 0) memcpy(text, body, len);
+            text[len] = '\0';
+            free(body);
+
+            char **more = realloc(bodies, (numBodies + 1) * sizeof(char*));
+            if(!more)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            bodies = more;
+            bodies[numBodies++] = text;
+
+            toks[n++] = lshOperatorText[TOK_HEREBODY];
+            toks[n++] = text;
+            p->pos++;
+            continue;
+        }
+
+        toks[n++] = tok;
+        if(kind == TOK_BG) break; //cmd & cmd
+    }
+
+    if(n == 0)
+    {
+        astSyntax(p, astPeek(p));
+    }
+    else if(!p->error)
+    {
+        node = astNode(AST_CMD);
+        node->words = astCopyWords(toks, n, node);
+    }
+
+    for(int i = 0; i < numBodies; i++) free(bodies[i]);
+    free(bodies);
+    free(toks);
+    return node;
+}
+
+static AstNode *astParseBody(AstParser *p, const char *const *ends) //a list that must not be empty
+{
+    AstNode *list = astParseList(p, ends);
+    if(!list) astSyntax(p, astPeek(p));
+    return list;
+}
+
+static AstNode *astParseIf(AstParser *p) //after if or elif, up to and including the fi
+{
+    static const char *const thenEnd[] = { "then", NULL };
+    static const char *const bodyEnd[] = { "elif", "else", "fi", NULL };
+    static const char *const elseEnd[] = { "fi", NULL };
+    AstNode *n = astNode(AST_IF);
+
+    n->a = astParseBody(p, thenEnd);
+    if(!p->error && astExpect(p, "then")) n->b = astParseBody(p, bodyEnd);
+
+    if(!p->error && astIsWord(astPeek(p), "elif"))
+    {
+        p->pos++;
+        n->c = astParseIf(p); //the elif chain shares the one fi
+    }
+    else if(!p->error)
+    {
+        if(astIsWord(astPeek(p), "else"))
+        {
+            p->pos++;
+            n->c = astParseBody(p, elseEnd);
+        }
+        if(!p->error) astExpect(p, "fi");
+    }
+
+    if(p->error)
+    {
+        astFree(n);
+        return NULL;
+    }
+    return n;
+}
+
+static AstNode *astParseLoop(AstParser *p, AstKind kind) //after while or until
+{
+    static const char *const doEnd[] = { "do", NULL };
+    static const char *const doneEnd[] = { "done", NULL };
+    AstNode *n = astNode(kind);
+
+    n->a = astParseBody(p, doEnd);
+    if(!p->error && astExpect(p, "do")) n->b = astParseBody(p, doneEnd);
+    if(!p->error) astExpect(p, "done");
+
+    if(p->error)
+    {
+        astFree(n);
+        return NULL;
+    }
+    return n;
+}
+
+static AstNode *astParseFor(AstParser *p) //after for: name [in words]; do list; done
+{
+    static const char *const doneEnd[] = { "done", NULL };
+    char *name = astNeed(p);
+
+    if(!name || lshTokKind(name) != TOK_WORD || varNameLen(name) == 0 || name[varNameLen(name)] != '\0')
+    {
+        astSyntax(p, name);
+        return NULL;
+    }
+    p->pos++;
+
+    AstNode *n = astNode(AST_FOR);
+    n->name = astDup(name);
+
+    if(astIsWord(astPeek(p), "in")) //the words end with the line or a ;
+    {
+        int start = ++p->pos;
+        while(astPeek(p) && lshTokKind(astPeek(p)) == TOK_WORD) p->pos++;
+        n->words = astCopyWords(p->toks + start, p->pos - start, n);
+    }
+    if(astPeek(p) && lshTokKind(astPeek(p)) == TOK_SEMI) p->pos++;
+
+    if(astExpect(p, "do")) n->b = astParseBody(p, doneEnd);
+    if(!p->error) astExpect(p, "done");
+
+    if(p->error)
+    {
+        astFree(n);
+        return NULL;
+    }
+    return n;
+}
+
+static AstNode *astParseGroup(AstParser *p) //after {
+{
+    static const char *const braceEnd[] = { "}", NULL };
+    AstNode *n = astNode(AST_GROUP);
+
+    n->a = astParseBody(p, braceEnd);
+    if(!p->error) astExpect(p, "}");
+
+    if(p->error)
+    {
+        astFree(n);
+        return NULL;
+    }
+    return n;
+}
+
+static AstNode *astParseFunc(AstParser *p, bool keyword) //name() compound-command, or function name [()] compound-command
+{
+    static const char *const bodyStart[] = { "{", "if", "while", "until", "for", NULL };
+    char *tok = keyword ? astNeed(p) : astPeek(p);
+    char name[256];
+
+    if(!tok || lshTokKind(tok) != TOK_WORD)
+    {
+        astSyntax(p, tok);
+        return NULL;
+    }
+    p->pos++;
+
+    size_t len = strlen(tok);
+    if(len > 2 && strcmp(tok + len - 2, "()") == 0) len -= 2;
+    else if(astIsWord(astPeek(p), "()")) p->pos++;
+    else if(!keyword)
+    {
+        astSyntax(p, tok);
+        return NULL;
+    }
+
+    if(len == 0 || len >= sizeof(name) || memchr(tok, '/', len) || memchr(tok, '=', len) || strpbrk(tok, LSH_SUBST_MARKS) || globHasMagic(tok))
+    {
+        fprintf(stderr, "lsh: `%.*s': not a valid function name\n", (int) len, tok);
+        p->error = true;
+        lshLastStatus = 2;
+        return NULL;
+    }
+    memcpy(name, tok, len);
+    name[len] = '\0';
+
+    char *start = astNeed(p); //the body may start on the next line
+    if(!start) return NULL;
+    if(!astIsOneOf(start, bodyStart))
+    {
+        astSyntax(p, start);
+        return NULL;
+    }
+
+    AstNode *body = astParseCommand(p);
+    if(!body) return NULL;
+
+    AstNode *n = astNode(AST_FUNC);
+    n->name = astDup(name);
+    n->a = body;
+    return n;
+}
+
+static void astAlias(AstParser *p) //an alias in the command word goes into the token stream in its place
+{
+    if(p->aliased) //lshLoop() did the first command
+    {
+        p->aliased = false;
+        return;
+    }
+
+    char *tok = astPeek(p);
+    Alias *a = tok && lshTokKind(tok) == TOK_WORD ? aliasFind(tok) : NULL;
+    if(!a) return;
+
+    int len;
+    char **expansion = aliasExpansion(a, &len);
+    int rest = 0;
+    while(p->toks[p->pos + 1 + rest]) rest++;
+
+    char **toks = malloc((len + rest + 1) * sizeof(char*));
+    if(!toks)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(toks, expansion, len * sizeof(char*));
+    memcpy(toks + len, p->toks + p->pos + 1, (rest + 1) * sizeof(char*));
+
+    free(p->spliced); //toks may have pointed at it, it is copied already
+    p->spliced = p->toks = toks;
+    p->pos = 0;
+}
+
+static AstNode *astParseCommand(AstParser *p) //a compound command or a command line
+{
+    astAlias(p);
+    char *tok = astPeek(p);
+
+    if(tok && lshTokKind(tok) == TOK_WORD)
+    {
+        if(strcmp(tok, "if") == 0)
+        {
+            p->pos++;
+            return astParseIf(p);
+        }
+        if(strcmp(tok, "while") == 0 || strcmp(tok, "until") == 0)
+        {
+            p->pos++;
+            return astParseLoop(p, tok[0] == 'w' ? AST_WHILE : AST_UNTIL);
+        }
+        if(strcmp(tok, "for") == 0)
+        {
+            p->pos++;
+            return astParseFor(p);
+        }
+        if(strcmp(tok, "{") == 0)
+        {
+            p->pos++;
+            return astParseGroup(p);
+        }
+        if(strcmp(tok, "function") == 0)
+        {
+            p->pos++;
+            return astParseFunc(p, true);
+        }
+        if(astFuncHeader(p->toks + p->pos) > 0)
+        {
+            return astParseFunc(p, false);
+        }
+        if(astIsOneOf(tok, astReserved)) //then, fi, done and the like with nothing open
+        {
+            astSyntax(p, tok);
+            return NULL;
+        }
+    }
+    return astParseCmd(p);
+}
+
+static AstNode *astParsePipeline(AstParser *p) //[!] command
+{
+    if(!astIsWord(astPeek(p), "!")) return astParseCommand(p);
+
+    p->pos++;
+    if(!astNeed(p)) return NULL;
+
+    AstNode *inner = astParsePipeline(p);
+    if(!inner) return NULL;
+
+    AstNode *n = astNode(AST_NOT);
+    n->a = inner;
+    return n;
+}
+
+static AstNode *astParseAndOr(AstParser *p) //pipelines joined by && and ||, which bind left to right with equal precedence
+{
+    AstNode *left = astParsePipeline(p);
+
+    while(left)
+    {
+        char *tok = astPeek(p);
+        TokenKind kind = tok ? lshTokKind(tok) : TOK_WORD;
+        if(kind != TOK_AND && kind != TOK_OR) break;
+
+        p->pos++;
+        if(!astNeed(p)) //a && at the end of a line goes on on the next one
+        {
+            astFree(left);
+            return NULL;
+        }
+
+        AstNode *n = astNode(kind == TOK_AND ? AST_AND : AST_OR);
+        n->a = left;
+        n->b = astParsePipeline(p);
+        left = n;
+        if(!n->b)
+        {
+            astFree(left);
+            return NULL;
+        }
+    }
+    return left;
+}
+
+static bool astEndsInBg(const AstNode *n)
+{
+    if(n->kind != AST_CMD) return false;
+
+    int last = 0;
+    while(n->words[last]) last++;
+    return lshTokKind(n->words[last - 1]) == TOK_BG;
+}
+
+static AstNode *astParseList(AstParser *p, const char *const *ends) //commands up to one of the reserved words in ends, or to the end of the line when ends is NULL
+{
+    AstNode *first = NULL, **tail = &first;
+
+    while(!p->error)
+    {
+        char *tok = astPeek(p);
+        if(!tok)
+        {
+            if(!ends) break; //a whole line is done
+            if(!astNextLine(p)) break;
+            continue;
+        }
+        if(ends && astIsOneOf(tok, ends)) break;
+
+        AstNode *n = astParseAndOr(p);
+        if(!n) break;
+        *tail = n;
+        tail = &n->next;
+
+        tok = astPeek(p);
+        if(!tok) continue;
+        if(lshTokKind(tok) == TOK_SEMI) p->pos++;
+        else if(!astEndsInBg(n) && !(n->kind != AST_CMD && ends && astIsOneOf(tok, ends))) astSyntax(p, tok); //fi fi needs no ; in between
+    }
+
+    if(p->error)
+    {
+        astFree(first);
+        return NULL;
+    }
+    return first;
+}
+
+//Running. astRun() returns what lshExecute() does, 0 once the shell is to exit; a
+//break, continue or return is left in astFlow and every list on the way out stops.
+
+static void astOnInterrupt(int sig)
+{
+    (void) sig;
+    lshInterrupted = 1;
+    astCaught = 1;
+}
+
+static void astCatchInterrupt(bool on) //^C stops a loop, even one of builtins that has no child for it to reach
+{
+    if(!lshJobControl) return; //without job control ^C kills the shell, as it always has
+
+    if(on && astCatchDepth++ == 0)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = astOnInterrupt;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, &astSavedInterrupt); //children reset it, a caught signal does not survive exec
+    }
+    else if(!on && --astCatchDepth == 0)
+    {
+        sigaction(SIGINT, &astSavedInterrupt, NULL);
+        if(astCaught) printf("\n"); //Ctrl+C left the cursor after ^C
+        astCaught = 0;
+    }
+}
+
+static int astRunList(AstNode *n)
+{
+    int status = 1;
+
+    for(; n && status && astFlow == AST_FLOW_NONE && !lshInterrupted; n = n->next)
+    {
+        status = astRun(n);
+    }
+    return status;
+}
+
+static char **astExpand(char **words, const AstNode *n) //a copy of words with substitutions and wildcards expanded, valid until the marks are released
+{
+    int count = 0;
+    while(words[count]) count++;
+
+    int capacity = count + 1;
+    char **args = malloc(capacity * sizeof(char*));
+    if(!args)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(args, words, capacity * sizeof(char*)); //lshExecute() rearranges the array, never the words
+
+    if(n->subst) args = substExpand(&args, &capacity);
+    if(n->glob) args = globExpand(&args, &capacity);
+    return args;
+}
+
+static bool astLoopStop(void) //a jump or ^C reached the loop that is running, true when it ends here
+{
+    if(lshInterrupted || astFlow == AST_FLOW_RETURN) return true;
+    if(astFlow == AST_FLOW_NONE) return false;
+    if(--astFlowCount > 0) return true; //an outer loop is the target
+
+    bool stop = astFlow == AST_FLOW_BREAK;
+    astFlow = AST_FLOW_NONE;
+    return stop;
+}
+
+static int astRunLoop(AstNode *n) //while, until and for
+{
+    int status = 1, last = 0;
+    int substAt = substMark(), globAt = globMark();
+    char **values = NULL, **owned = NULL;
+    int count = 0;
+
+    if(n->kind == AST_FOR && n->words) //the words are expanded once, when the loop starts
+    {
+        values = owned = astExpand(n->words, n);
+        while(values[count]) count++;
+    }
+    else if(n->kind == AST_FOR) //no in: the positional parameters
+    {
+        values = varPositional(&count);
+    }
+
+    astLoopDepth++;
+    astCatchInterrupt(true);
+    for(int i = 0; status; i++)
+    {
+        if(n->kind == AST_FOR)
+        {
+            if(i >= count) break;
+            varSet(n->name, values[i], false);
+        }
+        else
+        {
+            status = astRunList(n->a);
+            if(!status || astLoopStop()) break;
+            if((lshLastStatus == 0) != (n->kind == AST_WHILE)) break;
+        }
+
+        status = astRunList(n->b);
+        last = lshLastStatus;
+        if(astLoopStop()) break;
+    }
+    astCatchInterrupt(false);
+    astLoopDepth--;
+
+    free(owned);
+    substReleaseTo(substAt);
+    globReleaseTo(globAt);
+    if(astFlow != AST_FLOW_RETURN) lshLastStatus = last;
+    return status;
+}
+
+static void astDefine(const char *name, AstNode *body);
+
+static int astRun(AstNode *n) //run one node, not the rest of its list
+{
+    int status = 1;
+
+    switch(n->kind)
+    {
+        case AST_CMD:
+        {
+            int substAt = substMark(), globAt = globMark();
+            char **args = astExpand(n->words, n);
+
+            astPrevStatus = lshLastStatus;
+            status = lshExecute(args);
+            if(lshJobControl && lshLastStatus == 128 + SIGINT) lshInterrupted = 1; //^C killed the command, the rest of the line stops too
+            free(args);
+            substReleaseTo(substAt); //the words of this command only, an enclosing for still needs its own
+            globReleaseTo(globAt);
+            break;
+        }
+        case AST_AND:
+        case AST_OR:
+            status = astRun(n->a);
+            if(status && astFlow == AST_FLOW_NONE && !lshInterrupted && (lshLastStatus == 0) == (n->kind == AST_AND))
+            {
+                status = astRun(n->b);
+            }
+            break;
+        case AST_NOT:
+            status = astRun(n->a);
+            lshLastStatus = !lshLastStatus;
+            break;
+        case AST_GROUP:
+            status = astRunList(n->a);
+            break;
+        case AST_IF:
+            status = astRunList(n->a);
+            if(!status || astFlow != AST_FLOW_NONE || lshInterrupted) break;
+
+            if(lshLastStatus == 0) status = astRunList(n->b);
+            else if(n->c) status = astRunList(n->c);
+            else lshLastStatus = 0; //no branch taken
+            break;
+        case AST_WHILE:
+        case AST_UNTIL:
+        case AST_FOR:
+            status = astRunLoop(n);
+            break;
+        case AST_FUNC:
+            astDefine(n->name, n->a);
+            lshLastStatus = 0;
+            break;
+    }
+    return status;
+}
+
+int astRunTokens(char **tokens, LineSource *src) //parse the command that starts with tokens, reading the rest of it from src, and run it
+{
+    AstParser p = { .src = src, .toks = tokens, .aliased = true };
+    AstNode *tree = astParseList(&p, NULL);
+
+    free(p.buf);
+    free(p.spliced);
+    if(p.error) return 1;
+
+    int status = astRunList(tree);
+    astFlow = AST_FLOW_NONE; //a break with no loop to leave
+    astFree(tree); //functions it defined hold on to their bodies
+    return status;
+}
+
+//Functions
+
+static AstFunc *astFuncSlot(AstFuncTable *t, const char *name) //the slot holding name, or the empty slot where it belongs
+{
+    size_t mask = t->capacity - 1;
+    size_t i = varHash(name, strlen(name)) & mask;
+
+    while(t->slots[i].name && strcmp(t->slots[i].name, name) != 0) //linear probing
+    {
+        i = (i + 1) & mask;
+    }
+    return &t->slots[i];
+}
+
+static void astFuncGrow(AstFuncTable *t)
+{
+    AstFuncTable bigger = *t;
+    bigger.capacity = t->capacity ? t->capacity * 2 : AST_FUNC_INITIAL;
+    bigger.slots = calloc(bigger.capacity, sizeof(AstFunc));
+
+    if(!bigger.slots)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < t->capacity; i++)
+    {
+        if(t->slots[i].name)
+        {
+            *astFuncSlot(&bigger, t->slots[i].name) = t->slots[i];
+        }
+    }
+
+    free(t->slots);
+    *t = bigger;
+}
+
+static void astDefine(const char *name, AstNode *body) //name runs body from now on
+{
+    if((astFuncs.size + 1) * 4 > astFuncs.capacity * 3) //keep the load factor under 3/4
+    {
+        astFuncGrow(&astFuncs);
+    }
+
+    AstFunc *f = astFuncSlot(&astFuncs, name);
+    body->refs++; //the tree the definition came from may be freed before the function runs
+    if(f->name)
+    {
+        astFree(f->body);
+    }
+    else
+    {
+        f->name = astDup(name);
+        astFuncs.size++;
+    }
+    f->body = body;
+}
+
+AstFunc *astFindFunc(const char *name) //the function called name, NULL if there is none
+{
+    if(astFuncs.size == 0 || !name) return NULL; //the usual case costs one comparison
+
+    AstFunc *f = astFuncSlot(&astFuncs, name);
+    return f->name ? f : NULL;
+}
+
+int astCall(AstFunc *fn, char **args) //run fn with args[1]... as $1...
+{
+    AstNode *body = fn->body;
+    char **params = args + 1;
+    int count = 0;
+    int loopDepth = astLoopDepth;
+
+    while(params[count]) count++;
+
+    body->refs++; //the function may redefine itself while it runs
+    varSwapArgs(&params, &count);
+    astCallDepth++;
+    astLoopDepth = 0; //break and continue do not reach the caller's loops
+
+    lshLastStatus = 0;
+    int status = astRun(body);
+    if(astFlow == AST_FLOW_RETURN) astFlow = AST_FLOW_NONE;
+
+    astLoopDepth = loopDepth;
+    astCallDepth--;
+    varSwapArgs(&params, &count);
+    astFree(body);
+    return status;
+}
+
+pid_t astSpawnFunc(AstFunc *fn, char **args, const LaunchIO *io) //run a function in a forked child, for a pipeline stage or a background job
+{
+    pid_t pid = launchFork(io);
+
+    if(pid == 0)
+    {
+        lshJobControl = false; //the child is in the job's process group already
+        astCall(fn, args);
+        fflush(stdout);
+        _exit(lshLastStatus); //exit only ends the child
+    }
+    return pid;
+}
+
+//Sourced scripts
+
+static AstNode *astLoadScript(const char *path) //the parsed script at path, from the cache while the file is unchanged; NULL on error
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "source: %s: %s\n", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return NULL;
+    }
+
+    AstCacheEntry *e = NULL, *victim = &astCache[0];
+    for(int i = 0; i < AST_CACHE_MAX && !e; i++)
+    {
+        if(astCache[i].path && strcmp(astCache[i].path, path) == 0) e = &astCache[i];
+        else if(victim->path && (!astCache[i].path || astCache[i].lastUse < victim->lastUse)) victim = &astCache[i];
+    }
+
+    if(e && e->dev == st.st_dev && e->ino == st.st_ino && e->size == st.st_size &&
+       e->mtime.tv_sec == st.st_mtim.tv_sec && e->mtime.tv_nsec == st.st_mtim.tv_nsec)
+    {
+        close(fd);
+        e->lastUse = ++astCacheClock;
+        return e->tree;
+    }
+
+    LineSource src;
+    lineSourceInit(&src, fd, false); //mapped whole, like a script given to the shell
+    AstNode *tree = astNode(AST_GROUP), **tail = &tree->a;
+    int capacity = LSH_TOK_BUFSIZE;
+    char **toks = malloc(capacity * sizeof(char*));
+    char *line;
+
+    if(!toks)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while((line = lshNextLine(&src)))
+    {
+        if(isComment(line)) continue;
+
+        toks = lshTokenize(line, &toks, &capacity);
+        AstParser p = { .src = &src, .toks = toks };
+        AstNode *list = astParseList(&p, NULL);
+        free(p.buf);
+        free(p.spliced);
+
+        if(p.error) //nothing of a script with a syntax error runs
+        {
+            astFree(tree);
+            tree = NULL;
+            break;
+        }
+        *tail = list;
+        while(*tail) tail = &(*tail)->next;
+    }
+    free(toks);
+    lineSourceClose(&src); //the tree has copies of everything, closes fd too
+
+    if(!tree) return NULL;
+
+    if(!e)
+    {
+        e = victim;
+        free(e->path);
+        e->path = astDup(path);
+    }
+    if(e->tree) astFree(e->tree); //a copy that is still running keeps its own reference
+    e->tree = tree;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->size = st.st_size;
+    e->mtime = st.st_mtim;
+    e->lastUse = ++astCacheClock;
+    return tree;
+}
+
+//Builtins
+
+int lshTrue(char **args)
+{
+    lshLastStatus = 0;
+    return 1;
+}
+
+int lshFalse(char **args)
+{
+    lshLastStatus = 1;
+    return 1;
+}
+
+int lshSource(char **args) //source file [args...], and . file
+{
+    if(args[1] == NULL)
+    {
+        fprintf(stderr, "source: filename argument required\n");
+        lshLastStatus = 2;
+        return 1;
+    }
+
+    AstNode *tree = astLoadScript(args[1]);
+    if(!tree)
+    {
+        lshLastStatus = 1;
+        return 1;
+    }
+
+    char **params = args + 2;
+    int count = 0;
+    int loopDepth = astLoopDepth;
+    while(params[count]) count++;
+
+    bool ownArgs = count > 0; //without arguments the script sees the caller's
+    tree->refs++; //sourcing a changed copy of itself replaces the cached tree
+    if(ownArgs) varSwapArgs(&params, &count);
+    astCallDepth++;
+    astLoopDepth = 0;
+
+    lshLastStatus = 0;
+    int status = astRun(tree);
+    if(astFlow == AST_FLOW_RETURN) astFlow = AST_FLOW_NONE;
+
+    astLoopDepth = loopDepth;
+    astCallDepth--;
+    if(ownArgs) varSwapArgs(&params, &count);
+    astFree(tree);
+    return status;
+}
+
+int lshDot(char **args) //. file, the POSIX name of source
+{
+    return lshSource(args);
+}
+
+int lshReturn(char **args) //return [n]
+{
+    if(astCallDepth == 0)
+    {
+        fprintf(stderr, "return: can only `return' from a function or sourced script\n");
+        lshLastStatus = 1;
+        return 1;
+    }
+
+    lshLastStatus = args[1] ? atoi(args[1]) & 255 : astPrevStatus;
+    astFlow = AST_FLOW_RETURN;
+    return 1;
+}
+
+static int astJump(char **args, AstFlow flow) //break [n] and continue [n]
+{
+    int n = args[1] ? atoi(args[1]) : 1;
+
+    if(n < 1)
+    {
+        fprintf(stderr, "%s: %s: loop count out of range\n", args[0], args[1]);
+        lshLastStatus = 1;
+        return 1;
+    }
+    if(astLoopDepth == 0)
+    {
+        fprintf(stderr, "%s: only meaningful in a `for', `while', or `until' loop\n", args[0]);
+        return 1;
+    }
+
+    astFlow = flow;
+    astFlowCount = n < astLoopDepth ? n : astLoopDepth;
+    return 1;
+}
+
+int lshBreak(char **args)
+{
+    return astJump(args, AST_FLOW_BREAK);
+}
+
+int lshContinue(char **args)
+{
+    return astJump(args, AST_FLOW_CONTINUE);
+}
+
+void astFreeAll(void)
+{
+    for(size_t i = 0; i < astFuncs.capacity; i++)
+    {
+        if(!astFuncs.slots[i].name) continue;
+        free(astFuncs.slots[i].name);
+        astFree(astFuncs.slots[i].body);
+    }
+    free(astFuncs.slots);
+    memset(&astFuncs, 0, sizeof(astFuncs));
+
+    for(int i = 0; i < AST_CACHE_MAX; i++)
+    {
+        free(astCache[i].path);
+        astFree(astCache[i].tree);
+    }
+    memset(astCache, 0, sizeof(astCache));
+}
@@ -0,0 +1,267 @@
+#include "lsh.h"
+
+//The audit log. Setting LSH_AUDIT_LOG to a path turns it on: every command
+//lshExecute() runs becomes one JSON line with its start time, duration, status and,
+//for each process it started, the pid, how it ended and its rusage. Records are
+//formatted into an in-memory ring and a writer thread appends them to the file in
+//large batches, once AUDIT_FLUSH_AT bytes are waiting or when the prompt comes back,
+//so the command path never waits on the disk. When the writer falls behind and the
+//ring is full, records are dropped and the next one that fits says how many.
+
+bool auditOn; //LSH_AUDIT_LOG is set and the file is open
+static AuditLog audit = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER };
+
+static void *auditWriter(void *arg) //drain the ring into the file
+{
+    (void) arg;
+
+    pthread_mutex_lock(&audit.lock);
+    for(;;)
+    {
+        size_t waiting = audit.head - audit.tail;
+
+        if(waiting == 0 && audit.stop) break;
+        if(waiting == 0 || (waiting < AUDIT_FLUSH_AT && !audit.flush && !audit.stop))
+        {
+            pthread_cond_wait(&audit.work, &audit.lock);
+            continue;
+        }
+        audit.flush = false;
+
+        size_t at = audit.tail % AUDIT_RING_SIZE; //the batch may wrap around the end of the ring
+        struct iovec iov[2] = {
+            { audit.ring + at, waiting < AUDIT_RING_SIZE - at ? waiting : AUDIT_RING_SIZE - at },
+            { audit.ring, 0 }
+        };
+        iov[1].iov_len = waiting - iov[0].iov_len;
+        pthread_mutex_unlock(&audit.lock); //the shell keeps adding records meanwhile
+
+        size_t done = 0;
+        while(done < waiting)
+        {
+            ssize_t n = writev(audit.fd, iov, iov[1].iov_len ? 2 : 1);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) //a full disk or a revoked file: the batch is lost, the shell goes on
+            {
+                done = waiting;
+                break;
+            }
+            done += n;
+            if((size_t) n >= iov[0].iov_len) //what is left is in the second part
+            {
+                n -= iov[0].iov_len;
+                iov[0] = iov[1];
+                iov[1].iov_len = 0;
+            }
+            iov[0].iov_base = (char*) iov[0].iov_base + n;
+            iov[0].iov_len -= n;
+        }
+
+        pthread_mutex_lock(&audit.lock);
+        audit.tail += done;
+    }
+    pthread_mutex_unlock(&audit.lock);
+    return NULL;
+}
+
+static void auditForked(void) //a forked child has the ring but not the writer, it logs nothing
+{
+    auditOn = false;
+    audit.fd = -1;
+}
+
+void auditClose(void) //write out what is waiting and stop logging
+{
+    if(audit.fd < 0) return;
+
+    pthread_mutex_lock(&audit.lock);
+    audit.stop = true;
+    pthread_cond_signal(&audit.work);
+    pthread_mutex_unlock(&audit.lock);
+    pthread_join(audit.writer, NULL);
+
+    close(audit.fd);
+    audit.fd = -1;
+    audit.stop = false;
+    audit.head = audit.tail = 0;
+    audit.dropped = 0;
+    free(audit.ring);
+    audit.ring = NULL;
+    auditOn = false;
+}
+
+void auditOpen(const char *path) //log to path from now on, NULL or "" turns the log off
+{
+    static bool registered;
+
+    auditClose();
+    if(!path || !path[0]) return;
+
+    if(!registered)
+    {
+        pthread_atfork(NULL, NULL, auditForked);
+        registered = true;
+    }
+
+    audit.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600); //O_APPEND keeps batches from several shells whole
+    if(audit.fd < 0)
+    {
+        fprintf(stderr, "lsh: LSH_AUDIT_LOG: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    audit.ring = malloc(AUDIT_RING_SIZE);
+    if(!audit.ring)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old); //signals are for the shell's own thread
+    int err = pthread_create(&audit.writer, NULL, auditWriter, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(err != 0)
+    {
+        fprintf(stderr, "lsh: audit: %s\n", strerror(err));
+        close(audit.fd);
+        audit.fd = -1;
+        free(audit.ring);
+        audit.ring = NULL;
+        return;
+    }
+    auditOn = true;
+}
+
+void auditFlush(void) //the prompt is back: have the writer take whatever is waiting
+{
+    if(!auditOn) return;
+
+    pthread_mutex_lock(&audit.lock);
+    if(audit.head != audit.tail)
+    {
+        audit.flush = true;
+        pthread_cond_signal(&audit.work);
+    }
+    pthread_mutex_unlock(&audit.lock);
+}
+
+static bool auditPut(const char *rec, size_t len) //add one record to the ring, never waiting for the writer; false when it is full
+{
+    pthread_mutex_lock(&audit.lock);
+    bool fits = len <= AUDIT_RING_SIZE - (audit.head - audit.tail);
+    if(!fits)
+    {
+        audit.dropped++;
+    }
+    else
+    {
+        size_t at = audit.head % AUDIT_RING_SIZE;
+        size_t first = len < AUDIT_RING_SIZE - at ? len : AUDIT_RING_SIZE - at;
+        memcpy(audit.ring + at, rec, first);
+        memcpy(audit.ring, rec + first, len - first);
+        audit.head += len;
+        if(audit.head - audit.tail >= AUDIT_FLUSH_AT) pthread_cond_signal(&audit.work);
+    }
+    pthread_mutex_unlock(&audit.lock);
+    return fits;
+}
+
+void auditBegin(char **args) //lshExecute() is about to run args
+{
+    if(++audit.depth > AUDIT_DEPTH_MAX) return; //nested too deep, only the outer commands are logged
+
+    AuditEvent *e = &audit.events[audit.depth - 1];
+    clock_gettime(CLOCK_REALTIME, &e->start);
+    e->startNs = timingNow();
+    e->numStages = 0;
+    e->background = false;
+    e->cmdLen = 0;
+
+    for(int i = 0; args[i] && e->cmdLen < AUDIT_CMD_MAX - 1; i++) //the words as they are now, redirections still in
+    {
+        if(i > 0) e->cmd[e->cmdLen++] = ' ';
+        size_t len = strlen(args[i]);
+        if(len > AUDIT_CMD_MAX - 1 - e->cmdLen) len = AUDIT_CMD_MAX - 1 - e->cmdLen;
+        memcpy(e->cmd + e->cmdLen, args[i], len);
+        e->cmdLen += len;
+    }
+}
+
+void auditJob(const Job *j) //the processes of a job the current command started or waited for
+{
+    if(audit.depth < 1 || audit.depth > AUDIT_DEPTH_MAX) return;
+
+    AuditEvent *e = &audit.events[audit.depth - 1];
+    e->background |= j->background;
+    for(int i = 0; i < j->numProcs && e->numStages < AUDIT_STAGES_MAX; i++)
+    {
+        const JobProcess *p = &j->procs[i];
+        AuditStage *s = &e->stages[e->numStages++];
+        s->pid = p->pid;
+        s->status = p->status;
+        s->done = p->done;
+        s->usage = p->usage;
+    }
+}
+
+static char *auditEscape(char *w, const char *s, size_t len) //JSON string contents, w needs 6 bytes per byte of s
+{
+    for(size_t i = 0; i < len; i++)
+    {
+        unsigned char c = s[i];
+        if(c == '"' || c == '\\')
+        {
+            *w++ = '\\';
+            *w++ = c;
+        }
+        else if(c == '\n')
+        {
+            *w++ = '\\';
+            *w++ = 'n';
+        }
+        else if(c < 0x20 || c == 0x7f) w += sprintf(w, "\\u%04x", c);
+        else *w++ = c;
+    }
+    return w;
+}
+
+static double auditMs(struct timeval tv)
+{
+    return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+void auditEnd(void) //lshExecute() is done with the command auditBegin() saw, log it
+{
+    if(audit.depth-- > AUDIT_DEPTH_MAX || !auditOn) return; //unset LSH_AUDIT_LOG closed the log under it
+
+    AuditEvent *e = &audit.events[audit.depth];
+    char rec[AUDIT_RECORD_MAX];
+    char *w = rec;
+    char *end = rec + sizeof(rec);
+
+    w += snprintf(w, end - w, "{\"start\":%lld.%06ld,\"ms\":%.3f,\"cmd\":\"",
+                  (long long) e->start.tv_sec, e->start.tv_nsec / 1000, (timingNow() - e->startNs) / 1e6);
+    w = auditEscape(w, e->cmd, e->cmdLen); //AUDIT_RECORD_MAX has room for the worst case
+    w += snprintf(w, end - w, "\",\"status\":%d%s,\"stages\":[", lshLastStatus, e->background ? ",\"background\":true" : "");
+
+    for(int i = 0; i < e->numStages; i++)
+    {
+        const AuditStage *s = &e->stages[i];
+        w += snprintf(w, end - w, "%s{\"pid\":%d", i > 0 ? "," : "", (int) s->pid);
+        if(s->done)
+        {
+            if(WIFSIGNALED(s->status)) w += snprintf(w, end - w, ",\"signal\":%d", WTERMSIG(s->status));
+            else w += snprintf(w, end - w, ",\"exit\":%d", WEXITSTATUS(s->status));
+            w += snprintf(w, end - w, ",\"user_ms\":%.3f,\"sys_ms\":%.3f,\"maxrss_kb\":%ld",
+                          auditMs(s->usage.ru_utime), auditMs(s->usage.ru_stime), s->usage.ru_maxrss);
+        }
+        w += snprintf(w, end - w, "}");
+    }
+
+    unsigned long dropped = audit.dropped; //only this thread changes it
+    if(dropped > 0) w += snprintf(w, end - w, "],\"dropped\":%lu}\n", dropped);
+    else w += snprintf(w, end - w, "]}\n");
+
+    if(auditPut(rec, w - rec)) audit.dropped -= dropped; //counted in this record
+}
@@ -0,0 +1,130 @@
+#!/bin/sh
+# End-to-end benchmarks: scripted workloads are piped into lsh and timed from the
+# outside. Prints one JSON object per line, like bench/microbench.
+#   LSH=./lsh REV=abc123 sh bench/e2e.sh
+
+LSH=${LSH:-./lsh}
+REV=${REV:-unknown}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+now() { date +%s%N; }
+
+report() { # name value unit
+    printf '{"rev":"%s","bench":"%s","value":%s,"unit":"%s"}\n' "$REV" "$1" "$2" "$3"
+}
+
+repeat() { # count line
+    i=0
+    while [ "$i" -lt "$1" ]; do
+        echo "$2"
+        i=$((i + 1))
+    done
+}
+
+rate_with() { # shell name count line: commands per second for count copies of line run by shell
+    repeat "$3" "$4" > "$TMP/script"
+    start=$(now)
+    "$1" < "$TMP/script" > /dev/null
+    end=$(now)
+    report "$2" "$(awk -v n="$3" -v ns="$((end - start))" 'BEGIN { printf "%.1f", n / (ns / 1e9) }')" "cmds/s"
+}
+
+rate() { # name count line
+    rate_with "$LSH" "$@"
+}
+
+rate e2e.builtin 50000 "echo hello world"
+rate e2e.external 2000 "/bin/true"
+rate e2e.pipeline 1000 "echo hello | cat"
+rate e2e.pipeline3 1000 "/bin/echo hello | cat | cat"
+
+throughput() { # name MB line: MB/s for a line that moves MB megabytes
+    echo "$3" > "$TMP/script"
+    start=$(now)
+    "$LSH" < "$TMP/script" > /dev/null
+    end=$(now)
+    report "$1" "$(awk -v mb="$2" -v ns="$((end - start))" 'BEGIN { printf "%.1f", mb / (ns / 1e9) }')" "MB/s"
+}
+
+# bulk data through a three stage pipeline
+MB=1024
+throughput e2e.pipe_throughput "$MB" "head -c ${MB}M /dev/zero | /bin/cat | wc -c"
+
+# four stages with the default 64 KiB pipes, then with set -o bigpipes
+for opt in + -; do
+    [ "$opt" = - ] && name=bigpipes || name=default
+    throughput "e2e.pipe4.$name" "$MB" "set ${opt}o bigpipes
+head -c ${MB}M /dev/zero | /bin/cat | /bin/cat | wc -c"
+done
+
+# builtin cat/cp against the external binaries, over one file in the page cache
+head -c "${MB}M" /dev/urandom > "$TMP/data"
+throughput e2e.cat.file.builtin "$MB" "cat $TMP/data > $TMP/copy"
+throughput e2e.cat.file.external "$MB" "/bin/cat $TMP/data > $TMP/copy"
+throughput e2e.cat.pipe.builtin "$MB" "cat $TMP/data | wc -c"
+throughput e2e.cat.pipe.external "$MB" "/bin/cat $TMP/data | wc -c"
+throughput e2e.cp.builtin "$MB" "cp $TMP/data $TMP/copy"
+throughput e2e.cp.external "$MB" "/bin/cp $TMP/data $TMP/copy"
+
+# small files, where the fork+exec the builtin saves is most of the cost
+echo hello > "$TMP/small"
+rate e2e.cat.small.builtin 2000 "cat $TMP/small"
+rate e2e.cat.small.external 2000 "/bin/cat $TMP/small"
+
+# parallel keeping one /bin/true per online CPU running
+echo "seq 1 2000 | parallel /bin/true" > "$TMP/script"
+start=$(now)
+"$LSH" < "$TMP/script" > /dev/null
+end=$(now)
+report e2e.parallel "$(awk -v ns="$((end - start))" 'BEGIN { printf "%.1f", 2000 / (ns / 1e9) }')" "jobs/s"
+
+# command substitution: a builtin runs in the shell with no fork, an external one
+# is spawned with its stdout on a pipe; bash runs the same lines for comparison
+rate e2e.subst.builtin 20000 'echo $(pwd)'
+rate e2e.subst.external 2000 'echo $(/bin/pwd)'
+loop_with() { # shell name iterations script: commands per second for a loop run by shell, two commands an iteration
+    echo "$4" > "$TMP/script"
+    start=$(now)
+    "$1" < "$TMP/script" > /dev/null
+    end=$(now)
+    report "$2" "$(awk -v n="$(($3 * 2))" -v ns="$((end - start))" 'BEGIN { printf "%.1f", n / (ns / 1e9) }')" "cmds/s"
+}
+
+loop_with "$LSH" e2e.subst.assign_loop 20000 'for i in $(seq 20000); do x=$(pwd); true; done'
+if command -v bash > /dev/null; then
+    rate_with bash e2e.subst.builtin.bash 20000 'echo $(pwd)'
+    rate_with bash e2e.subst.external.bash 2000 'echo $(/bin/pwd)'
+    loop_with bash e2e.subst.assign_loop.bash 20000 'for i in $(seq 20000); do x=$(pwd); true; done'
+fi
+
+# a loop body is parsed once and run from its tree, never tokenized again
+loop_with "$LSH" e2e.loop.builtins 1000000 'for i in $(seq 1000000); do true; x=$i; done'
+if command -v bash > /dev/null; then
+    loop_with bash e2e.loop.builtins.bash 1000000 'for i in $(seq 1000000); do true; x=$i; done'
+fi
+
+# removing a tree of 100 directories of 1000 files: the rm builtin batches unlinkat()
+# through io_uring (or its thread pool with set +o io_uring), against /bin/rm -rf
+tree() { # dir
+    mkdir -p "$1"
+    for d in $(seq 100); do
+        mkdir "$1/d$d"
+        (cd "$1/d$d" && seq 1000 | xargs touch)
+    done
+}
+
+remove() { # name line
+    tree "$TMP/tree"
+    sync
+    echo "$2" > "$TMP/script"
+    start=$(now)
+    "$LSH" < "$TMP/script"
+    end=$(now)
+    report "$1" "$(awk -v ns="$((end - start))" 'BEGIN { printf "%.1f", ns / 1e6 }')" "ms"
+}
+
+remove e2e.rm_tree.io_uring "rm -r $TMP/tree"
+remove e2e.rm_tree.threads "set +o io_uring
+rm -r $TMP/tree"
+remove e2e.rm_tree.external "/bin/rm -rf $TMP/tree"
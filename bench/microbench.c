@@ -0,0 +1,376 @@
+#include "../lsh.c"
+#include <glob.h>
+
+//Microbenchmarks for the shell's hot paths. The whole shell is compiled in (with
+//LSH_NO_MAIN), so these call the same functions lshLoop does. Every result is one
+//JSON object per line on stdout: {"rev":..., "bench":..., "value":..., "unit":...}
+
+static const char *benchRev = "unknown";
+
+static void benchReport(const char *name, double value, const char *unit)
+{
+    printf("{\"rev\":\"%s\",\"bench\":\"%s\",\"value\":%.3f,\"unit\":\"%s\"}\n", benchRev, name, value, unit);
+    fflush(stdout);
+}
+
+static void benchTokenize(const char *name, const char *line, long iterations)
+{
+    size_t len = strlen(line);
+    char *buf = malloc(len + 1);
+    int capacity = LSH_TOK_BUFSIZE;
+    char **tokens = malloc(capacity * sizeof(char*));
+    long numTokens = 0;
+
+    uint64_t start = timingNow();
+    for(long i = 0; i < iterations; i++)
+    {
+        memcpy(buf, line, len + 1); //the tokenizer works in place
+        tokens = lshTokenize(buf, &tokens, &capacity);
+        for(char **t = tokens; *t; t++) numTokens++;
+    }
+    uint64_t ns = timingNow() - start;
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s.ns_per_line", name);
+    benchReport(label, (double) ns / iterations, "ns");
+    snprintf(label, sizeof(label), "%s.throughput", name);
+    benchReport(label, (double) len * iterations / (ns / 1e9) / 1e6, "MB/s");
+    snprintf(label, sizeof(label), "%s.tokens", name);
+    benchReport(label, numTokens / (ns / 1e9) / 1e6, "Mtok/s");
+
+    free(tokens);
+    free(buf);
+}
+
+static void benchSplitLine(void)
+{
+    benchTokenize("tokenize.short", "ls -la /usr/bin | grep \"foo bar\" > out.txt &", 2000000);
+
+    size_t size = 1 << 20; //one long line of mixed words, quotes and operators
+    char *line = malloc(size + 1);
+    const char *piece = "word \"quoted text\" 'single' a|b <in >out x\"y\"z ";
+    size_t pieceLen = strlen(piece), used = 0;
+
+    while(used + pieceLen <= size)
+    {
+        memcpy(line + used, piece, pieceLen);
+        used += pieceLen;
+    }
+    line[used] = '\0';
+
+    benchTokenize("tokenize.long", line, 50);
+    free(line);
+}
+
+static void benchHistory(void)
+{
+    History h;
+    char line[64];
+    long iterations = 2000000;
+
+    historyInit(&h); //histFile is closed, so this is the ring alone
+    uint64_t start = timingNow();
+    for(long i = 0; i < iterations; i++)
+    {
+        snprintf(line, sizeof(line), "git commit -m \"change %ld\"", i);
+        historyAdd(&h, line);
+    }
+    uint64_t ns = timingNow() - start;
+    benchReport("history.add", (double) ns / iterations, "ns");
+
+    FILE *realStdout = stdout;
+    long prints = 100;
+
+    stdout = fopen("/dev/null", "w");
+    start = timingNow();
+    for(long i = 0; i < prints; i++)
+    {
+        historyPrint(&h);
+    }
+    ns = timingNow() - start;
+    fclose(stdout);
+    stdout = realStdout;
+    benchReport("history.print", (double) ns / (prints * h.size), "ns/entry");
+
+    historyFree(&h);
+}
+
+static void benchHistorySearch(void) //trigram index against a scan of every entry, over 200000 entries
+{
+    History h;
+    char line[96];
+
+    varSet("HISTSIZE", "200000", true);
+    historyInit(&h);
+    varUnset("HISTSIZE");
+
+    for(long i = 0; i < 200000; i++)
+    {
+        snprintf(line, sizeof(line), "git commit -m \"change %ld\" && make -j%ld test-%lx", i, i % 16, i * 2654435761u);
+        historyStore(&h, line, strlen(line));
+    }
+    benchReport("history.bytes_per_entry", (double) (h.textCap + h.capacity * sizeof(HistEntry) + h.dedupCap * sizeof(uint32_t)) / h.size, "bytes");
+
+    const char *patterns[] = { "test-1234", "change 19999", "-j7 test-ff", "nothing like this" };
+    int numPatterns = sizeof(patterns) / sizeof(patterns[0]);
+    long iterations = 200;
+    volatile unsigned long sink = 0;
+
+    uint64_t start = timingNow();
+    sink += historySearch(&h, "first", h.total + 1); //builds the index
+    benchReport("history.index_build", (timingNow() - start) / 1e6, "ms");
+
+    start = timingNow();
+    for(long i = 0; i < iterations; i++)
+    {
+        sink += historySearch(&h, patterns[i % numPatterns], h.total + 1);
+    }
+    benchReport("history.search.indexed", (timingNow() - start) / 1e3 / iterations, "us");
+
+    start = timingNow();
+    for(long i = 0; i < iterations; i++) //what every keystroke of a search cost without the index
+    {
+        for(unsigned long num = h.total; num > h.total - h.size; num--)
+        {
+            if(strstr(historyEntry(&h, num), patterns[i % numPatterns]))
+            {
+                sink += num;
+                break;
+            }
+        }
+    }
+    benchReport("history.search.scan", (timingNow() - start) / 1e3 / iterations, "us");
+    (void) sink;
+
+    historyFree(&h);
+}
+
+static void benchDispatch(void)
+{
+    const char *names[] = { "cd", "echo", "history", "wait", "ls", "grep", "git", "cat", "make", "pwd" }; //hits and misses
+    int numNames = sizeof(names) / sizeof(names[0]);
+    long iterations = 10000000;
+    volatile int sink = 0;
+
+    uint64_t start = timingNow();
+    for(long i = 0; i < iterations; i++)
+    {
+        sink += lshFindBuiltin(names[i % numNames]);
+    }
+    uint64_t ns = timingNow() - start;
+    (void) sink;
+
+    benchReport("dispatch.find_builtin", (double) ns / iterations, "ns");
+}
+
+static void benchVars(void) //setting an exported variable and expanding one, the environment stays ready for spawns
+{
+    long iterations = 1000000;
+    char value[32];
+    volatile size_t sink = 0;
+
+    uint64_t start = timingNow();
+    for(long i = 0; i < iterations; i++)
+    {
+        snprintf(value, sizeof(value), "%ld", i);
+        varSet("LSH_BENCH_VAR", value, true);
+    }
+    benchReport("vars.export_set", (double) (timingNow() - start) / iterations, "ns");
+
+    start = timingNow();
+    for(long i = 0; i < iterations; i++)
+    {
+        sink += strlen(varLookup("LSH_BENCH_VAR", 13));
+    }
+    benchReport("vars.lookup", (double) (timingNow() - start) / iterations, "ns");
+    (void) sink;
+
+    varUnset("LSH_BENCH_VAR");
+}
+
+static void benchComplete(void) //command completion over a $PATH directory of 30000 executables
+{
+    char dir[] = "/tmp/lsh-bench-XXXXXX";
+    int numFiles = 30000;
+
+    if(!mkdtemp(dir)) return;
+    for(int i = 0; i < numFiles; i++)
+    {
+        char name[PATH_MAX];
+        snprintf(name, sizeof(name), "%s/cmd%c%05d", dir, 'a' + i % 26, i);
+        int fd = open(name, O_WRONLY | O_CREAT, 0755);
+        if(fd >= 0) close(fd);
+    }
+
+    char *oldPath = varGet("PATH") ? strdup(varGet("PATH")) : NULL;
+    Completion c = { 0 };
+    varSet("PATH", dir, true);
+
+    uint64_t start = timingNow();
+    completeWord("cmd", true, &c); //first TAB builds the index
+    benchReport("complete.build", (timingNow() - start) / 1e3, "us");
+
+    const char *prefixes[] = { "cmdq", "cmdb0", "cmdz2999", "x", "cmd" };
+    long iterations = 2000;
+    long found = 0;
+
+    start = timingNow();
+    for(long i = 0; i < iterations; i++) //each TAB re-checks the directory mtime
+    {
+        completeWord(prefixes[i % 5], true, &c);
+        found += c.count;
+    }
+    benchReport("complete.command", (timingNow() - start) / 1e3 / iterations, "us");
+    benchReport("complete.candidates", (double) found / iterations, "names");
+
+    start = timingNow();
+    for(long i = 0; i < iterations; i++)
+    {
+        char word[PATH_MAX];
+        snprintf(word, sizeof(word), "%s/cmdk", dir);
+        completeWord(word, false, &c);
+    }
+    benchReport("complete.path", (timingNow() - start) / 1e3 / iterations, "us");
+
+    if(oldPath)
+    {
+        varSet("PATH", oldPath, true);
+        free(oldPath);
+    }
+    free(c.items);
+    completeFree();
+
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if(system(cmd) != 0) fprintf(stderr, "microbench: could not remove %s\n", dir);
+}
+
+static long benchGlobLsh(const char *pattern, long *count) //ns to expand one word, with the marker bytes the tokenizer would leave
+{
+    int capacity = LSH_TOK_BUFSIZE;
+    char **tokens = malloc(capacity * sizeof(char*));
+    char *word = strdup(pattern);
+
+    for(char *p = word; *p; p++)
+    {
+        if(*p == '*') *p = LSH_GLOB_STAR;
+    }
+    tokens[0] = word;
+    tokens[1] = NULL;
+
+    uint64_t start = timingNow();
+    tokens = globExpand(&tokens, &capacity);
+    long ns = timingNow() - start;
+
+    for(*count = 0; tokens[*count]; (*count)++);
+    globRelease();
+    free(tokens);
+    free(word);
+    return ns;
+}
+
+static long benchGlobLibc(const char *pattern, long *count)
+{
+    glob_t g;
+
+    uint64_t start = timingNow();
+    int err = glob(pattern, 0, NULL, &g);
+    long ns = timingNow() - start;
+
+    *count = err == 0 ? (long) g.gl_pathc : 0;
+    globfree(&g);
+    return ns;
+}
+
+static void benchGlob(void) //* and *7* in a directory of $LSH_BENCH_GLOB_FILES files (100000 by default), against glibc glob()
+{
+    char dir[] = "/tmp/lsh-bench-XXXXXX";
+    long numFiles = getenv("LSH_BENCH_GLOB_FILES") ? atol(getenv("LSH_BENCH_GLOB_FILES")) : 100000;
+
+    if(!mkdtemp(dir)) return;
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+    for(long i = 0; i < numFiles; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "file%07ld.log", (i * 7919) % numFiles); //created out of order
+        int fd = openat(dirfd, name, O_WRONLY | O_CREAT, 0644);
+        if(fd >= 0) close(fd);
+    }
+    close(dirfd);
+
+    const char *patterns[][2] = { { "star", "*" }, { "filter", "*7*" } };
+    for(int i = 0; i < 2; i++)
+    {
+        char pattern[PATH_MAX], label[64];
+        long lshCount, libcCount;
+        snprintf(pattern, sizeof(pattern), "%s/%s", dir, patterns[i][1]);
+
+        benchGlobLsh(pattern, &lshCount); //warm the dentry cache for both
+        long lshNs = benchGlobLsh(pattern, &lshCount);
+        long libcNs = benchGlobLibc(pattern, &libcCount);
+
+        if(lshCount != libcCount) fprintf(stderr, "microbench: glob %s found %ld, glob() %ld\n", patterns[i][1], lshCount, libcCount);
+        snprintf(label, sizeof(label), "glob.%s.lsh", patterns[i][0]);
+        benchReport(label, lshNs / 1e6, "ms");
+        snprintf(label, sizeof(label), "glob.%s.libc", patterns[i][0]);
+        benchReport(label, libcNs / 1e6, "ms");
+    }
+
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if(system(cmd) != 0) fprintf(stderr, "microbench: could not remove %s\n", dir);
+}
+
+static int compareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void benchSpawn(const char *name, int usePosixSpawn) //latency of launching and reaping /bin/true
+{
+    int iterations = 2000;
+    uint64_t *samples = malloc(iterations * sizeof(uint64_t));
+    char *args[] = { "/bin/true", NULL };
+    int old = lshUsePosixSpawn;
+
+    lshUsePosixSpawn = usePosixSpawn;
+    for(int i = 0; i < iterations; i++)
+    {
+        int status;
+        uint64_t start = timingNow();
+        pid_t pid = lshSpawn(args, NULL);
+
+        if(pid > 0) waitpid(pid, &status, 0);
+        samples[i] = timingNow() - start;
+    }
+    lshUsePosixSpawn = old;
+
+    qsort(samples, iterations, sizeof(uint64_t), compareU64);
+
+    char label[64];
+    int percentiles[] = { 50, 90, 99 };
+    for(int i = 0; i < 3; i++)
+    {
+        snprintf(label, sizeof(label), "spawn.%s.p%d", name, percentiles[i]);
+        benchReport(label, samples[(long) iterations * percentiles[i] / 100] / 1e3, "us");
+    }
+    free(samples);
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1) benchRev = argv[1];
+    varInit();
+
+    benchSplitLine();
+    benchHistory();
+    benchHistorySearch();
+    benchDispatch();
+    benchVars();
+    benchComplete();
+    benchGlob();
+    benchSpawn("posix_spawn", 1);
+    benchSpawn("fork", 0);
+    return EXIT_SUCCESS;
+}
@@ -2,20 +2,98 @@
 
 
 
-//list of commands
-char *builtInStr[] = {
-    "cd", "help", "exit", "pwd", "echo", "clear", "history", "mkdir"
+//list of commands: name, its first, second and last characters, the function and flags.
+//The characters feed LSH_BUILTIN_HASH, which has to stay collision free over this
+//list; lshFindBuiltin switches on it, so a collision is a duplicate case label
+//and fails the build instead of silently shadowing a builtin.
+//LSH_BI_INPROC marks builtins that never read stdin and never change the shell's
+//own state (jobs and history -n only catch up on bookkeeping), so a pipeline can
+//run them inside the shell; any other builtin in a pipeline runs in a forked
+//child, and whatever it changes is lost with the child.
+//LSH_BI_CHILD marks builtins that may run long or read the terminal; with job
+//control, or after &, they run as a job of their own so ^C and ^Z reach them.
+#define LSH_BUILTINS(X) \
+    X("cd",      'c', 'd', 'd', lshCd,      0) \
+    X("help",    'h', 'e', 'p', lshHelp,    LSH_BI_INPROC) \
+    X("exit",    'e', 'x', 't', lshExit,    0) \
+    X("pwd",     'p', 'w', 'd', lshPwd,     LSH_BI_INPROC) \
+    X("echo",    'e', 'c', 'o', lshEcho,    LSH_BI_INPROC) \
+    X("clear",   'c', 'l', 'r', lshClear,   LSH_BI_INPROC) \
+    X("history", 'h', 'i', 'y', lshHistory, LSH_BI_INPROC) \
+    X("mkdir",   'm', 'k', 'r', lshMkdir,   LSH_BI_INPROC) \
+    X("rmdir",   'r', 'm', 'r', lshRmdir,   LSH_BI_INPROC) \
+    X("rm",      'r', 'm', 'm', lshRm,      LSH_BI_INPROC | LSH_BI_CHILD) \
+    X("hash",    'h', 'a', 'h', lshHash,    0) \
+    X("set",     's', 'e', 't', lshSet,     0) \
+    X("jobs",    'j', 'o', 's', lshJobs,    LSH_BI_INPROC) \
+    X("fg",      'f', 'g', 'g', lshFg,      0) \
+    X("bg",      'b', 'g', 'g', lshBg,      0) \
+    X("wait",    'w', 'a', 't', lshWait,    0) \
+    X("cat",     'c', 'a', 't', lshCat,     LSH_BI_CHILD) \
+    X("cp",      'c', 'p', 'p', lshCp,      LSH_BI_INPROC | LSH_BI_CHILD) \
+    X("parallel",'p', 'a', 'l', lshParallel, LSH_BI_CHILD) \
+    X("export",  'e', 'x', 't', lshExport,  0) \
+    X("unset",   'u', 'n', 't', lshUnset,   0) \
+    X("true",    't', 'r', 'e', lshTrue,    LSH_BI_INPROC) \
+    X("false",   'f', 'a', 'e', lshFalse,   LSH_BI_INPROC) \
+    X("source",  's', 'o', 'e', lshSource,  0) \
+    X(".",       '.', '\0', '.', lshDot,     0) \
+    X("return",  'r', 'e', 'n', lshReturn,  0) \
+    X("break",   'b', 'r', 'k', lshBreak,   0) \
+    X("continue",'c', 'o', 'e', lshContinue, 0) \
+    X("alias",   'a', 'l', 's', lshAlias,   0) \
+    X("unalias", 'u', 'n', 's', lshUnalias, 0)
+
+#define LSH_BUILTIN_SLOTS 128 //hash range, a power of two
+#define LSH_BUILTIN_HASH(first, second, last, len) \
+    (((first) + (second) * 3 + (last) + (len) * 21) & (LSH_BUILTIN_SLOTS - 1))
+
+#define LSH_BUILTIN_ENUM(str, first, second, last, fn, flags) BI_##fn,
+#define LSH_BUILTIN_ENTRY(str, first, second, last, fn, flags) { str, &fn, flags },
+#define LSH_BUILTIN_CASE(str, first, second, last, fn, flags) \
+    case LSH_BUILTIN_HASH(first, second, last, sizeof(str) - 1): index = BI_##fn; break;
+
+enum { LSH_BUILTINS(LSH_BUILTIN_ENUM) LSH_NUM_BUILTINS };
+
+//the commands and their corresponding functions, in LSH_BUILTINS order
+const Builtin lshBuiltins[] = {
+    LSH_BUILTINS(LSH_BUILTIN_ENTRY)
 };
 
-//their corresponding functions
-int (*builtInFunction[]) (char**) = {
-    &lshCd, &lshHelp, &lshExit, &lshPwd, &lshEcho,
-    &lshClear, &lshHistory, &lshMkdir
+//shell options, listed by set -o
+LshOption lshOptions[] = {
+    { "posix_spawn", &lshUsePosixSpawn },
+    { "io_uring", &lshUseIoUring },
+    { "bigpipes", &lshBigPipes },
 };
 
 int lshNumBuiltIns() //returns the number of built-in commands
 {
-    return sizeof(builtInStr) / sizeof(char*);
+    return LSH_NUM_BUILTINS;
+}
+
+int lshFindBuiltin(const char *name) //index of the builtin called name, or -1
+{
+    if(!name) return -1; //a stage that was only assignments or redirections
+
+    size_t len = strlen(name);
+    int index;
+
+    if(len == 0) return -1;
+
+    switch(LSH_BUILTIN_HASH((unsigned char) name[0], (unsigned char) name[1], (unsigned char) name[len-1], len)) //one jump table lookup
+    {
+        LSH_BUILTINS(LSH_BUILTIN_CASE)
+        default:
+            return -1;
+    }
+
+    return strcmp(name, lshBuiltins[index].name) == 0 ? index : -1; //confirm, the hash only picks a candidate
+}
+
+int lshNumOptions() //returns the number of shell options
+{
+    return sizeof(lshOptions) / sizeof(LshOption);
 }
 
 void lshBanner() 
@@ -39,12 +117,18 @@ int lshCd(char **args)
     if (args[1] == NULL) //if no argument is given to cd
     {
         fprintf(stderr, "lsh: expected argument to \"cd\"\n");
+        lshLastStatus = 2;
     } 
     else 
     {
         if (chdir(args[1]) != 0) //change directory, if it returns -1 then an error occurred
         {
             perror("lsh");
+            lshLastStatus = 1;
+        }
+        else
+        {
+            promptInvalidate(PROMPT_CWD); //the cached prompt shows the old directory
         }
     }
     return 1;
@@ -59,7 +143,7 @@ int lshHelp(char **args)
 
     for(i = 0; i < lshNumBuiltIns(); i++) //list all built-in commands
     {
-        printf("  %s\n", builtInStr[i]); //print each command
+        printf("  %s\n", lshBuiltins[i].name); //print each command
     }
 
     return 1;
@@ -77,6 +161,7 @@ int lshPwd(char **args)
     if(getcwd(buffer, PATH_MAX) == NULL) //call getcwd and if fail we print the error
     {
         perror("pwd"); 
+        lshLastStatus = 1;
     }
     else
     {
@@ -113,84 +198,515 @@ int lshClear(char **args)
 
 int lshHistory(char **args)
 {
-    (void)*args; //suppresses unused parameter warning
+    if(args[1] != NULL && strcmp(args[1], "-n") == 0) //read entries other sessions added since we last looked
+    {
+        histFileReadNew(&histFile, &hist);
+        return 1;
+    }
+    if(args[1] != NULL && strcmp(args[1], "-s") == 0) //entries containing a pattern
+    {
+        if(args[2] == NULL)
+        {
+            fprintf(stderr, "history: -s needs a pattern\n");
+            lshLastStatus = 2;
+            return 1;
+        }
+        historyPrintMatches(&hist, args[2]);
+        return 1;
+    }
+
     historyPrint(&hist); //print the command history
     return 1;
 }
 
-int lshMkdir(char **args)
+int lshCat(char **args) //cat [file...], - or no file is stdin
 {
-    if(args[1] == NULL) // if there is no argument for mkdir print an error
+    fflush(stdout); //output already buffered goes first, the copy writes straight to the fd
+
+    struct stat outSt;
+    bool outReg = fstat(STDOUT_FILENO, &outSt) == 0 && S_ISREG(outSt.st_mode);
+
+    for(int i = 1; args[i] != NULL || i == 1; i++)
     {
-        printf("mkdir: missing operand");
+        const char *name = args[i] ? args[i] : "-";
+        int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+
+        if(fd < 0)
+        {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            lshLastStatus = 1;
+            continue;
+        }
+
+        struct stat inSt;
+        if(outReg && fstat(fd, &inSt) == 0 && inSt.st_dev == outSt.st_dev && inSt.st_ino == outSt.st_ino) //cat a >> a would copy a onto itself forever
+        {
+            fprintf(stderr, "cat: %s: input file is output file\n", name);
+            lshLastStatus = 1;
+        }
+        else if(copyFd(fd, STDOUT_FILENO) != 0)
+        {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            lshLastStatus = 1;
+        }
+
+        if(fd != STDIN_FILENO) close(fd);
+        if(args[i] == NULL) break;
     }
-    else
+
+    return 1;
+}
+
+static int cpFile(const char *src, const char *dst) //copy one file, keeping its permission bits
+{
+    struct stat st;
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+
+    if(in < 0 || fstat(in, &st) != 0)
+    {
+        fprintf(stderr, "cp: %s: %s\n", src, strerror(errno));
+        if(in >= 0) close(in);
+        return -1;
+    }
+    if(S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "cp: %s: Is a directory\n", src);
+        close(in);
+        return -1;
+    }
+
+    struct stat dstSt;
+    if(stat(dst, &dstSt) == 0 && dstSt.st_dev == st.st_dev && dstSt.st_ino == st.st_ino) //O_TRUNC would empty the source
+    {
+        fprintf(stderr, "cp: '%s' and '%s' are the same file\n", src, dst);
+        close(in);
+        return -1;
+    }
+
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    if(out < 0)
     {
-        int result = mkdir(args[1], 0755); //mkdir is already provided by the OS, this function is basically just a wrapper
-        if(result == -1)
+        fprintf(stderr, "cp: %s: %s\n", dst, strerror(errno));
+        close(in);
+        return -1;
+    }
+
+    int result = copyFd(in, out);
+    if(result != 0)
+    {
+        fprintf(stderr, "cp: %s: %s\n", dst, strerror(errno));
+    }
+
+    close(in);
+    close(out);
+    return result;
+}
+
+int lshCp(char **args) //cp src dst, or cp src... dir
+{
+    int n = 0;
+    while(args[n + 1] != NULL) n++;
+
+    if(n < 2)
+    {
+        fprintf(stderr, "cp: usage: cp source dest, or cp source... directory\n");
+        lshLastStatus = 1;
+        return 1;
+    }
+
+    const char *target = args[n];
+    struct stat st;
+    bool intoDir = stat(target, &st) == 0 && S_ISDIR(st.st_mode);
+
+    if(n > 2 && !intoDir)
+    {
+        fprintf(stderr, "cp: %s: Not a directory\n", target);
+        lshLastStatus = 1;
+        return 1;
+    }
+
+    for(int i = 1; i < n; i++)
+    {
+        char path[PATH_MAX];
+        const char *dst = target;
+
+        if(intoDir)
+        {
+            const char *base = strrchr(args[i], '/');
+            base = base ? base + 1 : args[i];
+            const char *slash = target[strlen(target) - 1] == '/' ? "" : "/"; //dir/ already has one
+            if(snprintf(path, sizeof(path), "%s%s%s", target, slash, base) >= (int) sizeof(path))
+            {
+                fprintf(stderr, "cp: %s/%s: File name too long\n", target, base);
+                lshLastStatus = 1;
+                continue;
+            }
+            dst = path;
+        }
+
+        if(cpFile(args[i], dst) != 0)
         {
-            perror("mkdir");
+            lshLastStatus = 1;
         }
     }
 
     return 1;
 }
 
-int lshExecutePiped(char ***cmds, int n)
+int lshHash(char **args)
 {
-    int i;
-    int pipefd[2 * (n-1)]; //file descriptors for the pipes
+    if(args[1] == NULL) //no arguments, list the cache
+    {
+        pathCachePrint();
+        return 1;
+    }
 
-    for(i = 0; i < n-1; i++)
+    if(strcmp(args[1], "-r") == 0) //forget every remembered location
     {
-        if(pipe(pipefd + i*2) < 0) //create a pipe and if it fails print an error
+        pathCacheClear();
+        return 1;
+    }
+
+    if(strcmp(args[1], "-p") == 0) //hash -p path name: use path for name without searching $PATH
+    {
+        if(args[2] == NULL || args[3] == NULL)
         {
-            perror("pipe");
+            fprintf(stderr, "hash: usage: hash [-r] [-p pathname] [name ...]\n");
+            lshLastStatus = 2;
             return 1;
         }
+        pathCachePin(args[3], args[2]);
+        return 1;
     }
 
-    int pid;
-    for(i = 0; i < n; i++)
+    for(int i = 1; args[i] != NULL; i++) //hash name...: resolve and remember each name
+    {
+        if(strchr(args[i], '/')) continue;
+
+        if(!pathCacheLookup(args[i]))
+        {
+            fprintf(stderr, "hash: %s: not found\n", args[i]);
+            lshLastStatus = 1;
+        }
+    }
+    return 1;
+}
+
+int lshSet(char **args)
+{
+    if(args[1] == NULL || (args[2] == NULL && (strcmp(args[1], "-o") == 0 || strcmp(args[1], "+o") == 0))) //list options
+    {
+        for(int i = 0; i < lshNumOptions(); i++)
+        {
+            printf("%-15s %s\n", lshOptions[i].name, *lshOptions[i].value ? "on" : "off");
+        }
+        return 1;
+    }
+
+    if((strcmp(args[1], "-o") != 0 && strcmp(args[1], "+o") != 0) || args[2] == NULL)
     {
-        pid = fork();//create a new process
+        fprintf(stderr, "set: usage: set [-o|+o] [option]\n");
+        lshLastStatus = 2;
+        return 1;
+    }
 
-        if(pid == 0) //child process
+    for(int i = 0; i < lshNumOptions(); i++)
+    {
+        if(strcmp(args[2], lshOptions[i].name) == 0)
         {
-            if(i > 0)
+            *lshOptions[i].value = (args[1][0] == '-'); //-o turns an option on, +o turns it off
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "set: %s: invalid option name\n", args[2]);
+    lshLastStatus = 1;
+    return 1;
+}
+
+int lshBigPipes; //toggled with set [-+]o bigpipes
+
+static void pipeHandOff(int fd, const char *buf, size_t len, Job *job, int status, int *closeFds, int numClose) //write an in-process stage's output into its pipe and close it
+{
+    //What fits in the pipe goes in at once. The rest is left to a child in the job's
+    //process group, so a reader that is stopped or slow holds up the job and not the
+    //shell, and ^Z and fg reach the writer like any other stage.
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    size_t done = 0;
+    while(done < len)
+    {
+        ssize_t w = write(fd, buf + done, len - done);
+        if(w < 0 && errno == EINTR) continue;
+        if(w <= 0) break; //EAGAIN: the pipe is full; EPIPE: nobody reads it
+        done += w;
+    }
+
+    if(done < len && errno == EAGAIN)
+    {
+        LaunchIO io;
+        launchIOInit(&io);
+        io.closeFds = closeFds; //the reader sees EOF only once every write end is closed
+        io.numClose = numClose;
+        if(lshJobControl) io.pgid = job->pgid;
+
+        pid_t pid = launchFork(&io);
+        if(pid == 0)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK); //the child can wait for the reader
+            while(done < len)
             {
-                dup2(pipefd[(i-1) * 2], STDIN_FILENO); //redirect stdin to read end of previous pipe
+                ssize_t w = write(fd, buf + done, len - done);
+                if(w < 0 && errno == EINTR) continue;
+                if(w <= 0) break;
+                done += w;
             }
+            _exit(status);
+        }
+        if(pid > 0) jobAddProcess(job, pid);
+    }
+    close(fd); //the reader sees EOF once the child, if any, is done too
+}
 
-            if(i < n - 1)
+static void pipeGrow(int fd) //raise a pipe's capacity towards /proc/sys/fs/pipe-max-size, fewer wakeups per megabyte
+{
+    static int max; //read once
+
+    if(max == 0)
+    {
+        max = PIPE_SIZE_DEFAULT_MAX;
+        FILE *f = fopen("/proc/sys/fs/pipe-max-size", "re");
+        if(f)
+        {
+            if(fscanf(f, "%d", &max) != 1 || max < PIPE_SIZE_MIN) max = PIPE_SIZE_DEFAULT_MAX;
+            fclose(f);
+        }
+    }
+
+    for(int size = max; size > PIPE_SIZE_MIN; size /= 2) //past the user's pipe page budget only smaller pipes are allowed
+    {
+        if(fcntl(fd, F_SETPIPE_SZ, size) >= 0 || errno != EPERM) return;
+    }
+}
+
+int lshExecutePiped(char ***cmds, int n, bool background)
+{
+    int i;
+    int pipefd[2 * (n-1)]; //file descriptors for the pipes
+
+    int hereFd[n]; //staged <<EOF and <<< body for each stage's stdin, -1 for none
+
+    for(i = 0; i < n; i++)
+    {
+        if(cmds[i][0] == NULL) //| cat, a | | b and a |
+        {
+            fprintf(stderr, "lsh: syntax error near unexpected token `|'\n");
+            lshLastStatus = 2;
+            return 1;
+        }
+    }
+
+    for(i = 0; i < n; i++) //bodies are read in the order they appear on the line
+    {
+        hereFd[i] = heredocTake(cmds[i]);
+        if(hereFd[i] == -2)
+        {
+            while(--i >= 0)
             {
-                dup2(pipefd[i * 2 + 1], STDOUT_FILENO); //redirect stdout to write end of current pipe
+                if(hereFd[i] >= 0) close(hereFd[i]);
             }
+            return 1;
+        }
+    }
+
+    Redirs redirs[n]; //each stage's own <, >, >>, 2> and 2>&1
+    bool broken[n]; //a redirection failed, the stage is not started
+
+    for(i = 0; i < n; i++)
+    {
+        broken[i] = redirTake(cmds[i], &redirs[i]) < 0; //reported, its neighbours still run
+        if(broken[i]) redirs[i].count = 0;
+    }
 
-            for(int j = 0; j < 2 * (n-1); j++)
+    for(i = 0; i < n-1; i++)
+    {
+        if(pipe2(pipefd + i*2, O_CLOEXEC) < 0) //create a pipe and if it fails print an error
+        {
+            perror("pipe");
+            while(--i >= 0)
             {
-                close(pipefd[j]); //close all pipe fds in child
+                close(pipefd[i*2]);
+                close(pipefd[i*2 + 1]);
             }
+            for(i = 0; i < n; i++)
+            {
+                if(hereFd[i] >= 0) close(hereFd[i]);
+                redirClose(&redirs[i]);
+            }
+            return 1;
+        }
+        if(lshBigPipes) pipeGrow(pipefd[i*2 + 1]);
+    }
+
+    Job *job = jobCreate(cmds, n, background); //the whole pipeline is one job
+    int pid;
+    int builtin[n]; //builtin index of each stage, -1 for external commands
+    AstFunc *fn[n]; //function run by each stage, NULL for none
+    bool inproc[n]; //stages run by the shell itself once the rest are started
+    int numInproc = 0;
+
+    char **envp[n]; //VAR=value in front of a stage, its own environment
+
+    for(i = 0; i < n; i++)
+    {
+        envp[i] = varTakeAssignments(cmds[i]);
+        if(!envp[i] && cmds[i][0] && varIsAssignment(cmds[i][0])) cmds[i][0] = NULL; //A=1 | cat, only a subshell would see A, the stage just ends
+        fn[i] = astFindFunc(cmds[i][0]);
+        builtin[i] = fn[i] ? -1 : lshFindBuiltin(cmds[i][0]);
+        inproc[i] = !background && builtin[i] >= 0 && (lshBuiltins[builtin[i]].flags & LSH_BI_INPROC) && redirs[i].count == 0 && !broken[i]; //a background job must not block the shell
+        if(inproc[i]) numInproc++;
+    }
+
+    for(i = 0; i < n; i++)
+    {
+        if(inproc[i] || broken[i]) continue;
+        if(!cmds[i][0])
+        {
+            redirClose(&redirs[i]); //> f | cat still creates f
+            continue;
+        }
 
-            execvp(cmds[i][0], cmds[i]); //execute the command
-            perror("execvp"); 
-            exit(EXIT_FAILURE);
+        LaunchIO io;
+        launchIOInit(&io);
+        io.envp = envp[i];
+
+        if(i > 0)
+        {
+            launchIODup(&io, pipefd[(i-1) * 2], STDIN_FILENO); //redirect stdin to read end of previous pipe
         }
-        else if (pid < 0) //error forking
+
+        if(hereFd[i] >= 0)
         {
-            perror("fork");
-            return 1;
+            launchIODup(&io, hereFd[i], STDIN_FILENO); //a here-document replaces the pipe from the previous stage
+        }
+
+        if(i < n - 1)
+        {
+            launchIODup(&io, pipefd[i * 2 + 1], STDOUT_FILENO); //redirect stdout to write end of current pipe
         }
+
+        redirChild(&redirs[i], &io); //the stage's own redirections go on top of the pipes
+
+        io.closeFds = pipefd; //close all pipe fds in child
+        io.numClose = 2 * (n-1);
+
+        if(lshJobControl)
+        {
+            io.pgid = job->pgid; //0 until the first stage has started and leads the group
+            io.foreground = !background && job->numProcs == 0;
+        }
+
+        //start this stage of the pipeline, errors are reported by the spawn functions
+        pid = fn[i] ? astSpawnFunc(fn[i], cmds[i], &io) : builtin[i] >= 0 ? lshSpawnBuiltin(builtin[i], cmds[i], &io) : lshSpawn(cmds[i], &io);
+        if(pid > 0)
+        {
+            jobAddProcess(job, pid); //a failed stage just leaves its neighbours with a closed pipe
+        }
+        redirClose(&redirs[i]); //the child has its copies
+    }
+    for(i = 0; i < n; i++)
+    {
+        free(envp[i]);
     }
 
     for(i = 0; i < 2 * (n-1); i++)
     {
+        if(i % 2 == 1 && inproc[i / 2]) continue; //still needed by an in-process stage
         close(pipefd[i]);//close all pipe fds in parent
     }
-
     for(i = 0; i < n; i++)
     {
-        wait(NULL);//wait for all child processes to finish
+        if(hereFd[i] >= 0) close(hereFd[i]); //the children have their copies
+    }
+
+    int inprocStatus = 0;
+    if(numInproc > 0)
+    {
+        //These builtins only write, so they run in the shell instead of a forked copy of
+        //it. Their stdin pipe is already closed, which tells an upstream writer to stop.
+        void (*oldPipe)(int) = signal(SIGPIPE, SIG_IGN); //a reader that exits early is just EPIPE
+        FILE *realStdout = stdout;
+
+        fflush(stdout);
+        for(i = 0; i < n; i++)
+        {
+            if(!inproc[i]) continue;
+
+            FILE *out = NULL;
+            char *buf = NULL;
+            size_t len = 0;
+            if(i < n - 1)
+            {
+                out = open_memstream(&buf, &len); //the pipe gets it afterwards, without the shell waiting on the reader
+                if(!out)
+                {
+                    fprintf(stderr, "lsh: Allocation Error!\n");
+                    exit(EXIT_FAILURE);
+                }
+                stdout = out;
+            }
+
+            lshLastStatus = 0;
+            lshBuiltins[builtin[i]].func(cmds[i]);
+            inprocStatus = lshLastStatus;
+
+            if(out)
+            {
+                fclose(out);
+                stdout = realStdout;
+
+                int later[n]; //write ends of the in-process stages still to come
+                int numOpen = 0;
+                for(int j = i + 1; j < n - 1; j++)
+                {
+                    if(inproc[j]) later[numOpen++] = pipefd[j * 2 + 1];
+                }
+                pipeHandOff(pipefd[i * 2 + 1], buf, len, job, inprocStatus, later, numOpen);
+                free(buf);
+            }
+        }
+        fflush(stdout);
+        signal(SIGPIPE, oldPipe);
+    }
+
+    if(job->numProcs == 0) //nothing started
+    {
+        jobRemove(job);
+        lshLastStatus = numInproc == n ? inprocStatus : broken[n - 1] ? 1 : !cmds[n - 1][0] ? 0 : 127;
+        return 1;
+    }
+
+    if(background)
+    {
+        printf("[%d] %d\n", job->id, job->procs[job->numProcs - 1].pid);
+        lshLastStatus = 0;
+        if(auditOn) auditJob(job);
+    }
+    else
+    {
+        jobForeground(job, false); //wait for this pipeline's own processes only
+        if(inproc[n - 1])
+        {
+            lshLastStatus = inprocStatus; //a pipeline's status is its last stage's
+        }
+        else if(broken[n - 1])
+        {
+            lshLastStatus = 1;
+        }
+        else if(!cmds[n - 1][0])
+        {
+            lshLastStatus = 0;
+        }
     }
 
     return 1;
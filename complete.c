@@ -0,0 +1,325 @@
+#include "lsh.h"
+
+//TAB completion. Command names come from a sorted index of every executable on
+//$PATH, built on the first TAB and rebuilt only when $PATH or the mtime of one of
+//its directories changes; paths come from a few cached directory listings checked
+//the same way. Finding candidates is a binary search for the prefix plus a walk
+//over the names that share it.
+
+static CommandIndex commandIndex; //global command name index
+static DirListing dirCache[COMPLETE_DIR_CACHE]; //recently completed directories
+static unsigned long dirCacheClock; //for least recently used replacement
+
+void nameListAdd(NameList *list, const char *name, size_t len)
+{
+    if(list->textLen + len + 1 > list->textCap)
+    {
+        size_t capacity = list->textCap ? list->textCap : 4096;
+        while(capacity < list->textLen + len + 1) capacity *= 2;
+
+        char *grown = realloc(list->text, capacity);
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        list->text = grown;
+        list->textCap = capacity;
+    }
+    if(list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 256;
+        uint32_t *grown = realloc(list->offsets, capacity * sizeof(uint32_t));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        list->offsets = grown;
+        list->capacity = capacity;
+    }
+
+    list->offsets[list->count++] = list->textLen;
+    memcpy(list->text + list->textLen, name, len);
+    list->textLen += len;
+    list->text[list->textLen++] = '\0';
+}
+
+static const char *nameListSortText; //qsort has no context argument
+
+static int nameListCompare(const void *a, const void *b)
+{
+    return strcmp(nameListSortText + *(const uint32_t *) a, nameListSortText + *(const uint32_t *) b);
+}
+
+void nameListSort(NameList *list) //sort and drop duplicates (the same command in two $PATH directories)
+{
+    if(list->count == 0) return;
+
+    nameListSortText = list->text;
+    qsort(list->offsets, list->count, sizeof(uint32_t), nameListCompare);
+
+    int kept = 1;
+    for(int i = 1; i < list->count; i++)
+    {
+        if(strcmp(nameListAt(list, i), list->text + list->offsets[kept - 1]) != 0)
+        {
+            list->offsets[kept++] = list->offsets[i];
+        }
+    }
+    list->count = kept;
+}
+
+int nameListFind(const NameList *list, const char *prefix) //index of the first name >= prefix
+{
+    int lo = 0, hi = list->count;
+
+    while(lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if(strcmp(nameListAt(list, mid), prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void nameListFree(NameList *list)
+{
+    free(list->text);
+    free(list->offsets);
+    memset(list, 0, sizeof(*list));
+}
+
+static bool sameTime(struct timespec a, struct timespec b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool commandIndexStale(CommandIndex *idx, const char *path) //one stat() per $PATH directory
+{
+    if(!idx->built || strcmp(idx->path, path) != 0) return true;
+
+    int d = 0;
+    for(const char *p = path; ; d++)
+    {
+        const char *colon = strchrnul(p, ':');
+        char dir[PATH_MAX];
+        struct stat st;
+
+        snprintf(dir, sizeof(dir), "%.*s", (int) (colon - p), p);
+        struct timespec mtime = stat(*dir ? dir : ".", &st) == 0 ? st.st_mtim : (struct timespec) { 0, 0 };
+        if(!sameTime(mtime, idx->mtimes[d])) return true;
+
+        if(!*colon) break;
+        p = colon + 1;
+    }
+    return false;
+}
+
+static void commandIndexBuild(CommandIndex *idx, const char *path)
+{
+    idx->names.textLen = 0;
+    idx->names.count = 0;
+    free(idx->path);
+    idx->path = strdup(path);
+
+    idx->numDirs = 1;
+    for(const char *p = path; *p; p++)
+    {
+        if(*p == ':') idx->numDirs++;
+    }
+    free(idx->mtimes);
+    idx->mtimes = calloc(idx->numDirs, sizeof(struct timespec));
+
+    int d = 0;
+    for(const char *p = path; ; d++)
+    {
+        const char *colon = strchrnul(p, ':');
+        char dir[PATH_MAX];
+        struct stat st;
+
+        snprintf(dir, sizeof(dir), "%.*s", (int) (colon - p), p);
+        if(!*dir) strcpy(dir, "."); //an empty entry means the current directory
+
+        if(stat(dir, &st) == 0) //same check commandIndexStale makes, even if the directory cannot be read
+        {
+            idx->mtimes[d] = st.st_mtim;
+        }
+
+        DIR *dp = opendir(dir);
+        if(dp)
+        {
+            struct dirent *e;
+            while((e = readdir(dp)) != NULL)
+            {
+                if(e->d_name[0] == '.') continue;
+                if(e->d_type == DT_DIR) continue;
+                if(faccessat(dirfd(dp), e->d_name, X_OK, AT_EACCESS) != 0) continue; //only what could run
+                if(e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) //a directory or a link to one is no command
+                {
+                    if(fstatat(dirfd(dp), e->d_name, &st, 0) != 0 || S_ISDIR(st.st_mode)) continue;
+                }
+                nameListAdd(&idx->names, e->d_name, strlen(e->d_name));
+            }
+        }
+        if(dp) closedir(dp);
+
+        if(!*colon) break;
+        p = colon + 1;
+    }
+
+    for(int i = 0; i < lshNumBuiltIns(); i++) //builtins complete like commands
+    {
+        nameListAdd(&idx->names, lshBuiltins[i].name, strlen(lshBuiltins[i].name));
+    }
+
+    nameListSort(&idx->names);
+    idx->built = true;
+}
+
+static DirListing *dirCacheGet(const char *dir) //listing of dir, re-read only if its mtime changed
+{
+    struct stat st;
+    DirListing *entry = NULL, *oldest = &dirCache[0];
+
+    if(stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+
+    for(int i = 0; i < COMPLETE_DIR_CACHE; i++)
+    {
+        if(dirCache[i].dir && strcmp(dirCache[i].dir, dir) == 0)
+        {
+            entry = &dirCache[i];
+            break;
+        }
+        if(!dirCache[i].dir || (oldest->dir && dirCache[i].lastUse < oldest->lastUse))
+        {
+            oldest = &dirCache[i];
+        }
+    }
+
+    if(entry && sameTime(entry->mtime, st.st_mtim))
+    {
+        entry->lastUse = ++dirCacheClock;
+        return entry;
+    }
+
+    if(!entry) //take over the least recently used slot
+    {
+        entry = oldest;
+        free(entry->dir);
+        entry->dir = strdup(dir);
+    }
+
+    entry->names.textLen = 0;
+    entry->names.count = 0;
+    entry->mtime = st.st_mtim;
+    entry->lastUse = ++dirCacheClock;
+
+    DIR *dp = opendir(dir);
+    if(!dp) return entry; //unreadable: no candidates until it changes
+
+    struct dirent *e;
+    while((e = readdir(dp)) != NULL)
+    {
+        if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+
+        size_t len = strlen(e->d_name);
+        bool isDir = e->d_type == DT_DIR;
+
+        if(e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) //links to directories complete as directories too
+        {
+            isDir = fstatat(dirfd(dp), e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+
+        if(isDir)
+        {
+            char name[len + 2];
+            memcpy(name, e->d_name, len);
+            name[len] = '/';
+            nameListAdd(&entry->names, name, len + 1);
+        }
+        else
+        {
+            nameListAdd(&entry->names, e->d_name, len);
+        }
+    }
+    closedir(dp);
+
+    nameListSort(&entry->names);
+    return entry;
+}
+
+static void completionAdd(Completion *c, const char *item)
+{
+    if(c->count == c->capacity)
+    {
+        int capacity = c->capacity ? c->capacity * 2 : 64;
+        const char **grown = realloc(c->items, capacity * sizeof(char*));
+        if(!grown) return;
+
+        c->items = grown;
+        c->capacity = capacity;
+    }
+    c->items[c->count++] = item;
+}
+
+static void completionCollect(Completion *c, const NameList *list, const char *prefix, bool hidden) //every name starting with prefix
+{
+    size_t len = strlen(prefix);
+
+    for(int i = nameListFind(list, prefix); i < list->count; i++)
+    {
+        const char *name = nameListAt(list, i);
+        if(strncmp(name, prefix, len) != 0) break; //sorted, so the matches are contiguous
+        if(name[0] == '.' && !hidden) continue;
+        completionAdd(c, name);
+    }
+}
+
+void completeWord(const char *word, bool command, Completion *c) //candidates for word, command names when command is set
+{
+    c->count = 0;
+    c->replaceFrom = 0;
+
+    if(command && !strchr(word, '/'))
+    {
+        const char *path = varGet("PATH");
+        if(!path) path = "";
+
+        if(commandIndexStale(&commandIndex, path))
+        {
+            commandIndexBuild(&commandIndex, path);
+        }
+        completionCollect(c, &commandIndex.names, word, false);
+        return;
+    }
+
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    char dir[PATH_MAX];
+
+    if(!slash) strcpy(dir, ".");
+    else if(slash == word) strcpy(dir, "/");
+    else snprintf(dir, sizeof(dir), "%.*s", (int) (slash - word), word);
+
+    DirListing *listing = dirCacheGet(dir);
+    if(!listing) return;
+
+    c->replaceFrom = base - word;
+    completionCollect(c, &listing->names, base, base[0] == '.');
+}
+
+void completeFree(void)
+{
+    nameListFree(&commandIndex.names);
+    free(commandIndex.path);
+    free(commandIndex.mtimes);
+    memset(&commandIndex, 0, sizeof(commandIndex));
+
+    for(int i = 0; i < COMPLETE_DIR_CACHE; i++)
+    {
+        free(dirCache[i].dir);
+        nameListFree(&dirCache[i].names);
+        memset(&dirCache[i], 0, sizeof(dirCache[i]));
+    }
+}
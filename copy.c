@@ -0,0 +1,126 @@
+#include "lsh.h"
+
+//Data movement for the cat and cp builtins. The bytes are left to the kernel:
+//copy_file_range() between regular files (a reflink or server side copy where
+//the filesystem can), splice() when either end is a pipe, sendfile() from a
+//regular file to anything else, and a plain read()/write() loop as a last resort.
+//Every method works from the current file offsets, so a copy that one method
+//cannot finish is picked up by the next.
+
+static bool copyUnsupported(int err) //the method does not apply to these fds, try the next one
+{
+    return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP || err == EBADF || err == ENOTSUP;
+}
+
+static int copyFileRange(int in, int out) //1 when the copy is finished, 0 to fall back, -1 on error
+{
+    while(true)
+    {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, LSH_COPY_CHUNK, 0);
+
+        if(n == 0) return 1; //end of input
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return copyUnsupported(errno) ? 0 : -1;
+        }
+    }
+}
+
+static int copySplice(int in, int out)
+{
+    while(true)
+    {
+        ssize_t n = splice(in, NULL, out, NULL, LSH_COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if(n == 0) return 1;
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return copyUnsupported(errno) ? 0 : -1;
+        }
+    }
+}
+
+static int copySendfile(int in, int out)
+{
+    while(true)
+    {
+        ssize_t n = sendfile(out, in, NULL, LSH_COPY_CHUNK);
+
+        if(n == 0) return 1;
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return copyUnsupported(errno) ? 0 : -1;
+        }
+    }
+}
+
+static int copyReadWrite(int in, int out)
+{
+    char *buf = malloc(LSH_COPY_BUFSIZE);
+    int result = 1;
+
+    if(!buf)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while(true)
+    {
+        ssize_t n = read(in, buf, LSH_COPY_BUFSIZE);
+
+        if(n == 0) break;
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            result = -1;
+            break;
+        }
+
+        for(ssize_t done = 0; done < n; ) //a pipe or terminal may take less than asked
+        {
+            ssize_t w = write(out, buf + done, n - done);
+            if(w < 0)
+            {
+                if(errno == EINTR) continue;
+                result = -1;
+                break;
+            }
+            done += w;
+        }
+        if(result < 0) break;
+    }
+
+    free(buf);
+    return result;
+}
+
+int copyFd(int in, int out) //copy everything from in to out, returns 0 or -1 with errno set
+{
+    struct stat inSt, outSt;
+    int r = 0;
+
+    if(fstat(in, &inSt) != 0 || fstat(out, &outSt) != 0) return -1;
+
+    if(S_ISREG(inSt.st_mode) && S_ISREG(outSt.st_mode))
+    {
+        r = copyFileRange(in, out);
+    }
+    if(r == 0 && (S_ISFIFO(inSt.st_mode) || S_ISFIFO(outSt.st_mode)))
+    {
+        r = copySplice(in, out);
+    }
+    if(r == 0 && S_ISREG(inSt.st_mode))
+    {
+        r = copySendfile(in, out);
+    }
+    if(r == 0)
+    {
+        r = copyReadWrite(in, out);
+    }
+
+    return r > 0 ? 0 : -1;
+}
@@ -0,0 +1,768 @@
+#include "lsh.h"
+
+//Bulk filesystem builtins: mkdir [-p], rmdir and rm [-rf]. Every operation is an
+//FsOp naming a directory fd and a name in it, and a whole batch of them is handed to
+//fsBatchRun() at once: on io_uring the batch goes into the submission ring and one
+//io_uring_enter() call submits it and waits for the completions; without io_uring
+//(an old kernel, a seccomp filter, or set +o io_uring) a small pool of threads runs
+//the same operations with mkdirat()/unlinkat()/openat(). mkdir -p creates the paths
+//a level at a time, each level one batch against the fds opened for the level
+//before, and rm -r walks a tree through the fd of each directory it opens, its
+//unlinks batched across many directories.
+
+int lshUseIoUring = 1; //toggled with set [-+]o io_uring
+
+static FsRing fsRing = { .fd = -1 }; //set up on first use
+static bool fsRingFailed; //io_uring is not there, or lacks mkdirat/unlinkat/openat
+static pid_t fsOwner; //process the ring and the pool belong to, a forked child makes its own
+static FsPool fsPool;
+
+static int fsRingSetup(FsRing *r)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    r->fd = syscall(SYS_io_uring_setup, FS_RING_ENTRIES, &p);
+    if(r->fd < 0) return -1;
+
+    //the kernel may not know these operations, opcodes it does not support would only fail later
+    size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probeSize);
+    int supported = probe && syscall(SYS_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                    probe->last_op >= IORING_OP_MKDIRAT &&
+                    (probe->ops[IORING_OP_MKDIRAT].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_UNLINKAT].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+
+    r->sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) //both rings in one mapping
+    {
+        if(r->cqSize > r->sqSize) r->sqSize = r->cqSize;
+        r->cqSize = r->sqSize;
+    }
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq = mmap(NULL, r->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->sq :
+            mmap(NULL, r->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+    if(!supported || r->sq == MAP_FAILED || r->cq == MAP_FAILED || r->sqes == MAP_FAILED)
+    {
+        if(r->sqes != MAP_FAILED) munmap(r->sqes, r->sqesSize);
+        if(r->cq != MAP_FAILED && r->cq != r->sq) munmap(r->cq, r->cqSize);
+        if(r->sq != MAP_FAILED) munmap(r->sq, r->sqSize);
+        close(r->fd);
+        r->fd = -1;
+        return -1;
+    }
+
+    r->sqHead = (unsigned *) ((char *) r->sq + p.sq_off.head);
+    r->sqTail = (unsigned *) ((char *) r->sq + p.sq_off.tail);
+    r->sqMask = *(unsigned *) ((char *) r->sq + p.sq_off.ring_mask);
+    r->sqArray = (unsigned *) ((char *) r->sq + p.sq_off.array);
+    r->cqHead = (unsigned *) ((char *) r->cq + p.cq_off.head);
+    r->cqTail = (unsigned *) ((char *) r->cq + p.cq_off.tail);
+    r->cqMask = *(unsigned *) ((char *) r->cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) ((char *) r->cq + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+    return 0;
+}
+
+static void fsRingClose(FsRing *r, bool unmap)
+{
+    if(r->fd < 0) return;
+
+    if(unmap)
+    {
+        munmap(r->sqes, r->sqesSize);
+        if(r->cq != r->sq) munmap(r->cq, r->cqSize);
+        munmap(r->sq, r->sqSize);
+    }
+    close(r->fd);
+    r->fd = -1;
+}
+
+static int fsRingRun(FsRing *r, FsOp *ops, int n) //every op through the ring, at most r->entries in flight
+{
+    int next = 0, done = 0;
+    unsigned inflight = 0;
+
+    while(done < n)
+    {
+        unsigned tail = *r->sqTail;
+
+        while(next < n && inflight < r->entries) //the ring only holds what is in flight, so it never fills
+        {
+            FsOp *op = &ops[next];
+            struct io_uring_sqe *sqe = &r->sqes[tail & r->sqMask];
+
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->fd = op->dirfd;
+            sqe->addr = (uintptr_t) op->name;
+            sqe->user_data = next;
+            switch(op->kind)
+            {
+                case FS_MKDIR:
+                    sqe->opcode = IORING_OP_MKDIRAT;
+                    sqe->len = op->mode;
+                    break;
+                case FS_UNLINK:
+                case FS_RMDIR:
+                    sqe->opcode = IORING_OP_UNLINKAT;
+                    sqe->unlink_flags = op->kind == FS_RMDIR ? AT_REMOVEDIR : 0;
+                    break;
+                case FS_OPENDIR:
+                case FS_OPENSUBDIR:
+                    sqe->opcode = IORING_OP_OPENAT;
+                    sqe->open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (op->kind == FS_OPENSUBDIR ? O_NOFOLLOW : 0);
+                    break;
+            }
+            r->sqArray[tail & r->sqMask] = tail & r->sqMask;
+            tail++;
+            next++;
+            inflight++;
+        }
+        __atomic_store_n(r->sqTail, tail, __ATOMIC_RELEASE);
+
+        unsigned toSubmit = tail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+        if(syscall(SYS_io_uring_enter, r->fd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            return -1; //the ring is unusable, the caller finishes the batch without it
+        }
+
+        unsigned head = *r->cqHead;
+        while(head != __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &r->cqes[head & r->cqMask];
+            ops[cqe->user_data].result = cqe->res;
+            head++;
+            done++;
+            inflight--;
+        }
+        __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void fsOpRun(FsOp *op) //the same operation as a plain system call
+{
+    int res;
+
+    switch(op->kind)
+    {
+        case FS_MKDIR: res = mkdirat(op->dirfd, op->name, op->mode); break;
+        case FS_UNLINK: res = unlinkat(op->dirfd, op->name, 0); break;
+        case FS_RMDIR: res = unlinkat(op->dirfd, op->name, AT_REMOVEDIR); break;
+        case FS_OPENDIR: res = openat(op->dirfd, op->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC); break;
+        default: res = openat(op->dirfd, op->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC); break;
+    }
+    op->result = res < 0 ? -errno : res;
+}
+
+static void fsPoolWork(FsPool *p) //take ops off the current batch until none are left
+{
+    int i;
+    while((i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < p->n)
+    {
+        if(p->ops[i].result == FS_PENDING) fsOpRun(&p->ops[i]);
+    }
+}
+
+static void *fsPoolThread(void *arg)
+{
+    FsPool *p = arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+    while(true)
+    {
+        while(p->generation == seen) pthread_cond_wait(&p->work, &p->lock);
+        seen = p->generation;
+        pthread_mutex_unlock(&p->lock);
+
+        fsPoolWork(p);
+
+        pthread_mutex_lock(&p->lock);
+        if(++p->finished == p->numThreads) pthread_cond_signal(&p->done);
+    }
+    return NULL;
+}
+
+static void fsPoolStart(FsPool *p)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = cpus < 2 ? 2 : cpus > FS_POOL_MAX ? FS_POOL_MAX : cpus; //blocked in the kernel more than busy, so never fewer than two
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old); //signals are for the shell's own thread, the workers inherit this mask
+    for(int i = 0; i < count; i++)
+    {
+        if(pthread_create(&p->threads[p->numThreads], NULL, fsPoolThread, p) == 0) p->numThreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    p->started = true;
+}
+
+static void fsPoolRun(FsPool *p, FsOp *ops, int n)
+{
+    if(p->numThreads == 0) //no threads to be had, run them here
+    {
+        for(int i = 0; i < n; i++)
+        {
+            if(ops[i].result == FS_PENDING) fsOpRun(&ops[i]);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->ops = ops;
+    p->n = n;
+    p->next = 0;
+    p->finished = 0;
+    p->generation++;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    fsPoolWork(p); //the shell's thread helps too
+
+    pthread_mutex_lock(&p->lock);
+    while(p->finished < p->numThreads) pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void fsBatchRun(FsOp *ops, int n) //run every op, in any order, each result is what the system call returned or -errno
+{
+    if(n == 0) return;
+
+    if(fsOwner != getpid()) //a forked child has neither the ring's submissions nor the pool's threads
+    {
+        if(fsOwner != 0)
+        {
+            fsRingClose(&fsRing, false); //the mappings are this process's own copies, the fd is shared
+            memset(&fsPool, 0, sizeof(fsPool));
+        }
+        fsOwner = getpid();
+    }
+
+    for(int i = 0; i < n; i++) ops[i].result = FS_PENDING;
+
+    if(lshUseIoUring && !fsRingFailed)
+    {
+        if(fsRing.fd < 0 && fsRingSetup(&fsRing) < 0) fsRingFailed = true;
+        if(!fsRingFailed && fsRingRun(&fsRing, ops, n) == 0) return;
+    }
+
+    if(fsRing.fd >= 0) //it failed part way, the pool finishes what is still FS_PENDING
+    {
+        fsRingClose(&fsRing, true);
+        fsRingFailed = true;
+    }
+
+    if(!fsPool.started) fsPoolStart(&fsPool);
+    fsPoolRun(&fsPool, ops, n);
+}
+
+static void fsOpsPush(FsOpList *l, FsOpKind kind, int dirfd, const char *name, int node)
+{
+    if(l->count == l->capacity)
+    {
+        int capacity = l->capacity ? l->capacity * 2 : 256;
+        FsOp *grown = realloc(l->ops, capacity * sizeof(FsOp));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        l->ops = grown;
+        l->capacity = capacity;
+    }
+    l->ops[l->count++] = (FsOp) { .kind = kind, .dirfd = dirfd, .name = name, .mode = 0777, .node = node };
+}
+
+static int fsNodeAdd(FsNode **nodes, int *numNodes, int *capNodes, FsNode node)
+{
+    if(*numNodes == *capNodes)
+    {
+        *capNodes = *capNodes ? *capNodes * 2 : 64;
+        FsNode *grown = realloc(*nodes, *capNodes * sizeof(FsNode));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        *nodes = grown;
+    }
+    (*nodes)[*numNodes] = node;
+    return (*numNodes)++;
+}
+
+static int fsMkdirParents(char **paths, int count) //mkdir -p, a level of the combined tree per batch, returns the number of failures
+{
+    //Every path becomes nodes of one tree, shared prefixes once; a level's directories
+    //are created in one batch and those with children opened in a second, so the next
+    //level works relative to the fds and no path is ever looked up from the top again.
+    FsNode *nodes = NULL;
+    int numNodes = 0, capNodes = 0, failures = 0;
+    char *copies[count];
+
+    fsNodeAdd(&nodes, &numNodes, &capNodes, (FsNode) { .name = ".", .parent = -1, .firstChild = -1, .nextSibling = -1, .depth = -1, .fd = AT_FDCWD });
+    fsNodeAdd(&nodes, &numNodes, &capNodes, (FsNode) { .name = "/", .parent = -1, .firstChild = -1, .nextSibling = -1, .depth = -1, .fd = -1 });
+
+    for(int i = 0; i < count; i++)
+    {
+        copies[i] = strdup(paths[i]);
+        if(!copies[i])
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        int parent = paths[i][0] == '/'; //node 0 is the working directory, node 1 the root
+        char *save = NULL;
+
+        for(char *comp = strtok_r(copies[i], "/", &save); comp; comp = strtok_r(NULL, "/", &save))
+        {
+            int found = nodes[parent].firstChild;
+            while(found >= 0 && strcmp(nodes[found].name, comp) != 0) found = nodes[found].nextSibling;
+
+            if(found < 0)
+            {
+                found = fsNodeAdd(&nodes, &numNodes, &capNodes, (FsNode) { .name = comp, .path = paths[i], .parent = parent,
+                    .firstChild = -1, .nextSibling = nodes[parent].firstChild, .depth = nodes[parent].depth + 1, .fd = -1 });
+                nodes[parent].firstChild = found;
+            }
+            parent = found;
+        }
+    }
+
+    if(nodes[1].firstChild >= 0)
+    {
+        nodes[1].fd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        nodes[1].failed = nodes[1].fd < 0;
+    }
+
+    FsOpList batch = { 0 };
+    for(int depth = 0; ; depth++)
+    {
+        batch.count = 0;
+        for(int j = 2; j < numNodes; j++)
+        {
+            FsNode *nd = &nodes[j];
+            if(nd->depth != depth) continue;
+
+            if(nodes[nd->parent].failed) //reported already, and so is everything below it
+            {
+                nd->failed = true;
+                continue;
+            }
+            fsOpsPush(&batch, FS_MKDIR, nodes[nd->parent].fd, nd->name, j);
+        }
+        if(batch.count == 0) break;
+
+        fsBatchRun(batch.ops, batch.count);
+
+        int numMade = batch.count;
+        for(int k = 0; k < numMade; k++)
+        {
+            FsOp *op = &batch.ops[k];
+            FsNode *nd = &nodes[op->node];
+
+            if(op->result < 0 && op->result != -EEXIST) //an existing directory is fine, opening it tells it from a file
+            {
+                fprintf(stderr, "mkdir: cannot create directory '%s': %s\n", nd->path, strerror(-op->result));
+                nd->failed = true;
+                failures++;
+            }
+            else if(nd->firstChild >= 0 || op->result == -EEXIST) //the next level needs its fd
+            {
+                fsOpsPush(&batch, FS_OPENDIR, op->dirfd, nd->name, op->node);
+            }
+        }
+
+        FsOp *opens = batch.ops + numMade;
+        int numOpens = batch.count - numMade;
+        fsBatchRun(opens, numOpens);
+        for(int k = 0; k < numOpens; k++)
+        {
+            FsNode *nd = &nodes[opens[k].node];
+
+            if(opens[k].result < 0)
+            {
+                fprintf(stderr, "mkdir: cannot create directory '%s': %s\n", nd->path, strerror(opens[k].result == -ENOTDIR ? EEXIST : -opens[k].result));
+                nd->failed = true;
+                failures++;
+            }
+            else if(nd->firstChild >= 0) nd->fd = opens[k].result;
+            else close(opens[k].result); //only opened to see that it is a directory
+        }
+
+        for(int j = 1; j < numNodes; j++) //the level above is done with
+        {
+            if(nodes[j].depth == depth - 1 && nodes[j].fd >= 0)
+            {
+                close(nodes[j].fd);
+                nodes[j].fd = -1;
+            }
+        }
+    }
+
+    for(int j = 1; j < numNodes; j++)
+    {
+        if(nodes[j].fd >= 0) close(nodes[j].fd);
+    }
+    for(int i = 0; i < count; i++) free(copies[i]);
+    free(nodes);
+    free(batch.ops);
+    return failures;
+}
+
+static void fsTreeEnter(FsTree *t, const char *name) //the directories being read are now inside name
+{
+    size_t len = strlen(name);
+    if(t->pathLen + len + 2 > t->pathCap)
+    {
+        size_t capacity = t->pathCap ? t->pathCap : 256;
+        while(capacity < t->pathLen + len + 2) capacity *= 2;
+
+        char *grown = realloc(t->path, capacity);
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        t->path = grown;
+        t->pathCap = capacity;
+    }
+    t->path[t->pathLen++] = '/';
+    memcpy(t->path + t->pathLen, name, len + 1);
+    t->pathLen += len;
+}
+
+static void fsTreeLeave(FsTree *t, const char *name) //undo fsTreeEnter()
+{
+    t->pathLen -= strlen(name) + 1;
+    t->path[t->pathLen] = '\0';
+}
+
+static void fsTreeError(FsTree *t, const FsDir *dir, const char *name, int err) //name in dir could not go, dir NULL when it is in the path itself
+{
+    const char *in = dir && dir->name ? dir->name : "";
+    fprintf(stderr, "rm: cannot remove '%s%s%s%s/%s': %s\n", t->top, t->path, in[0] ? "/" : "", in, name, strerror(err));
+    t->failures++;
+}
+
+static void fsTreeFlush(FsTree *t, FsDir *dirs) //run the queued unlinks, each against the fd of the dirs entry it came from
+{
+    for(int k = 0; k < t->batch.count; k++) t->batch.ops[k].name = nameListAt(&t->names, k); //the names have stopped moving
+    fsBatchRun(t->batch.ops, t->batch.count);
+
+    for(int k = 0; k < t->batch.count; k++)
+    {
+        FsOp *op = &t->batch.ops[k];
+        FsDir *dir = &dirs[op->node];
+
+        if(op->result == -EISDIR || op->result == -EPERM) //d_type was unknown and it is a directory after all
+        {
+            struct stat st;
+            if(fstatat(op->dirfd, op->name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))
+            {
+                nameListAdd(&dir->subdirs, op->name, strlen(op->name));
+                continue;
+            }
+        }
+        if(op->result < 0 && op->result != -ENOENT) fsTreeError(t, dir, op->name, -op->result);
+    }
+
+    t->batch.count = 0;
+    t->names.count = 0;
+    t->names.textLen = 0;
+}
+
+static void fsEmptyChildren(FsTree *t, FsDir *parent);
+
+static void fsEmptyDirs(FsTree *t, FsDir *dirs, int n) //remove everything inside the n open dirs, all in the directory t->path ends at
+{
+    //The files of all n directories share the unlink batches, so the work is spread
+    //over many directories instead of queueing on one directory's lock. Every
+    //operation names an entry relative to the fd of the directory holding it, so a
+    //directory renamed or swapped for a symlink meanwhile cannot send rm elsewhere.
+    for(int i = 0; i < n; i++)
+    {
+        long got;
+        while((got = syscall(SYS_getdents64, dirs[i].fd, t->dents, FS_DENTS_SIZE)) > 0)
+        {
+            for(long off = 0; off < got; )
+            {
+                struct lshDirent64 *e = (struct lshDirent64 *) (t->dents + off);
+                off += e->d_reclen;
+
+                if(e->d_name[0] == '.' && (e->d_name[1] == '\0' || (e->d_name[1] == '.' && e->d_name[2] == '\0'))) continue;
+
+                size_t len = strlen(e->d_name);
+                if(e->d_type == DT_DIR)
+                {
+                    nameListAdd(&dirs[i].subdirs, e->d_name, len);
+                    continue;
+                }
+                nameListAdd(&t->names, e->d_name, len);
+                fsOpsPush(&t->batch, FS_UNLINK, dirs[i].fd, NULL, i); //named when it runs, names may still move
+                if(t->batch.count == FS_BATCH_MAX) fsTreeFlush(t, dirs);
+            }
+        }
+    }
+    fsTreeFlush(t, dirs);
+
+    for(int i = 0; i < n; i++)
+    {
+        if(dirs[i].subdirs.count == 0) continue;
+        if(dirs[i].name) fsTreeEnter(t, dirs[i].name);
+        fsEmptyChildren(t, &dirs[i]);
+        if(dirs[i].name) fsTreeLeave(t, dirs[i].name);
+    }
+}
+
+static void fsEmptyChildren(FsTree *t, FsDir *parent) //empty and remove every directory in parent->subdirs
+{
+    //Up to FS_OPEN_MAX directories are open at once across the whole walk, so a
+    //wide level is taken a slice at a time and a deep one a directory at a time.
+    const NameList *names = &parent->subdirs;
+
+    for(int first = 0; first < names->count; )
+    {
+        int room = FS_OPEN_MAX - t->numOpen;
+        int count = names->count - first < room ? names->count - first : room < 1 ? 1 : room;
+        FsOp *opens = malloc(count * sizeof(FsOp));
+        FsDir *dirs = calloc(count, sizeof(FsDir));
+        if(!opens || !dirs)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for(int k = 0; k < count; k++)
+        {
+            opens[k] = (FsOp) { .kind = FS_OPENSUBDIR, .dirfd = parent->fd, .name = nameListAt(names, first + k) };
+        }
+        fsBatchRun(opens, count);
+
+        int numDirs = 0;
+        for(int k = 0; k < count; k++)
+        {
+            if(opens[k].result >= 0) dirs[numDirs++] = (FsDir) { .name = opens[k].name, .fd = opens[k].result };
+            else if(opens[k].result != -ENOENT) fsTreeError(t, NULL, opens[k].name, -opens[k].result);
+        }
+        t->numOpen += numDirs;
+
+        fsEmptyDirs(t, dirs, numDirs);
+
+        for(int k = 0; k < numDirs; k++) //emptied, now they go, relative to the parent they were opened from
+        {
+            close(dirs[k].fd);
+            nameListFree(&dirs[k].subdirs);
+            opens[k] = (FsOp) { .kind = FS_RMDIR, .dirfd = parent->fd, .name = dirs[k].name };
+        }
+        t->numOpen -= numDirs;
+        fsBatchRun(opens, numDirs);
+
+        for(int k = 0; k < numDirs; k++)
+        {
+            int res = opens[k].result;
+            if(res < 0 && res != -ENOENT && !(res == -ENOTEMPTY && t->failures > 0)) //what is still inside was reported
+            {
+                fsTreeError(t, NULL, opens[k].name, -res);
+            }
+        }
+
+        free(opens);
+        free(dirs);
+        first += count;
+    }
+}
+
+static int fsEmptyTree(int topFd, const char *top) //remove everything below the directory open on topFd, returns the number of failures
+{
+    FsTree t = { .top = top, .dents = malloc(FS_DENTS_SIZE), .path = calloc(1, 1), .pathCap = 1 };
+    FsDir dir = { .fd = topFd };
+
+    if(!t.dents || !t.path)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fsEmptyDirs(&t, &dir, 1); //the caller removes the top itself
+
+    nameListFree(&dir.subdirs);
+    nameListFree(&t.names);
+    free(t.batch.ops);
+    free(t.dents);
+    free(t.path);
+    return t.failures;
+}
+
+int lshMkdir(char **args) //mkdir [-p] dir...
+{
+    bool parents = false;
+    int first = 1;
+
+    if(args[1] && strcmp(args[1], "-p") == 0)
+    {
+        parents = true;
+        first = 2;
+    }
+
+    int count = 0;
+    while(args[first + count]) count++;
+
+    if(count == 0)
+    {
+        fprintf(stderr, "mkdir: missing operand\n");
+        lshLastStatus = 1;
+        return 1;
+    }
+
+    if(parents)
+    {
+        if(fsMkdirParents(args + first, count) > 0) lshLastStatus = 1;
+        return 1;
+    }
+
+    FsOp ops[count];
+    for(int i = 0; i < count; i++)
+    {
+        ops[i] = (FsOp) { .kind = FS_MKDIR, .dirfd = AT_FDCWD, .name = args[first + i], .mode = 0777 };
+    }
+    fsBatchRun(ops, count);
+    for(int i = 0; i < count; i++)
+    {
+        if(ops[i].result < 0)
+        {
+            fprintf(stderr, "mkdir: cannot create directory '%s': %s\n", ops[i].name, strerror(-ops[i].result));
+            lshLastStatus = 1;
+        }
+    }
+    return 1;
+}
+
+int lshRmdir(char **args) //rmdir dir...
+{
+    int count = 0;
+    while(args[1 + count]) count++;
+
+    if(count == 0)
+    {
+        fprintf(stderr, "rmdir: missing operand\n");
+        lshLastStatus = 1;
+        return 1;
+    }
+
+    FsOp ops[count];
+    for(int i = 0; i < count; i++)
+    {
+        ops[i] = (FsOp) { .kind = FS_RMDIR, .dirfd = AT_FDCWD, .name = args[1 + i] };
+    }
+    fsBatchRun(ops, count);
+    for(int i = 0; i < count; i++)
+    {
+        if(ops[i].result < 0)
+        {
+            fprintf(stderr, "rmdir: failed to remove '%s': %s\n", ops[i].name, strerror(-ops[i].result));
+            lshLastStatus = 1;
+        }
+    }
+    return 1;
+}
+
+int lshRm(char **args) //rm [-r] [-f] path...
+{
+    bool recursive = false, force = false;
+    int first = 1;
+
+    for(; args[first] && args[first][0] == '-' && args[first][1]; first++)
+    {
+        if(strcmp(args[first], "--") == 0)
+        {
+            first++;
+            break;
+        }
+        for(const char *f = args[first] + 1; *f; f++)
+        {
+            if(*f == 'r' || *f == 'R') recursive = true;
+            else if(*f == 'f') force = true;
+            else
+            {
+                fprintf(stderr, "rm: invalid option -- '%c'\n", *f);
+                lshLastStatus = 1;
+                return 1;
+            }
+        }
+    }
+
+    int count = 0;
+    while(args[first + count]) count++;
+    if(count == 0)
+    {
+        if(!force)
+        {
+            fprintf(stderr, "rm: missing operand\n");
+            lshLastStatus = 1;
+        }
+        return 1;
+    }
+
+    FsOp ops[count];
+    int failures = 0;
+
+    for(int i = 0; i < count; i++) //plain files first, all in one batch
+    {
+        ops[i] = (FsOp) { .kind = FS_UNLINK, .dirfd = AT_FDCWD, .name = args[first + i] };
+    }
+    fsBatchRun(ops, count);
+
+    for(int i = 0; i < count; i++)
+    {
+        const char *name = ops[i].name;
+        const char *base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+        int res = ops[i].result;
+
+        if(res >= 0 || (res == -ENOENT && force)) continue;
+
+        if(res == -EISDIR && recursive)
+        {
+            if(strcmp(base, ".") == 0 || strcmp(base, "..") == 0 || strspn(name, "/") == strlen(name))
+            {
+                fprintf(stderr, "rm: refusing to remove '%s'\n", name);
+                failures++;
+                continue;
+            }
+
+            int fd = open(name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if(fd >= 0)
+            {
+                failures += fsEmptyTree(fd, name);
+                close(fd);
+            }
+            res = rmdir(name) == 0 ? 0 : -errno;
+            if(res == 0 || (res == -ENOTEMPTY && failures > 0)) continue; //what is left inside was reported
+        }
+
+        fprintf(stderr, "rm: cannot remove '%s': %s\n", name, strerror(-res));
+        failures++;
+    }
+
+    if(failures > 0) lshLastStatus = 1;
+    return 1;
+}
+
+void fsFree(void)
+{
+    if(fsOwner == getpid()) fsRingClose(&fsRing, true); //the pool's threads go with the process
+}
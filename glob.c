@@ -0,0 +1,533 @@
+#include "lsh.h"
+
+//Pathname expansion for *, ?, [...] and **. The tokenizer replaces unquoted
+//wildcards with marker bytes, so a quoted * is never expanded. The pattern is cut
+//into / separated segments: leading segments without wildcards are only joined into
+//the directory to start in, each wildcard segment reads its directory with
+//getdents64() into one large buffer and matches names straight out of it, and
+//d_type says which entries are directories, so stat() is only needed when the file
+//system does not fill it in. Matches are packed into one NameList and put in order
+//by an LSD radix sort on 8-byte prefix keys, recursing into groups that share a
+//key, so each byte of a shared prefix is looked at only once.
+
+bool lshTokGlob; //the last lshTokenize() call left wildcards to expand
+
+static char **globBlocks; //match texts, owned here until the command has run
+static int globNumBlocks, globCapBlocks;
+
+typedef struct { //one expansion in progress
+    char **segs; //pattern segments, wildcards still as marker bytes
+    int numSegs;
+    bool wantDir; //the pattern ended in /
+    char path[PATH_MAX]; //directory being read, as it goes into the results
+    size_t pathLen;
+    char *dents; //getdents64() buffer, shared by every directory
+    NameList matches;
+} GlobState;
+
+static bool globIsMagic(char c)
+{
+    return c == LSH_GLOB_STAR || c == LSH_GLOB_QMARK || c == LSH_GLOB_BRACKET;
+}
+
+static bool globHasMagic(const char *s) //wildcard markers the word has to be expanded or unmarked for
+{
+    for(; *s; s++)
+    {
+        if(globIsMagic(*s)) return true;
+    }
+    return false;
+}
+
+static bool globIsPattern(const char *s) //a * or ?, or a [ with its ] in the same segment; [ -f x ] never reads a directory
+{
+    for(; *s; s++)
+    {
+        if(*s == LSH_GLOB_STAR || *s == LSH_GLOB_QMARK) return true;
+        if(*s == LSH_GLOB_BRACKET)
+        {
+            const char *p = s + 1;
+            if(*p == '!' || *p == '^') p++;
+            if(*p == ']') p++; //part of the set, as in globBracket()
+            while(*p && *p != ']' && *p != '/') p++;
+            if(*p == ']') return true;
+        }
+    }
+    return false;
+}
+
+static void globUnmark(char *s) //back to the characters that were typed
+{
+    for(; *s; s++)
+    {
+        if(*s == LSH_GLOB_STAR) *s = '*';
+        else if(*s == LSH_GLOB_QMARK) *s = '?';
+        else if(*s == LSH_GLOB_BRACKET) *s = '[';
+    }
+}
+
+static const char *globBracket(const char *p, unsigned char c, bool *matched) //match c against the set after a [, returns what follows the ], NULL if it is not closed
+{
+    bool negate = *p == '!' || *p == '^';
+    bool found = false;
+
+    if(negate) p++;
+
+    const char *start = p;
+    while(*p && (*p != ']' || p == start)) //a ] right after [ or [! is part of the set
+    {
+        unsigned char lo = *p == LSH_GLOB_STAR ? '*' : *p == LSH_GLOB_QMARK ? '?' : *p == LSH_GLOB_BRACKET ? '[' : *p;
+        unsigned char hi = lo;
+
+        if(p[1] == '-' && p[2] && p[2] != ']')
+        {
+            hi = p[2];
+            p += 2;
+        }
+        if(c >= lo && c <= hi) found = true;
+        p++;
+    }
+    if(*p != ']') return NULL;
+
+    *matched = found != negate;
+    return p + 1;
+}
+
+static bool globMatch(const char *pat, const char *name) //does name match one segment of a pattern
+{
+    const char *starPat = NULL, *starName = NULL; //where to resume after the last *
+
+    while(*name)
+    {
+        unsigned char c = *name;
+        size_t charLen = 1; //? and [...] take a whole UTF-8 character
+        if(c >= 0xC0) while(((unsigned char) name[charLen] & 0xC0) == 0x80) charLen++;
+
+        if(*pat == LSH_GLOB_STAR)
+        {
+            starPat = ++pat;
+            starName = name;
+            continue;
+        }
+        if(*pat == LSH_GLOB_QMARK)
+        {
+            pat++;
+            name += charLen;
+            continue;
+        }
+        if(*pat == LSH_GLOB_BRACKET)
+        {
+            bool matched;
+            const char *next = globBracket(pat + 1, c, &matched);
+
+            if(next && matched)
+            {
+                pat = next;
+                name += charLen;
+                continue;
+            }
+            if(!next && c == '[') //an unclosed [ is just a [
+            {
+                pat++;
+                name++;
+                continue;
+            }
+        }
+        else if(*pat == *name)
+        {
+            pat++;
+            name++;
+            continue;
+        }
+
+        if(!starPat) return false; //mismatch: let the last * take one more character
+        pat = starPat;
+        name = ++starName;
+    }
+
+    while(*pat == LSH_GLOB_STAR) pat++;
+    return *pat == '\0';
+}
+
+static void globAdd(GlobState *g, const char *name, size_t len, bool dir) //path + name is a result
+{
+    size_t total = g->pathLen + len + (dir && g->wantDir);
+
+    if(total >= sizeof(g->path)) return;
+
+    memcpy(g->path + g->pathLen, name, len); //built on the end of path, which is put back after
+    if(dir && g->wantDir) g->path[g->pathLen + len] = '/';
+    nameListAdd(&g->matches, g->path, total);
+    g->path[g->pathLen] = '\0';
+}
+
+static bool globIsDir(int dirfd, const struct lshDirent64 *e) //d_type, or stat() when the file system leaves it out
+{
+    struct stat st;
+
+    if(e->d_type == DT_DIR) return true;
+    if(e->d_type != DT_LNK && e->d_type != DT_UNKNOWN) return false;
+    return fstatat(dirfd, e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void globWalk(GlobState *g, int dirfd, int seg);
+
+static void globDescend(GlobState *g, int dirfd, const char *name, int seg) //continue in subdirectory name at segment seg
+{
+    size_t len = strlen(name);
+    size_t saved = g->pathLen;
+
+    if(saved + len + 2 > sizeof(g->path)) return;
+
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) return;
+
+    memcpy(g->path + saved, name, len);
+    g->path[saved + len] = '/';
+    g->pathLen = saved + len + 1;
+
+    globWalk(g, fd, seg);
+
+    close(fd);
+    g->pathLen = saved;
+    g->path[saved] = '\0';
+}
+
+static void globWalk(GlobState *g, int dirfd, int seg) //match segments seg.. in the directory open on dirfd
+{
+    const char *pat = g->segs[seg];
+    bool last = seg + 1 == g->numSegs;
+    bool globstar = pat[0] == LSH_GLOB_STAR && pat[1] == LSH_GLOB_STAR && pat[2] == '\0';
+
+    if(!globIsPattern(pat)) //a plain name after a wildcard: one lookup instead of a listing
+    {
+        struct stat st;
+        if(fstatat(dirfd, pat, &st, last && !g->wantDir ? AT_SYMLINK_NOFOLLOW : 0) != 0) return;
+
+        if(!last) globDescend(g, dirfd, pat, seg + 1);
+        else if(!g->wantDir || S_ISDIR(st.st_mode)) globAdd(g, pat, strlen(pat), S_ISDIR(st.st_mode));
+        return;
+    }
+
+    if(globstar && !last) globWalk(g, dirfd, seg + 1); //** matches no directory at all too
+
+    bool dotOk = pat[0] == '.'; //hidden names only match a pattern that starts with a dot
+    bool all = pat[0] == LSH_GLOB_STAR && pat[1] == '\0'; //plain *, nothing to compare
+    NameList subdirs = { 0 }; //descended into once this directory is read, so the buffer can be reused
+
+    lseek(dirfd, 0, SEEK_SET); //the ** call above may have read this directory already
+    while(true)
+    {
+        long n = syscall(SYS_getdents64, dirfd, g->dents, GLOB_DENTS_SIZE);
+        if(n <= 0) break;
+
+        for(long off = 0; off < n; )
+        {
+            struct lshDirent64 *e = (struct lshDirent64 *) (g->dents + off);
+            const char *name = e->d_name;
+            off += e->d_reclen;
+
+            if(name[0] == '.' && (!dotOk || name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            if(globstar) //every directory below, through real directories only so links cannot loop
+            {
+                bool dir = e->d_type == DT_DIR || (e->d_type == DT_UNKNOWN && globIsDir(dirfd, e));
+
+                if(last && (dir || !g->wantDir)) globAdd(g, name, strlen(name), dir); //a final ** is everything below
+                if(dir) nameListAdd(&subdirs, name, strlen(name));
+                continue;
+            }
+
+            if(!all && !globMatch(pat, name)) continue;
+
+            if(last && !g->wantDir)
+            {
+                globAdd(g, name, strlen(name), false);
+            }
+            else if(globIsDir(dirfd, e))
+            {
+                if(last) globAdd(g, name, strlen(name), true);
+                else nameListAdd(&subdirs, name, strlen(name));
+            }
+        }
+    }
+
+    for(int i = 0; i < subdirs.count; i++)
+    {
+        globDescend(g, dirfd, nameListAt(&subdirs, i), globstar ? seg : seg + 1);
+    }
+    nameListFree(&subdirs);
+}
+
+static uint64_t globKeyAt(const char *s) //the next 8 bytes of s as one number, in byte order, zero past the end
+{
+    uint64_t key = 0;
+    int i = 0;
+
+    for(; i < 8 && s[i]; i++) key = key << 8 | (unsigned char) s[i];
+    return i == 0 ? 0 : key << (8 * (8 - i));
+}
+
+static void globSort(GlobKey *a, GlobKey *tmp, size_t n, size_t depth) //byte order, 8 bytes a round
+{
+    if(n < 32) //insertion sort for the small groups
+    {
+        for(size_t i = 1; i < n; i++)
+        {
+            GlobKey k = a[i];
+            size_t j = i;
+            for(; j > 0 && strcmp(a[j - 1].name + depth, k.name + depth) > 0; j--) a[j] = a[j - 1];
+            a[j] = k;
+        }
+        return;
+    }
+
+    //The keys are cached next to the pointers, so a round is an LSD radix sort over
+    //them that never touches the names; bytes every name shares cost no pass at all.
+    static size_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    for(size_t i = 0; i < n; i++)
+    {
+        a[i].key = globKeyAt(a[i].name + depth);
+        for(int b = 0; b < 8; b++) counts[b][(a[i].key >> (8 * b)) & 0xFF]++;
+    }
+
+    GlobKey *from = a, *to = tmp;
+    for(int b = 0; b < 8; b++)
+    {
+        size_t pos = 0, *count = counts[b];
+        if(count[(from[0].key >> (8 * b)) & 0xFF] == n) continue;
+
+        for(int v = 0; v < 256; v++)
+        {
+            size_t c = count[v];
+            count[v] = pos;
+            pos += c;
+        }
+        for(size_t i = 0; i < n; i++) to[count[(from[i].key >> (8 * b)) & 0xFF]++] = from[i];
+
+        GlobKey *t = from;
+        from = to;
+        to = t;
+    }
+    if(from != a) memcpy(a, from, n * sizeof(GlobKey));
+
+    for(size_t i = 0; i < n; ) //names with the same 8 bytes go on to the next 8, unless they ended
+    {
+        size_t j = i + 1;
+        while(j < n && a[j].key == a[i].key) j++;
+        if(j - i > 1 && (a[i].key & 0xFF)) globSort(a + i, tmp, j - i, depth + 8);
+        i = j;
+    }
+}
+
+static void globKeep(char *block)
+{
+    if(globNumBlocks == globCapBlocks)
+    {
+        int capacity = globCapBlocks ? globCapBlocks * 2 : 16;
+        char **grown = realloc(globBlocks, capacity * sizeof(char*));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        globBlocks = grown;
+        globCapBlocks = capacity;
+    }
+    globBlocks[globNumBlocks++] = block;
+}
+
+static int globPattern(char *word, char ***out, int *numOut, int *capOut) //expand one word into *out, returns the number of matches
+{
+    GlobState g = { 0 };
+    size_t len = strlen(word);
+    char **segs = malloc((len / 2 + 2) * sizeof(char*) + len + 1); //on the heap, a word can be longer than the stack
+    if(!segs)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    char *copy = (char *) (segs + len / 2 + 2);
+
+    memcpy(copy, word, len + 1);
+
+    bool absolute = copy[0] == '/';
+    g.wantDir = len > 0 && copy[len - 1] == '/';
+    g.segs = segs;
+
+    for(char *p = copy + absolute; *p; ) //cut into segments, empty ones (a//b) dropped
+    {
+        char *slash = strchrnul(p, '/');
+        bool end = *slash == '\0';
+
+        *slash = '\0';
+        if(*p) segs[g.numSegs++] = p;
+        if(end) break;
+        p = slash + 1;
+    }
+
+    int first = 0; //wildcard-free leading segments become the starting directory, unchecked
+    if(absolute) g.path[g.pathLen++] = '/';
+    while(first < g.numSegs - 1 && !globIsPattern(segs[first]))
+    {
+        int n = snprintf(g.path + g.pathLen, sizeof(g.path) - g.pathLen, "%s/", segs[first]);
+        if(n < 0 || (size_t) n >= sizeof(g.path) - g.pathLen)
+        {
+            free(segs);
+            return 0;
+        }
+        g.pathLen += n;
+        first++;
+    }
+    g.path[g.pathLen] = '\0';
+
+    size_t start = g.pathLen;
+    int dirfd = open(g.pathLen ? g.path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirfd < 0)
+    {
+        free(segs);
+        return 0;
+    }
+
+    g.dents = malloc(GLOB_DENTS_SIZE);
+    if(!g.dents)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    globWalk(&g, dirfd, first);
+    close(dirfd);
+    free(g.dents);
+    free(segs);
+
+    int count = g.matches.count;
+    if(count == 0)
+    {
+        nameListFree(&g.matches);
+        return 0;
+    }
+
+    GlobKey *sorted = malloc(2 * count * sizeof(GlobKey));
+    if(!sorted)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < count; i++)
+    {
+        sorted[i].name = g.matches.text + g.matches.offsets[i];
+    }
+    globSort(sorted, sorted + count, count, start); //every match begins with the starting directory
+
+    for(int i = 0; i < count; i++)
+    {
+        if(*numOut + 1 >= *capOut) //keep room for the final NULL
+        {
+            *capOut *= 2;
+            char **grown = realloc(*out, *capOut * sizeof(char*));
+            if(!grown)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            *out = grown;
+        }
+        (*out)[(*numOut)++] = sorted[i].name;
+    }
+
+    free(sorted);
+    free(g.matches.offsets);
+    globKeep(g.matches.text); //the words point into it
+    return count;
+}
+
+char **globExpand(char ***tokensPtr, int *capacity) //replace every word with wildcards by the paths it matches
+{
+    char **in = *tokensPtr;
+    int numIn = 0;
+    while(in[numIn]) numIn++;
+
+    int outCap = numIn + 2 > LSH_TOK_BUFSIZE ? numIn + 2 : LSH_TOK_BUFSIZE, numOut = 0;
+    char **out = malloc(outCap * sizeof(char*));
+    if(!out)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool commandStart = true; //still in the NAME=value words in front of a command
+
+    for(int i = 0; i < numIn; i++)
+    {
+        char *word = in[i];
+        TokenKind kind = lshTokKind(word);
+        TokenKind prev = i > 0 ? lshTokKind(in[i - 1]) : TOK_WORD;
+        bool target = prev == TOK_IN || prev == TOK_OUT || prev == TOK_APPEND || prev == TOK_ERR || prev == TOK_HEREDOC || prev == TOK_HERESTR || prev == TOK_HEREBODY; //file names and delimiters stay one word
+        bool assignment = commandStart && kind == TOK_WORD && varIsAssignment(word);
+
+        commandStart = kind == TOK_PIPE || kind == TOK_BG || assignment;
+        if(kind == TOK_WORD && !target && !assignment && globIsPattern(word) && globPattern(word, &out, &numOut, &outCap) > 0)
+        {
+            continue;
+        }
+        if(kind == TOK_WORD && globHasMagic(word)) //no match: the word as typed, like bash
+        {
+            word = strdup(word); //a copy, a word of a parsed loop body is expanded again next time
+            if(!word)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            globUnmark(word);
+            globKeep(word);
+        }
+        if(numOut + 1 >= outCap)
+        {
+            outCap *= 2;
+            char **grown = realloc(out, outCap * sizeof(char*));
+            if(!grown)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            out = grown;
+        }
+        out[numOut++] = word;
+    }
+    out[numOut] = NULL;
+
+    free(in);
+    *tokensPtr = out;
+    *capacity = outCap;
+    lshTokGlob = false;
+    return out;
+}
+
+int globMark(void) //where the matches of the next command start, for globReleaseTo()
+{
+    return globNumBlocks;
+}
+
+void globReleaseTo(int mark) //done with the matches expanded since mark
+{
+    for(int i = mark; i < globNumBlocks; i++)
+    {
+        free(globBlocks[i]);
+    }
+    globNumBlocks = mark;
+}
+
+void globRelease(void) //done with the command the matches were expanded for
+{
+    globReleaseTo(0);
+}
+
+void globFree(void)
+{
+    globRelease();
+    free(globBlocks);
+    globBlocks = NULL;
+    globCapBlocks = 0;
+}
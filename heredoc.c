@@ -0,0 +1,171 @@
+#include "lsh.h"
+
+//Here-documents (<<WORD) and here-strings (<<<word). The body is gathered in
+//memory and handed to the command as an fd: a pipe when it fits the pipe's
+//buffer, so one write() stages it and nothing blocks, or a memfd for anything
+//bigger. No temporary file and no helper process is involved.
+
+static void heredocAppend(char **buf, size_t *len, size_t *cap, const char *s, size_t n)
+{
+    if(*len + n > *cap)
+    {
+        size_t capacity = *cap ? *cap : 256;
+        while(capacity < *len + n) capacity *= 2;
+
+        char *grown = realloc(*buf, capacity);
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        *buf = grown;
+        *cap = capacity;
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+}
+
+char *heredocReadBody(LineSource *src, const char *delim, size_t *lenOut) //lines up to delim, from wherever the command came from
+{
+    char *body = NULL;
+    size_t len = 0, cap = 0;
+
+    while(true)
+    {
+        if(src->interactive)
+        {
+            fputs("> ", stdout); //continuation prompt
+            fflush(stdout);
+        }
+
+        char *line = lshNextLine(src); //valid until the command has run, like the line that started it
+        if(!line)
+        {
+            fprintf(stderr, "lsh: warning: here-document delimited by end-of-file (wanted `%s')\n", delim);
+            break;
+        }
+        if(strcmp(line, delim) == 0) break;
+
+        heredocAppend(&body, &len, &cap, line, strlen(line));
+        heredocAppend(&body, &len, &cap, "\n", 1);
+    }
+
+    *lenOut = len;
+    return body;
+}
+
+static bool heredocWriteAll(int fd, const char *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int heredocStage(const char *body, size_t len) //fd to read body from, -1 on error
+{
+    int fds[2];
+
+    if(len <= HEREDOC_PIPE_MAX && pipe2(fds, O_CLOEXEC) == 0)
+    {
+        int size = fcntl(fds[1], F_GETPIPE_SZ);
+        if(size >= 0 && (size_t) size < len)
+        {
+            size = fcntl(fds[1], F_SETPIPE_SZ, (int) len); //up to /proc/sys/fs/pipe-max-size
+        }
+
+        if(size >= 0 && (size_t) size >= len && heredocWriteAll(fds[1], body, len)) //all of it is buffered, so this never blocks
+        {
+            close(fds[1]);
+            return fds[0];
+        }
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    int fd = memfd_create("lsh-heredoc", MFD_CLOEXEC); //memory backed file, never on disk
+    if(fd < 0)
+    {
+        perror("lsh: memfd_create");
+        return -1;
+    }
+    if(!heredocWriteAll(fd, body, len) || lseek(fd, 0, SEEK_SET) != 0)
+    {
+        perror("lsh: here-document");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int heredocTake(char **args) //stage and remove the <<WORD and <<<word redirections in args, returns the fd for stdin, -1 for none, -2 on error
+{
+    int fd = -1;
+    int w = 0;
+
+    for(int i = 0; args[i] != NULL; i++)
+    {
+        TokenKind kind = lshTokKind(args[i]);
+
+        if(kind != TOK_HEREDOC && kind != TOK_HERESTR && kind != TOK_HEREBODY)
+        {
+            args[w++] = args[i];
+            continue;
+        }
+
+        if(args[i+1] == NULL || lshTokKind(args[i+1]) != TOK_WORD)
+        {
+            fprintf(stderr, "lsh: syntax error near unexpected token `%s'\n", args[i]);
+            if(fd >= 0) close(fd);
+            return -2;
+        }
+
+        char *body;
+        size_t len;
+
+        if(kind == TOK_HEREDOC) //every body is read, even when a later one wins
+        {
+            body = heredocReadBody(&lshInput, args[i+1], &len);
+        }
+        else if(kind == TOK_HEREBODY) //read when the command was parsed
+        {
+            len = strlen(args[i+1]);
+            body = strdup(args[i+1]);
+            if(!body)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else
+        {
+            len = strlen(args[i+1]);
+            body = malloc(len + 1);
+            if(!body)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(body, args[i+1], len);
+            body[len++] = '\n'; //a here-string ends with a newline
+        }
+
+        if(fd >= 0) close(fd);
+        fd = heredocStage(body, len);
+        free(body);
+
+        if(fd < 0) return -2;
+        i++; //skip the word
+    }
+
+    args[w] = NULL;
+    return fd;
+}
@@ -0,0 +1,208 @@
+#include "lsh.h"
+
+//Persistent history. Entries are appended to $HISTFILE as framed records with
+//O_APPEND, so concurrent sessions can share one file, and each record's offset
+//is appended to an index file next to it. Startup maps the index and reads only
+//the records the ring can hold instead of parsing the whole file.
+
+HistFile histFile = { .dataFd = -1, .indexFd = -1 }; //global history file, closed until histFileOpen()
+
+static bool histRecordAt(const char *data, size_t dataLen, uint64_t off, const char **text, uint32_t *len) //validate the record at off
+{
+    HistRecord rec;
+
+    if(off > dataLen || dataLen - off < sizeof(rec)) return false;
+
+    memcpy(&rec, data + off, sizeof(rec));
+    if(rec.magic != HIST_RECORD_MAGIC || rec.len > dataLen - off - sizeof(rec)) return false;
+
+    *text = data + off + sizeof(rec);
+    *len = rec.len;
+    return true;
+}
+
+static bool histOwnRecord(HistFile *hf, uint64_t off) //was this record written by this session?
+{
+    for(size_t i = 0; i < hf->numOwn; i++)
+    {
+        if(hf->own[i] == off) return true;
+    }
+    return false;
+}
+
+static uint64_t histScan(HistFile *hf, History *h, uint64_t from, bool skipOwn, bool rebuildIndex) //read records from offset from to end of file
+{
+    struct stat st;
+
+    if(fstat(hf->dataFd, &st) != 0 || (uint64_t) st.st_size <= from) return from;
+
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t mapStart = from & ~(uint64_t) (pageSize - 1);
+    size_t mapLen = st.st_size - mapStart;
+    char *map = mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE, hf->dataFd, mapStart);
+
+    if(map == MAP_FAILED) return from;
+
+    const char *data = map - mapStart; //so record offsets can be used directly
+    uint64_t off = from;
+    uint64_t batch[1024]; //index entries being rebuilt, written a batch at a time
+    size_t numBatch = 0;
+    const char *text;
+    uint32_t len;
+
+    while(histRecordAt(data, st.st_size, off, &text, &len))
+    {
+        if(!(skipOwn && histOwnRecord(hf, off)))
+        {
+            historyStore(h, text, len); //into the ring without writing it back
+        }
+        if(rebuildIndex)
+        {
+            batch[numBatch++] = off;
+            if(numBatch == sizeof(batch) / sizeof(batch[0]) && write(hf->indexFd, batch, sizeof(batch)) >= 0)
+            {
+                numBatch = 0;
+            }
+        }
+        off += sizeof(HistRecord) + len;
+    }
+
+    if(numBatch > 0 && write(hf->indexFd, batch, numBatch * sizeof(uint64_t)) < 0)
+    {
+        perror("lsh: history index");
+    }
+
+    munmap(map, mapLen);
+    return off; //a partial record at the end is left for the next scan
+}
+
+void histFileOpen(HistFile *hf, const char *path)
+{
+    char indexPath[PATH_MAX];
+
+    hf->dataFd = hf->indexFd = -1;
+    hf->seen = 0;
+    hf->numOwn = 0;
+
+    if(snprintf(indexPath, sizeof(indexPath), "%s.idx", path) >= (int) sizeof(indexPath)) return;
+
+    hf->dataFd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    hf->indexFd = open(indexPath, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+    if(hf->dataFd < 0 || hf->indexFd < 0)
+    {
+        perror("lsh: history file");
+        histFileClose(hf);
+    }
+}
+
+void histFileLoad(HistFile *hf, History *h) //load the newest h->capacity entries
+{
+    struct stat dataSt, indexSt;
+
+    if(hf->dataFd < 0 || fstat(hf->dataFd, &dataSt) != 0 || fstat(hf->indexFd, &indexSt) != 0) return;
+
+    size_t count = indexSt.st_size / sizeof(uint64_t);
+
+    if(count == 0) //no index yet, or it was lost: one full scan rebuilds it
+    {
+        if(ftruncate(hf->indexFd, 0) == 0)
+        {
+            hf->seen = histScan(hf, h, 0, false, true);
+        }
+        return;
+    }
+
+    uint64_t *index = mmap(NULL, count * sizeof(uint64_t), PROT_READ, MAP_PRIVATE, hf->indexFd, 0);
+    if(index == MAP_FAILED) return;
+
+    size_t first = count > h->capacity ? count - h->capacity : 0; //only the tail of the index is touched
+    uint64_t lowest = UINT64_MAX, end = 0;
+
+    for(size_t i = first; i < count; i++)
+    {
+        if(index[i] < lowest) lowest = index[i];
+    }
+
+    if(lowest < (uint64_t) dataSt.st_size)
+    {
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        uint64_t mapStart = lowest & ~(uint64_t) (pageSize - 1);
+        size_t mapLen = dataSt.st_size - mapStart;
+        char *map = mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE, hf->dataFd, mapStart);
+
+        if(map != MAP_FAILED)
+        {
+            const char *data = map - mapStart;
+            const char *text;
+            uint32_t len;
+
+            for(size_t i = first; i < count; i++)
+            {
+                if(histRecordAt(data, dataSt.st_size, index[i], &text, &len)) //skip index entries that point at garbage
+                {
+                    historyStore(h, text, len); //into the ring without writing it back
+                    if(index[i] + sizeof(HistRecord) + len > end) end = index[i] + sizeof(HistRecord) + len;
+                }
+            }
+            munmap(map, mapLen);
+        }
+    }
+
+    munmap(index, count * sizeof(uint64_t));
+
+    //records appended after the last indexed one (a session that died between its two writes)
+    hf->seen = histScan(hf, h, end, false, false);
+}
+
+void histFileAppend(HistFile *hf, const char *line)
+{
+    if(hf->dataFd < 0) return;
+
+    size_t len = strlen(line);
+    HistRecord rec = { HIST_RECORD_MAGIC, (uint32_t) len };
+    struct iovec iov[2] = {
+        { &rec, sizeof(rec) },
+        { (void *) line, len }
+    };
+
+    ssize_t written = writev(hf->dataFd, iov, 2); //one O_APPEND write, so records from other sessions never interleave with it
+    if(written != (ssize_t) (sizeof(rec) + len))
+    {
+        perror("lsh: history file");
+        histFileClose(hf);
+        return;
+    }
+
+    off_t after = lseek(hf->dataFd, 0, SEEK_CUR); //an O_APPEND write leaves the offset at the end of this record
+    uint64_t off = after - written;
+
+    if(write(hf->indexFd, &off, sizeof(off)) != sizeof(off))
+    {
+        perror("lsh: history index");
+    }
+
+    if(off == hf->seen) //nobody else wrote since we last looked
+    {
+        hf->seen = after;
+    }
+    else if(hf->numOwn < HIST_MAX_OWN) //history -n must skip this one
+    {
+        hf->own[hf->numOwn++] = off;
+    }
+}
+
+void histFileReadNew(HistFile *hf, History *h) //history -n: pull in entries other sessions appended
+{
+    if(hf->dataFd < 0) return;
+
+    hf->seen = histScan(hf, h, hf->seen, true, false);
+    hf->numOwn = 0;
+}
+
+void histFileClose(HistFile *hf)
+{
+    if(hf->dataFd >= 0) close(hf->dataFd);
+    if(hf->indexFd >= 0) close(hf->indexFd);
+    hf->dataFd = hf->indexFd = -1;
+}
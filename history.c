@@ -0,0 +1,389 @@
+#include "lsh.h"
+
+//In-memory history. Entry texts are packed one after another into a single byte
+//arena and a ring of offsets says where each one is, so an entry costs its text
+//plus a few bytes instead of a separate allocation. Evicted texts leave a dead
+//prefix in the arena that is squeezed out once it is half of it. Repeats are found
+//through a hash set of entries ($HISTCONTROL=ignoredups or erasedups) and substring
+//search goes through a trigram index, built on the first search and kept up to date
+//after that, so only entries that share the pattern's rarest trigram are looked at.
+
+static uint32_t historyHash(const char *s, size_t len) //FNV-1a
+{
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; i++)
+    {
+        h = (h ^ (unsigned char) s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static inline uint32_t historyGram(const char *s) //trigram bucket of the three bytes at s
+{
+    uint32_t g = (unsigned char) s[0] << 16 | (unsigned char) s[1] << 8 | (unsigned char) s[2];
+    return (g * 2654435761u) >> (32 - HIST_GRAM_BITS);
+}
+
+static inline HistEntry *historySlot(const History *h, unsigned long num) //entry number num, which must still be in the ring
+{
+    unsigned long first = h->total - h->size + 1;
+    return &h->entries[(h->start + (num - first)) % h->capacity];
+}
+
+static void historyControl(History *h) //how repeats are handled, from $HISTCONTROL
+{
+    const char *control = varGet("HISTCONTROL");
+
+    if(!control) h->dedupMode = HIST_KEEPDUPS;
+    else if(strstr(control, "erasedups")) h->dedupMode = HIST_ERASEDUPS;
+    else if(strstr(control, "ignoredups")) h->dedupMode = HIST_IGNOREDUPS;
+    else h->dedupMode = HIST_KEEPDUPS;
+}
+
+void historyInit(History *h)
+{
+    const char *size = varGet("HISTSIZE");
+    long capacity = size ? strtol(size, NULL, 10) : 0;
+
+    if(capacity <= 0) capacity = HISTORY_CAPACITY;
+    if(capacity > HISTORY_MAX) capacity = HISTORY_MAX;
+
+    memset(h, 0, sizeof(*h));
+    h->capacity = capacity;
+    h->entries = calloc(capacity, sizeof(HistEntry));
+
+    h->dedupCap = 16;
+    while(h->dedupCap < h->capacity * 2) h->dedupCap *= 2; //at most half full
+    h->dedup = calloc(h->dedupCap, sizeof(uint32_t));
+
+    if(!h->entries || !h->dedup)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    historyControl(h);
+}
+
+int isAllWhiteSpace(const char *s)
+{
+    while(*s)
+    {
+        if(!isspace((unsigned char) *s)) return 0; //return if a non-whitespace character is found
+        s++;
+    }
+    return 1;
+}
+
+static uint32_t *historyDedupFind(const History *h, const char *text, size_t len, uint32_t hash) //set slot holding text, or the empty slot it would go in
+{
+    size_t mask = h->dedupCap - 1;
+
+    for(size_t i = hash & mask; ; i = (i + 1) & mask)
+    {
+        uint32_t ring = h->dedup[i];
+        if(ring == 0) return &h->dedup[i];
+
+        const HistEntry *e = &h->entries[ring - 1];
+        if(e->hash == hash && e->len == len && memcmp(h->text + e->off, text, len) == 0) return &h->dedup[i];
+    }
+}
+
+static void historyDedupRemove(History *h, const HistEntry *e) //take e out of the set, shifting later entries back
+{
+    size_t mask = h->dedupCap - 1;
+    size_t i = historyDedupFind(h, h->text + e->off, e->len, e->hash) - h->dedup;
+
+    if(h->dedup[i] == 0 || &h->entries[h->dedup[i] - 1] != e) return;
+    h->dedup[i] = 0;
+
+    for(size_t j = (i + 1) & mask; h->dedup[j] != 0; j = (j + 1) & mask) //linear probing: no tombstones needed
+    {
+        size_t home = h->entries[h->dedup[j] - 1].hash & mask;
+        bool movable = i <= j ? (home <= i || home > j) : (home <= i && home > j);
+
+        if(movable)
+        {
+            h->dedup[i] = h->dedup[j];
+            h->dedup[j] = 0;
+            i = j;
+        }
+    }
+}
+
+static void historyArenaReserve(History *h, size_t len) //room for len more bytes at the end of the arena
+{
+    if(h->textLen + len <= h->textCap) return;
+
+    if(h->textStart > 0 && h->textStart >= h->textLen / 2) //mostly evicted text: move the live part down
+    {
+        size_t dead = h->textStart;
+        memmove(h->text, h->text + dead, h->textLen - dead);
+        h->textLen -= dead;
+        h->textStart = 0;
+
+        for(size_t i = 0; i < h->size; i++)
+        {
+            h->entries[(h->start + i) % h->capacity].off -= dead;
+        }
+        if(h->textLen + len <= h->textCap) return;
+    }
+
+    size_t capacity = h->textCap ? h->textCap : HIST_ARENA_INITIAL;
+    while(capacity < h->textLen + len) capacity *= 2;
+
+    char *grown = realloc(h->text, capacity);
+    if(!grown)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    h->text = grown;
+    h->textCap = capacity;
+}
+
+static void historyPostingAdd(HistPosting *p, uint32_t num)
+{
+    if(p->len > 0 && p->nums[p->len - 1] == num) return; //the same trigram twice in one entry
+
+    if(p->len == p->cap)
+    {
+        if(p->head > 0) //drop the evicted entries at the front first
+        {
+            memmove(p->nums, p->nums + p->head, (p->len - p->head) * sizeof(uint32_t));
+            p->len -= p->head;
+            p->head = 0;
+        }
+        if(p->len == p->cap)
+        {
+            uint32_t capacity = p->cap ? p->cap * 2 : 4;
+            uint32_t *grown = realloc(p->nums, capacity * sizeof(uint32_t));
+            if(!grown)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            p->nums = grown;
+            p->cap = capacity;
+        }
+    }
+    p->nums[p->len++] = num;
+}
+
+static void historyIndexEntry(History *h, unsigned long num, const char *text, size_t len)
+{
+    for(size_t i = 0; i + 3 <= len; i++)
+    {
+        historyPostingAdd(&h->grams[historyGram(text + i)], num);
+    }
+}
+
+static void historyIndexTrim(History *h) //forget evicted entries in every posting list
+{
+    uint32_t first = h->total - h->size + 1;
+
+    for(size_t b = 0; b < HIST_GRAM_BUCKETS; b++)
+    {
+        HistPosting *p = &h->grams[b];
+        while(p->head < p->len && p->nums[p->head] < first) p->head++;
+
+        if(p->head == p->len)
+        {
+            free(p->nums);
+            memset(p, 0, sizeof(*p));
+        }
+    }
+}
+
+static void historyIndexBuild(History *h)
+{
+    h->grams = calloc(HIST_GRAM_BUCKETS, sizeof(HistPosting));
+    if(!h->grams)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long first = h->total - h->size + 1;
+    for(size_t i = 0; i < h->size; i++)
+    {
+        const HistEntry *e = &h->entries[(h->start + i) % h->capacity];
+        if(!(e->flags & HIST_ERASED)) historyIndexEntry(h, first + i, h->text + e->off, e->len);
+    }
+}
+
+void historyStore(History *h, const char *line, size_t len) //copy line into the arena as the newest entry
+{
+    uint32_t hash = historyHash(line, len);
+    uint32_t *set = historyDedupFind(h, line, len, hash);
+
+    if(*set != 0 && h->dedupMode == HIST_ERASEDUPS) //the older copy goes, this one is the newest
+    {
+        HistEntry *old = &h->entries[*set - 1];
+        historyDedupRemove(h, old);
+        old->flags |= HIST_ERASED;
+    }
+
+    if(h->size == h->capacity) //full: the oldest entry and its text go
+    {
+        HistEntry *oldest = &h->entries[h->start];
+        if(!(oldest->flags & HIST_ERASED)) historyDedupRemove(h, oldest);
+
+        h->textStart = oldest->off + oldest->len + 1;
+        h->start = (h->start + 1) % h->capacity;
+        h->size--;
+    }
+
+    historyArenaReserve(h, len + 1);
+
+    size_t slot = (h->start + h->size) % h->capacity;
+    HistEntry *e = &h->entries[slot];
+    e->off = h->textLen;
+    e->len = len;
+    e->hash = hash;
+    e->flags = 0;
+
+    memcpy(h->text + h->textLen, line, len);
+    h->text[h->textLen + len] = '\0';
+    h->textLen += len + 1;
+    h->size++;
+    h->total++;
+
+    set = historyDedupFind(h, line, len, hash); //the slot may have moved when an entry was removed
+    *set = slot + 1;
+
+    if(h->grams)
+    {
+        historyIndexEntry(h, h->total, line, len);
+        if(h->total % h->capacity == 0) historyIndexTrim(h); //once per ring's worth of entries
+    }
+}
+
+void historyAdd(History *h, const char *line)
+{
+    if(!line || isAllWhiteSpace(line)) //ignore empty or whitespace-only commands
+    {
+        return;
+    }
+
+    historyControl(h);
+
+    size_t len = strlen(line);
+    if(h->dedupMode == HIST_IGNOREDUPS && h->size > 0) //same as the previous command
+    {
+        const HistEntry *last = historySlot(h, h->total);
+        if(last->len == len && memcmp(h->text + last->off, line, len) == 0) return;
+    }
+
+    historyStore(h, line, len);
+    histFileAppend(&histFile, line); //and make it visible to other sessions
+}
+
+const char *historyEntry(const History *h, unsigned long num) //text of entry number num, NULL if it is gone
+{
+    if(num == 0 || num > h->total || num <= h->total - h->size) return NULL;
+
+    const HistEntry *e = historySlot(h, num);
+    return (e->flags & HIST_ERASED) ? NULL : h->text + e->off;
+}
+
+unsigned long historySearch(History *h, const char *pattern, unsigned long before) //newest entry older than before that contains pattern, 0 if none
+{
+    size_t patLen = strlen(pattern);
+    unsigned long first = h->total - h->size + 1;
+
+    if(before > h->total + 1) before = h->total + 1;
+    if(h->size == 0 || before <= first) return 0;
+
+    if(patLen < 3) //too short for a trigram: look at every entry
+    {
+        for(unsigned long num = before - 1; num >= first; num--)
+        {
+            const char *text = historyEntry(h, num);
+            if(text && strstr(text, pattern)) return num;
+        }
+        return 0;
+    }
+
+    if(!h->grams) historyIndexBuild(h);
+
+    HistPosting *rarest = NULL; //only entries with every trigram can match, so the shortest list is enough
+    for(size_t i = 0; i + 3 <= patLen; i++)
+    {
+        HistPosting *p = &h->grams[historyGram(pattern + i)];
+        if(!rarest || p->len - p->head < rarest->len - rarest->head) rarest = p;
+    }
+
+    uint32_t lo = rarest->head, hi = rarest->len; //first posting not older than before
+    while(lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(rarest->nums[mid] < before) lo = mid + 1;
+        else hi = mid;
+    }
+
+    while(lo > rarest->head && rarest->nums[lo - 1] >= first)
+    {
+        unsigned long num = rarest->nums[--lo];
+        const HistEntry *e = historySlot(h, num);
+
+        if(!(e->flags & HIST_ERASED) && e->len >= patLen && memmem(h->text + e->off, e->len, pattern, patLen)) return num;
+    }
+    return 0;
+}
+
+void historyPrint(const History *h)
+{
+    unsigned long firstNum = h->total - h->size + 1; //the number of the first command in history
+
+    for(size_t i = 0; i < h->size; i++) //print each entry in order
+    {
+        const HistEntry *e = &h->entries[(h->start + i) % h->capacity]; //calculate the correct index in the circular buffer
+        if(e->flags & HIST_ERASED) continue;
+        printf(COLOR_GREEN"%lu" COLOR_YELLOW":" COLOR_RESET"%s\n", firstNum + i, h->text + e->off); //print command number and entry
+    }
+}
+
+void historyPrintMatches(History *h, const char *pattern) //history -s: every entry containing pattern, oldest first
+{
+    size_t count = 0, cap = 0;
+    unsigned long *nums = NULL;
+
+    for(unsigned long num = historySearch(h, pattern, h->total + 1); num; num = historySearch(h, pattern, num))
+    {
+        if(count == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            unsigned long *grown = realloc(nums, cap * sizeof(unsigned long));
+            if(!grown)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            nums = grown;
+        }
+        nums[count++] = num;
+    }
+
+    while(count > 0)
+    {
+        unsigned long num = nums[--count];
+        printf(COLOR_GREEN"%lu" COLOR_YELLOW":" COLOR_RESET"%s\n", num, historyEntry(h, num));
+    }
+    free(nums);
+}
+
+void historyFree(History *h)
+{
+    if(h->grams)
+    {
+        for(size_t b = 0; b < HIST_GRAM_BUCKETS; b++)
+        {
+            free(h->grams[b].nums);
+        }
+        free(h->grams);
+    }
+    free(h->entries);
+    free(h->dedup);
+    free(h->text);
+    memset(h, 0, sizeof(*h));
+}
@@ -0,0 +1,204 @@
+#include "lsh.h"
+
+//Where command lines come from. Interactive sessions read one line at a time;
+//scripts are mmap()ed (or read from stdin in large blocks) and lines are handed
+//out as slices of that buffer, NUL terminated in place, with no per-line copy. A
+//read buffer is grown in place while no line handed out points into it.
+
+LineSource lshInput; //global input source
+
+static void lineSourceRetire(LineSource *src, char *block) //keep a block alive until the current command is done with it
+{
+    if(src->numRetired == src->capRetired)
+    {
+        int capacity = src->capRetired ? src->capRetired * 2 : 4;
+        char **grown = realloc(src->retired, capacity * sizeof(char*));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        src->retired = grown;
+        src->capRetired = capacity;
+    }
+    src->retired[src->numRetired++] = block;
+}
+
+void lineSourceInit(LineSource *src, int fd, bool interactive)
+{
+    struct stat st;
+
+    memset(src, 0, sizeof(*src));
+    src->fd = fd;
+    src->interactive = interactive;
+
+    if(interactive) return;
+
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) //a regular file can be mapped whole
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0); //private, so the tokenizer can write NULs into it
+
+        if(map != MAP_FAILED)
+        {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            src->buf = map;
+            src->len = st.st_size;
+            src->mapped = true;
+            src->eof = true; //everything is already in buf
+        }
+    }
+}
+
+static bool lineSourceFill(LineSource *src) //read another block after the unconsumed tail, returns false at end of input
+{
+    if(src->eof) return false;
+
+    size_t rest = src->len - src->pos;
+    size_t capacity = src->cap;
+
+    if(rest + LSH_INPUT_BLOCK > capacity) //a line longer than a block needs a bigger buffer, doubling keeps a long one linear
+    {
+        capacity = capacity * 2 > rest + LSH_INPUT_BLOCK ? capacity * 2 : rest + LSH_INPUT_BLOCK;
+    }
+
+    if(src->lent) //lines handed out point into buf, the tail moves to a fresh block and buf is freed once they are done
+    {
+        char *block = malloc(capacity + 1);
+        if(!block)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        if(rest) memcpy(block, src->buf + src->pos, rest);
+        lineSourceRetire(src, src->buf);
+        src->buf = block;
+        src->lent = false;
+    }
+    else //nothing points into buf, it is reused and grown in place
+    {
+        if(rest && src->pos) memmove(src->buf, src->buf + src->pos, rest);
+        if(capacity != src->cap || !src->buf)
+        {
+            char *grown = realloc(src->buf, capacity + 1); //read buffers always keep a spare byte
+            if(!grown)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            src->buf = grown;
+        }
+    }
+    src->cap = capacity;
+    src->len = rest;
+    src->pos = 0;
+
+    ssize_t n;
+    do
+    {
+        n = read(src->fd, src->buf + src->len, src->cap - src->len);
+    } while(n < 0 && errno == EINTR);
+
+    if(n < 0)
+    {
+        perror("lsh: read");
+        n = 0;
+    }
+    if(n == 0)
+    {
+        src->eof = true;
+        return rest > 0;
+    }
+
+    src->len += n;
+    return true;
+}
+
+char *lshNextLine(LineSource *src) //next line without its newline, valid until lineSourceRelease(); NULL at end of input
+{
+    if(src->interactive)
+    {
+        char *line = lshReadLine();
+        if(line) lineSourceRetire(src, line);
+        return line;
+    }
+
+    while(true)
+    {
+        char *start = src->buf + src->pos;
+        char *nl = src->len > src->pos + src->scanned ? memchr(start + src->scanned, '\n', src->len - src->pos - src->scanned) : NULL;
+
+        if(nl) //a complete line is in the buffer
+        {
+            *nl = '\0';
+            src->pos = nl - src->buf + 1;
+            src->scanned = 0;
+            src->lineNumber++;
+            src->lent = true;
+            return start;
+        }
+        src->scanned = src->len - src->pos; //a long line is searched once, not again after every block
+
+        if(!src->eof)
+        {
+            lineSourceFill(src);
+            continue;
+        }
+
+        if(src->pos >= src->len) return NULL; //nothing left
+
+        //last line has no newline: it needs one more byte for its NUL
+        size_t len = src->len - src->pos;
+        char *line;
+
+        if(!src->mapped)
+        {
+            line = start; //read buffers always keep a spare byte
+            src->lent = true;
+        }
+        else
+        {
+            line = malloc(len + 1); //the mapping may end exactly on a page boundary
+            if(!line)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(line, start, len);
+            lineSourceRetire(src, line);
+        }
+
+        line[len] = '\0';
+        src->pos = src->len;
+        src->scanned = 0;
+        src->lineNumber++;
+        return line;
+    }
+}
+
+void lineSourceRelease(LineSource *src) //the caller is done with every line it was given so far
+{
+    for(int i = 0; i < src->numRetired; i++)
+    {
+        free(src->retired[i]);
+    }
+    src->numRetired = 0;
+    src->lent = false; //buf can be reused in place again
+}
+
+void lineSourceClose(LineSource *src)
+{
+    lineSourceRelease(src);
+    free(src->retired);
+
+    if(src->mapped)
+    {
+        munmap(src->buf, src->len);
+    }
+    else
+    {
+        free(src->buf);
+    }
+
+    if(src->fd > STDERR_FILENO) close(src->fd);
+    memset(src, 0, sizeof(*src));
+}
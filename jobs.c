@@ -0,0 +1,632 @@
+#include "lsh.h"
+
+//Job table. Every external command or pipeline becomes a job whose processes are
+//waited for by pid, so a pipeline never reaps someone else's child. Background
+//jobs are reaped between prompts by polling one pidfd per process, which costs a
+//single poll() and never blocks or spins.
+
+JobTable jobTable; //global job table
+bool lshJobControl = false; //process groups and terminal hand-off, interactive sessions only
+pid_t lshShellPgid = 0;
+int lshLastStatus = 0; //exit status of the last command, as reported by $? in other shells
+
+int pidfdOpen(pid_t pid) //pidfd for pid, or -1 on kernels without pidfd_open()
+{
+#ifdef SYS_pidfd_open
+    static bool unsupported = false;
+
+    if(!unsupported)
+    {
+        int fd = syscall(SYS_pidfd_open, pid, 0);
+        if(fd >= 0)
+        {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            return fd;
+        }
+        if(errno == ENOSYS) unsupported = true;
+    }
+#endif
+    (void) pid;
+    return -1;
+}
+
+void jobsInitShell(void) //take over the terminal so jobs can be moved between foreground and background
+{
+    lshShellPgid = getpid();
+
+    if(setpgid(0, lshShellPgid) != 0 && getpgrp() != lshShellPgid) //fails harmlessly when we already lead a session
+    {
+        return;
+    }
+
+    //the shell itself must not be stopped or killed by job control signals meant for its jobs
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    if(tcsetpgrp(STDIN_FILENO, lshShellPgid) == 0)
+    {
+        lshJobControl = true;
+    }
+}
+
+Job *jobCreate(char ***cmds, int n, bool background) //new job named after its command line
+{
+    JobTable *t = &jobTable;
+
+    if(t->numJobs == t->capJobs)
+    {
+        int capacity = t->capJobs ? t->capJobs * 2 : 8;
+        Job **grown = realloc(t->jobs, capacity * sizeof(Job*));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        t->jobs = grown;
+        t->capJobs = capacity;
+    }
+
+    Job *j = calloc(1, sizeof(Job));
+    if(!j)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t len = 0;
+    for(int c = 0; c < n; c++)
+    {
+        for(int i = 0; cmds[c][i]; i++) len += strlen(cmds[c][i]) + 1;
+        len += 2; //room for " |"
+    }
+
+    j->command = malloc(len + 1);
+    if(j->command)
+    {
+        char *p = j->command;
+        for(int c = 0; c < n; c++)
+        {
+            if(c > 0) p = stpcpy(p, " | ");
+            for(int i = 0; cmds[c][i]; i++)
+            {
+                if(i > 0) *p++ = ' ';
+                p = stpcpy(p, cmds[c][i]);
+            }
+        }
+        *p = '\0';
+    }
+
+    int highest = 0;
+    for(int i = 0; i < t->numJobs; i++)
+    {
+        if(t->jobs[i]->id > highest) highest = t->jobs[i]->id;
+    }
+
+    j->id = highest + 1; //numbers are reused once the table empties, like other shells
+    j->state = JOB_RUNNING;
+    j->background = background;
+    t->jobs[t->numJobs++] = j;
+    return j;
+}
+
+void jobAddProcess(Job *j, pid_t pid)
+{
+    if(j->numProcs == j->capProcs)
+    {
+        int capacity = j->capProcs ? j->capProcs * 2 : 4;
+        JobProcess *grown = realloc(j->procs, capacity * sizeof(JobProcess));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        j->procs = grown;
+        j->capProcs = capacity;
+    }
+
+    if(j->pgid == 0) j->pgid = pid; //the first process leads the job's group
+
+    if(lshJobControl)
+    {
+        setpgid(pid, j->pgid); //also done in the child, whichever runs first wins
+    }
+
+    JobProcess *p = &j->procs[j->numProcs++];
+    p->pid = pid;
+    p->pidfd = j->background ? pidfdOpen(pid) : -1; //foreground jobs are waited for directly
+    p->status = 0;
+    p->done = false;
+    p->stopped = false;
+    memset(&p->usage, 0, sizeof(p->usage));
+    j->numLive++;
+}
+
+static void jobFree(Job *j)
+{
+    for(int i = 0; i < j->numProcs; i++)
+    {
+        if(j->procs[i].pidfd >= 0) close(j->procs[i].pidfd);
+    }
+    free(j->procs);
+    free(j->command);
+    free(j);
+}
+
+void jobRemove(Job *j)
+{
+    JobTable *t = &jobTable;
+
+    for(int i = 0; i < t->numJobs; i++)
+    {
+        if(t->jobs[i] == j)
+        {
+            memmove(&t->jobs[i], &t->jobs[i + 1], (t->numJobs - i - 1) * sizeof(Job*));
+            t->numJobs--;
+            break;
+        }
+    }
+    jobFree(j);
+}
+
+static void jobSignal(Job *j, int sig) //signal the whole job
+{
+    if(lshJobControl)
+    {
+        kill(-j->pgid, sig);
+        return;
+    }
+
+    for(int i = 0; i < j->numProcs; i++) //without job control the processes share the shell's group
+    {
+        if(!j->procs[i].done) kill(j->procs[i].pid, sig);
+    }
+}
+
+static int jobStatus(const Job *j) //exit status of a job is that of its last process
+{
+    int status = j->procs[j->numProcs - 1].status;
+
+    if(WIFEXITED(status)) return WEXITSTATUS(status);
+    if(WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 0;
+}
+
+static void jobRecord(Job *j, JobProcess *p, int status) //apply a wait status to a process and its job
+{
+    if(WIFSTOPPED(status))
+    {
+        p->stopped = true;
+        j->state = JOB_STOPPED;
+        return;
+    }
+
+    if(WIFCONTINUED(status))
+    {
+        p->stopped = false;
+        return;
+    }
+
+    p->status = status;
+    p->done = true;
+    p->stopped = false;
+    j->numLive--;
+
+    if(p->pidfd >= 0)
+    {
+        close(p->pidfd);
+        p->pidfd = -1;
+    }
+
+    if(j->numLive == 0)
+    {
+        j->state = JOB_DONE;
+    }
+}
+
+static const char *jobStateName(const Job *j)
+{
+    if(j->state == JOB_STOPPED) return "Stopped";
+    if(j->state == JOB_RUNNING) return "Running";
+
+    int status = j->procs[j->numProcs - 1].status;
+    if(WIFSIGNALED(status)) return strsignal(WTERMSIG(status));
+    if(WIFEXITED(status) && WEXITSTATUS(status) != 0) return "Exit";
+    return "Done";
+}
+
+static void jobPrint(const Job *j)
+{
+    const char *mark = (jobTable.numJobs > 0 && jobTable.jobs[jobTable.numJobs - 1] == j) ? "+" : " "; //+ marks the current job
+
+    if(j->state == JOB_DONE && WIFEXITED(j->procs[j->numProcs - 1].status) && jobStatus(j) != 0)
+    {
+        printf("[%d]%s  Exit %-18d %s\n", j->id, mark, jobStatus(j), j->command ? j->command : "");
+    }
+    else
+    {
+        printf("[%d]%s  %-23s %s\n", j->id, mark, jobStateName(j), j->command ? j->command : "");
+    }
+}
+
+int jobWait(Job *j) //wait for a job to finish or stop, blocking on its own pids only
+{
+    for(int i = 0; i < j->numProcs; i++)
+    {
+        JobProcess *p = &j->procs[i];
+        int status;
+        struct rusage ru;
+
+        while(!p->done && !p->stopped)
+        {
+            uint64_t start = timingNow();
+            pid_t r = wait4(p->pid, &status, WUNTRACED, &ru); //the rusage is what time reports
+            lshTiming.waitNs += timingNow() - start;
+
+            if(r == p->pid)
+            {
+                if(!WIFSTOPPED(status))
+                {
+                    timingAddChild(&ru);
+                    p->usage = ru;
+                }
+                jobRecord(j, p, status);
+            }
+            else if(r < 0 && errno != EINTR) //already reaped elsewhere, count it as done
+            {
+                jobRecord(j, p, 0);
+            }
+        }
+    }
+
+    if(j->state != JOB_STOPPED) //every process is done
+    {
+        j->state = JOB_DONE;
+    }
+    return jobStatus(j);
+}
+
+int jobForeground(Job *j, bool resume) //run a job in the foreground until it finishes or stops
+{
+    int status;
+
+    j->background = false;
+
+    if(lshJobControl)
+    {
+        tcsetpgrp(STDIN_FILENO, j->pgid); //give it the terminal
+    }
+
+    if(resume)
+    {
+        j->state = JOB_RUNNING;
+        for(int i = 0; i < j->numProcs; i++) j->procs[i].stopped = false;
+        jobSignal(j, SIGCONT);
+    }
+
+    status = jobWait(j);
+    if(auditOn) auditJob(j); //the pids and how they ended go into the running command's record
+
+    if(lshJobControl)
+    {
+        tcsetpgrp(STDIN_FILENO, lshShellPgid); //and take it back
+    }
+
+    if(j->state == JOB_STOPPED)
+    {
+        printf("\n");
+        jobPrint(j);
+        lshLastStatus = 128 + SIGTSTP;
+        return lshLastStatus;
+    }
+
+    if(lshJobControl && status == 128 + SIGINT)
+    {
+        printf("\n"); //Ctrl+C left the cursor after ^C
+    }
+
+    jobRemove(j);
+    lshLastStatus = status;
+    return status;
+}
+
+static void jobSweep(Job *j) //non-blocking check of every live process in a job
+{
+    for(int i = 0; i < j->numProcs; i++)
+    {
+        JobProcess *p = &j->procs[i];
+        int status;
+
+        if(p->done) continue;
+
+        if(waitpid(p->pid, &status, WNOHANG | WUNTRACED | WCONTINUED) == p->pid)
+        {
+            jobRecord(j, p, status);
+        }
+    }
+
+    if(j->state == JOB_STOPPED)
+    {
+        bool anyStopped = false;
+        for(int i = 0; i < j->numProcs; i++) anyStopped |= j->procs[i].stopped;
+        if(!anyStopped) j->state = j->numLive ? JOB_RUNNING : JOB_DONE;
+    }
+}
+
+void jobsReap(bool notify) //collect finished background jobs, called between prompts
+{
+    JobTable *t = &jobTable;
+    struct pollfd fds[JOBS_POLL_MAX];
+    int numFds = 0;
+    bool sweepAll = false;
+
+    if(t->numJobs == 0) return;
+
+    for(int i = 0; i < t->numJobs; i++) //one poll() tells which processes have exited
+    {
+        Job *j = t->jobs[i];
+        for(int k = 0; k < j->numProcs; k++)
+        {
+            if(j->procs[k].done) continue;
+
+            if(j->procs[k].pidfd < 0 || numFds == JOBS_POLL_MAX)
+            {
+                sweepAll = true; //no pidfd for this one, ask waitpid() instead
+                continue;
+            }
+            fds[numFds].fd = j->procs[k].pidfd;
+            fds[numFds].events = POLLIN;
+            fds[numFds].revents = 0;
+            numFds++;
+        }
+    }
+
+    int ready = numFds > 0 ? poll(fds, numFds, 0) : 0;
+
+    for(int i = 0; i < t->numJobs; i++)
+    {
+        Job *j = t->jobs[i];
+
+        if(sweepAll || ready > 0 || j->state == JOB_STOPPED)
+        {
+            jobSweep(j);
+        }
+    }
+
+    for(int i = 0; i < t->numJobs; )
+    {
+        Job *j = t->jobs[i];
+
+        if(j->state == JOB_DONE)
+        {
+            if(notify) jobPrint(j);
+            jobRemove(j);
+            continue;
+        }
+        i++;
+    }
+}
+
+Job *jobFind(const char *spec) //%n, %+, %- or a pid; NULL spec means the current job
+{
+    JobTable *t = &jobTable;
+
+    if(t->numJobs == 0) return NULL;
+
+    if(!spec || strcmp(spec, "%+") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%") == 0)
+    {
+        return t->jobs[t->numJobs - 1];
+    }
+    if(strcmp(spec, "%-") == 0)
+    {
+        return t->numJobs > 1 ? t->jobs[t->numJobs - 2] : NULL;
+    }
+
+    char *end;
+    long n = strtol(spec[0] == '%' ? spec + 1 : spec, &end, 10);
+    if(*end != '\0') return NULL;
+
+    for(int i = 0; i < t->numJobs; i++)
+    {
+        Job *j = t->jobs[i];
+
+        if(spec[0] == '%' && j->id == n) return j;
+
+        for(int k = 0; spec[0] != '%' && k < j->numProcs; k++)
+        {
+            if(j->procs[k].pid == n) return j;
+        }
+    }
+    return NULL;
+}
+
+int jobWaitAny(void) //wait -n: block until any job finishes, returns its status or -1 if there are none
+{
+    JobTable *t = &jobTable;
+
+    while(true)
+    {
+        struct pollfd fds[JOBS_POLL_MAX];
+        int numFds = 0;
+        bool anyLive = false, allPollable = true;
+
+        for(int i = 0; i < t->numJobs; i++)
+        {
+            Job *j = t->jobs[i];
+
+            if(j->state == JOB_DONE) //finished while we weren't looking
+            {
+                int status = jobStatus(j);
+                jobRemove(j);
+                return status;
+            }
+            if(j->state == JOB_STOPPED) continue;
+
+            for(int k = 0; k < j->numProcs; k++)
+            {
+                if(j->procs[k].done) continue;
+                anyLive = true;
+
+                if(j->procs[k].pidfd < 0 || numFds == JOBS_POLL_MAX)
+                {
+                    allPollable = false;
+                    continue;
+                }
+                fds[numFds].fd = j->procs[k].pidfd;
+                fds[numFds].events = POLLIN;
+                numFds++;
+            }
+        }
+
+        if(!anyLive) return -1;
+
+        if(allPollable)
+        {
+            if(poll(fds, numFds, -1) < 0 && errno != EINTR) return -1; //sleep until a process exits
+        }
+        else
+        {
+            int status;
+            pid_t pid = waitpid(-1, &status, 0); //every child of the shell is in the table
+            if(pid < 0) return -1;
+
+            for(int i = 0; i < t->numJobs; i++)
+            {
+                for(int k = 0; k < t->jobs[i]->numProcs; k++)
+                {
+                    if(t->jobs[i]->procs[k].pid == pid) jobRecord(t->jobs[i], &t->jobs[i]->procs[k], status);
+                }
+            }
+            continue;
+        }
+
+        for(int i = 0; i < t->numJobs; i++)
+        {
+            jobSweep(t->jobs[i]);
+        }
+    }
+}
+
+void jobsFree(void)
+{
+    for(int i = 0; i < jobTable.numJobs; i++)
+    {
+        jobFree(jobTable.jobs[i]);
+    }
+    free(jobTable.jobs);
+    memset(&jobTable, 0, sizeof(jobTable));
+}
+
+int lshJobs(char **args)
+{
+    (void) args;
+    jobsReap(false);
+
+    for(int i = 0; i < jobTable.numJobs; i++)
+    {
+        Job *j = jobTable.jobs[i];
+        if(!j->background && j->state == JOB_RUNNING) continue; //the pipeline this jobs is part of
+        jobPrint(j);
+    }
+
+    for(int i = 0; i < jobTable.numJobs; ) //finished jobs are only shown once
+    {
+        if(jobTable.jobs[i]->state == JOB_DONE)
+        {
+            jobRemove(jobTable.jobs[i]);
+            continue;
+        }
+        i++;
+    }
+    return 1;
+}
+
+int lshFg(char **args)
+{
+    Job *j = jobFind(args[1]);
+
+    if(!j)
+    {
+        fprintf(stderr, "fg: %s: no such job\n", args[1] ? args[1] : "current");
+        lshLastStatus = 1;
+        return 1;
+    }
+
+    printf("%s\n", j->command ? j->command : "");
+    jobForeground(j, true);
+    return 1;
+}
+
+int lshBg(char **args)
+{
+    Job *j = jobFind(args[1]);
+
+    if(!j)
+    {
+        fprintf(stderr, "bg: %s: no such job\n", args[1] ? args[1] : "current");
+        lshLastStatus = 1;
+        return 1;
+    }
+
+    for(int i = 0; i < j->numProcs; i++)
+    {
+        j->procs[i].stopped = false;
+        if(j->procs[i].pidfd < 0 && !j->procs[i].done) j->procs[i].pidfd = pidfdOpen(j->procs[i].pid); //it may have started in the foreground
+    }
+    j->background = true;
+    j->state = JOB_RUNNING;
+    jobSignal(j, SIGCONT);
+    printf("[%d] %s &\n", j->id, j->command ? j->command : "");
+    return 1;
+}
+
+int lshWait(char **args)
+{
+    int status = 0;
+
+    if(args[1] && strcmp(args[1], "-n") == 0) //the next job to finish
+    {
+        status = jobWaitAny();
+        lshLastStatus = status < 0 ? 127 : status;
+        return 1;
+    }
+
+    if(args[1] == NULL) //every job that is running
+    {
+        for(int i = 0; i < jobTable.numJobs; )
+        {
+            Job *j = jobTable.jobs[i];
+            if(j->state == JOB_STOPPED)
+            {
+                i++;
+                continue;
+            }
+            jobWait(j);
+            if(j->state == JOB_DONE)
+            {
+                jobRemove(j);
+                continue;
+            }
+            i++; //stopped while we waited
+        }
+        lshLastStatus = 0;
+        return 1;
+    }
+
+    for(int i = 1; args[i]; i++)
+    {
+        Job *j = jobFind(args[i]);
+        if(!j)
+        {
+            fprintf(stderr, "wait: %s: no such job\n", args[i]);
+            status = 127;
+            continue;
+        }
+        status = jobWait(j);
+        if(j->state == JOB_DONE) jobRemove(j);
+    }
+    lshLastStatus = status;
+    return 1;
+}
@@ -0,0 +1,207 @@
+#include "lsh.h"
+
+//Process launching backends. The posix_spawn() backend lets glibc create the
+//child with clone(CLONE_VM|CLONE_VFORK), so the shell's page tables are never
+//copied; the fork() backend is kept so the two can be compared with set -o.
+
+int lshUsePosixSpawn = LSH_USE_POSIX_SPAWN; //which backend lshSpawn uses, toggled with set [-+]o posix_spawn
+
+void launchIOInit(LaunchIO *io)
+{
+    io->numDups = 0;
+    io->closeFds = NULL;
+    io->numClose = 0;
+    io->pgid = -1;
+    io->foreground = false;
+    io->envp = NULL;
+}
+
+static void launchJobControlSignals(sigset_t *set) //signals the shell ignores but its children must not
+{
+    sigemptyset(set);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGQUIT);
+    sigaddset(set, SIGTSTP);
+    sigaddset(set, SIGTTIN);
+    sigaddset(set, SIGTTOU);
+}
+
+void launchIODup(LaunchIO *io, int from, int to) //make the child's fd 'to' a copy of 'from'
+{
+    if(io->numDups < LAUNCH_MAX_DUPS)
+    {
+        io->dupFrom[io->numDups] = from;
+        io->dupTo[io->numDups] = to;
+        io->numDups++;
+    }
+}
+
+static void launchChildSetup(const LaunchIO *io) //fd and job control setup done in a forked child
+{
+    if(!io) return;
+
+    if(io->pgid >= 0)
+    {
+        setpgid(0, io->pgid); //join (or start) the job's process group
+        if(io->foreground)
+        {
+            tcsetpgrp(STDIN_FILENO, getpgrp()); //SIGTTOU is still ignored here
+        }
+
+        sigset_t set;
+        launchJobControlSignals(&set);
+        for(int sig = 1; sig < NSIG; sig++)
+        {
+            if(sigismember(&set, sig) == 1) signal(sig, SIG_DFL);
+        }
+    }
+
+    for(int i = 0; i < io->numDups; i++)
+    {
+        dup2(io->dupFrom[i], io->dupTo[i]); //wire up pipes and redirections
+    }
+    for(int i = 0; i < io->numClose; i++)
+    {
+        close(io->closeFds[i]); //drop fds the child must not hold open
+    }
+}
+
+static pid_t lshSpawnFork(const char *path, char **args, char **envp, const LaunchIO *io)
+{
+    pid_t pid = fork(); //create a new process
+
+    if(pid == 0) //child process
+    {
+        launchChildSetup(io);
+
+        path ? execve(path, args, envp) : execvpe(args[0], args, envp); //only returns on error
+        int err = errno;
+        perror("lsh");
+        _exit(err == ENOENT ? 127 : 126); //the status posix_spawn gives, and no flushing the shell's stdio buffers
+    }
+    else if(pid < 0)
+    {
+        perror("lsh: fork");
+    }
+
+    return pid;
+}
+
+static pid_t lshSpawnPosix(const char *path, char **args, char **envp, const LaunchIO *io)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_t *actionsPtr = NULL;
+    posix_spawnattr_t attr;
+    posix_spawnattr_t *attrPtr = NULL;
+    pid_t pid;
+
+    if(io && io->pgid >= 0) //job control: own process group and default signal handling
+    {
+        sigset_t set;
+
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setpgroup(&attr, io->pgid);
+        launchJobControlSignals(&set);
+        posix_spawnattr_setsigdefault(&attr, &set);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+        attrPtr = &attr;
+    }
+
+    if(io && (io->numDups > 0 || io->numClose > 0 || io->foreground)) //describe the fd setup instead of doing it in a forked child
+    {
+        posix_spawn_file_actions_init(&actions);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+        if(io->foreground) //actions run in order, so this comes before a pipe replaces stdin
+        {
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO); //take the terminal before exec, so the job can read it at once
+        }
+#endif
+        for(int i = 0; i < io->numDups; i++)
+        {
+            posix_spawn_file_actions_adddup2(&actions, io->dupFrom[i], io->dupTo[i]);
+        }
+        for(int i = 0; i < io->numClose; i++)
+        {
+            posix_spawn_file_actions_addclose(&actions, io->closeFds[i]);
+        }
+        actionsPtr = &actions;
+    }
+
+    int err = path ? posix_spawn(&pid, path, actionsPtr, attrPtr, args, envp)
+                   : posix_spawnp(&pid, args[0], actionsPtr, attrPtr, args, envp);
+
+    if(actionsPtr)
+    {
+        posix_spawn_file_actions_destroy(actionsPtr);
+    }
+    if(attrPtr)
+    {
+        posix_spawnattr_destroy(attrPtr);
+    }
+
+    if(err != 0) //glibc reports exec failures back to the parent
+    {
+        fprintf(stderr, "lsh: %s\n", strerror(err));
+        return -1;
+    }
+
+    return pid;
+}
+
+pid_t lshSpawn(char **args, const LaunchIO *io)
+{
+    uint64_t start = timingNow();
+    const char *path = pathCacheLookup(args[0]); //resolve in the parent so the cache outlives the child
+    uint64_t resolved = timingNow();
+    char **envp = io && io->envp ? io->envp : varEnviron(); //kept up to date as variables change, nothing to build here
+    pid_t pid;
+
+    fflush(stdout); //builtin output still buffered in the shell must come out before the child's
+
+    if(lshUsePosixSpawn)
+    {
+        pid = lshSpawnPosix(path, args, envp, io);
+    }
+    else
+    {
+        pid = lshSpawnFork(path, args, envp, io);
+    }
+
+    lshTiming.lookupNs += resolved - start;
+    lshTiming.spawnNs += timingNow() - resolved;
+    return pid;
+}
+
+pid_t launchFork(const LaunchIO *io) //fork() with io applied in the child, returns like fork()
+{
+    fflush(stdout); //or the child would write the shell's buffered output a second time
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        launchChildSetup(io);
+    }
+    else if(pid < 0)
+    {
+        perror("lsh: fork");
+    }
+    return pid;
+}
+
+pid_t lshSpawnBuiltin(int builtin, char **args, const LaunchIO *io) //run a builtin in a forked child, without exec
+{
+    uint64_t start = timingNow();
+    pid_t pid = launchFork(io);
+
+    if(pid == 0)
+    {
+        lshLastStatus = 0;
+        lshBuiltins[builtin].func(args);
+        fflush(stdout);
+        _exit(lshLastStatus); //skip atexit handlers and buffers that belong to the shell
+    }
+
+    lshTiming.spawnNs += timingNow() - start;
+    return pid;
+}
@@ -0,0 +1,597 @@
+#include "lsh.h"
+
+//Interactive line editor. The terminal is put in raw mode only while a line is
+//being read and keys are taken from a read buffer, so a paste arrives in a few
+//reads. The screen is only updated once every key read so far has been handled:
+//the new line is compared with what the terminal already shows, and the cursor
+//moves, the changed tail and the clear are composed into one buffer and sent with
+//a single write(). Typing over a slow link or pasting a long line costs one small
+//write per batch of keys, and nothing that is already on screen is sent again.
+
+static struct termios editSaved; //terminal settings to restore after each line
+static int editTermState; //0 unknown, 1 usable, -1 not a terminal
+static unsigned char editIn[EDIT_READ_SIZE]; //keys read but not handled yet
+static int editInLen, editInPos;
+
+typedef struct { //the line being edited
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t cursor; //byte offset in buf
+} EditLine;
+
+typedef struct { //what the terminal shows after the prompt
+    char *text;
+    size_t len;
+    size_t cap;
+    size_t cursor; //column of the terminal cursor, counted from the start of the prompt's row
+    size_t promptWidth;
+    size_t cols; //terminal width
+} EditView;
+
+typedef struct { //bytes for the terminal, written in one go
+    char *buf;
+    size_t len;
+    size_t cap;
+} EditOut;
+
+enum { //keys that arrive as escape sequences
+    KEY_UP = 1000,
+    KEY_DOWN,
+    KEY_LEFT,
+    KEY_RIGHT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_WORD_LEFT,
+    KEY_WORD_RIGHT,
+    KEY_NONE
+};
+
+static Completion editCompletion; //reused for every TAB
+static EditView editView;
+static EditOut editOut;
+
+static bool editRawOn(void)
+{
+    if(editTermState == 0)
+    {
+        editTermState = tcgetattr(STDIN_FILENO, &editSaved) == 0 ? 1 : -1;
+    }
+    if(editTermState < 0) return false;
+
+    struct termios raw = editSaved;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN); //keys one at a time, ^C and ^Z arrive as bytes
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    return tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == 0;
+}
+
+static void editRawOff(void)
+{
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &editSaved);
+}
+
+static int editGetByte(void) //next byte from the terminal, -1 at end of input
+{
+    if(editInPos == editInLen)
+    {
+        ssize_t n;
+        do
+        {
+            n = read(STDIN_FILENO, editIn, sizeof(editIn));
+        } while(n < 0 && errno == EINTR);
+
+        if(n <= 0) return -1;
+        editInLen = n;
+        editInPos = 0;
+    }
+    return editIn[editInPos++];
+}
+
+static int editGetKey(void) //next key, escape sequences decoded into KEY_* values
+{
+    int key = editGetByte();
+    if(key != 27) return key;
+
+    int next = editGetByte();
+    if(next == 'b') return KEY_WORD_LEFT; //Alt-b and Alt-f
+    if(next == 'f') return KEY_WORD_RIGHT;
+    if(next != '[' && next != 'O') return KEY_NONE;
+
+    char params[16];
+    int numParams = 0;
+    int final;
+
+    while((final = editGetByte()) >= 0 && !(final >= 0x40 && final <= 0x7E)) //parameter bytes up to the final one
+    {
+        if(numParams < (int) sizeof(params) - 1) params[numParams++] = final;
+    }
+    params[numParams] = '\0';
+
+    bool ctrl = strstr(params, ";5") != NULL;
+    switch(final)
+    {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return ctrl ? KEY_WORD_RIGHT : KEY_RIGHT;
+        case 'D': return ctrl ? KEY_WORD_LEFT : KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        case '~':
+            if(strcmp(params, "1") == 0 || strcmp(params, "7") == 0) return KEY_HOME;
+            if(strcmp(params, "4") == 0 || strcmp(params, "8") == 0) return KEY_END;
+            if(strcmp(params, "3") == 0) return KEY_DELETE;
+            return KEY_NONE;
+        default: return KEY_NONE;
+    }
+}
+
+static void editWrite(const char *s, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, s, len);
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return;
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+static void editGrow(char **buf, size_t *cap, size_t need)
+{
+    if(need <= *cap) return;
+
+    size_t capacity = *cap ? *cap : 128;
+    while(capacity < need) capacity *= 2;
+
+    char *grown = realloc(*buf, capacity);
+    if(!grown)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    *buf = grown;
+    *cap = capacity;
+}
+
+static void editEmit(const char *s, size_t len) //queue bytes for the next editFlush()
+{
+    editGrow(&editOut.buf, &editOut.cap, editOut.len + len);
+    memcpy(editOut.buf + editOut.len, s, len);
+    editOut.len += len;
+}
+
+static void editEmitSeq(const char *format, size_t n) //an escape sequence with one number in it
+{
+    char seq[32];
+    editEmit(seq, snprintf(seq, sizeof(seq), format, (int) n));
+}
+
+static void editFlush(void)
+{
+    editWrite(editOut.buf, editOut.len);
+    editOut.len = 0;
+}
+
+static size_t editColumns(const char *s, size_t len) //terminal columns taken by len bytes of UTF-8
+{
+    size_t cols = 0;
+    for(size_t i = 0; i < len; i++)
+    {
+        if(((unsigned char) s[i] & 0xC0) != 0x80) cols++;
+    }
+    return cols;
+}
+
+static void editMoveTo(size_t to) //move the terminal cursor to a column counted from the start of the prompt's row
+{
+    size_t cols = editView.cols, from = editView.cursor;
+    size_t rowFrom = from / cols, rowTo = to / cols;
+    size_t colFrom = from % cols, colTo = to % cols;
+
+    if(rowTo < rowFrom) editEmitSeq("\033[%dA", rowFrom - rowTo);
+    if(rowTo > rowFrom) editEmitSeq("\033[%dB", rowTo - rowFrom);
+    if(colTo == 0 && colFrom != 0) editEmit("\r", 1);
+    else if(colTo > colFrom) editEmitSeq("\033[%dC", colTo - colFrom);
+    else if(colTo < colFrom) editEmitSeq("\033[%dD", colFrom - colTo);
+
+    editView.cursor = to;
+}
+
+static void editViewReset(void) //the prompt was just printed and nothing follows it
+{
+    struct winsize ws;
+
+    editView.cols = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+    editView.promptWidth = prompt.width % editView.cols;
+    editView.cursor = editView.promptWidth;
+    editView.len = 0;
+}
+
+static void editRender(const EditLine *line) //queue what it takes to bring the screen in line with line
+{
+    size_t same = 0; //bytes at the start that are on screen already
+    while(same < line->len && same < editView.len && line->buf[same] == editView.text[same]) same++;
+    while(same > 0 && same < line->len && ((unsigned char) line->buf[same] & 0xC0) == 0x80) same--; //never split a character
+
+    size_t base = editView.promptWidth;
+    size_t end = base + editColumns(line->buf, line->len);
+    size_t oldEnd = base + editColumns(editView.text, editView.len);
+
+    if(same < line->len || same < editView.len)
+    {
+        editMoveTo(base + editColumns(line->buf, same));
+        editEmit(line->buf + same, line->len - same);
+        editView.cursor = end;
+
+        if(end % editView.cols == 0 && line->len > same) //the terminal holds the cursor on the last column: make it wrap
+        {
+            editEmit("\r\n", 2);
+        }
+        if(end < oldEnd) editEmit("\033[J", 3); //the old line was longer
+    }
+    editMoveTo(base + editColumns(line->buf, line->cursor));
+
+    editGrow(&editView.text, &editView.cap, line->len);
+    memcpy(editView.text, line->buf, line->len);
+    editView.len = line->len;
+}
+
+static void editRedrawAll(const EditLine *line) //prompt and line again from the cursor's row, after something was printed
+{
+    editEmit(prompt.buf, prompt.len);
+    editViewReset();
+    editRender(line);
+    editFlush();
+}
+
+static void editSetText(EditLine *line, const char *text, size_t len) //replace the whole line, cursor at its end
+{
+    editGrow(&line->buf, &line->cap, len + 1);
+    memcpy(line->buf, text, len);
+    line->len = line->cursor = len;
+    line->buf[len] = '\0';
+}
+
+static void editInsert(EditLine *line, const char *s, size_t len)
+{
+    editGrow(&line->buf, &line->cap, line->len + len + 1);
+    memmove(line->buf + line->cursor + len, line->buf + line->cursor, line->len - line->cursor);
+    memcpy(line->buf + line->cursor, s, len);
+    line->len += len;
+    line->cursor += len;
+    line->buf[line->len] = '\0';
+}
+
+static void editDelete(EditLine *line, size_t from, size_t to) //remove bytes [from, to), the cursor ends up at from
+{
+    memmove(line->buf + from, line->buf + to, line->len - to);
+    line->len -= to - from;
+    line->cursor = from;
+    line->buf[line->len] = '\0';
+}
+
+static size_t editPrevChar(const EditLine *line, size_t pos) //start of the UTF-8 character before pos
+{
+    if(pos == 0) return 0;
+    do
+    {
+        pos--;
+    } while(pos > 0 && ((unsigned char) line->buf[pos] & 0xC0) == 0x80);
+    return pos;
+}
+
+static size_t editNextChar(const EditLine *line, size_t pos)
+{
+    if(pos >= line->len) return line->len;
+    do
+    {
+        pos++;
+    } while(pos < line->len && ((unsigned char) line->buf[pos] & 0xC0) == 0x80);
+    return pos;
+}
+
+static size_t editWordStart(const EditLine *line, size_t pos) //start of the word before pos, blanks before it skipped
+{
+    while(pos > 0 && line->buf[pos - 1] == ' ') pos--;
+    while(pos > 0 && line->buf[pos - 1] != ' ') pos--;
+    return pos;
+}
+
+static size_t editWordEnd(const EditLine *line, size_t pos)
+{
+    while(pos < line->len && line->buf[pos] == ' ') pos++;
+    while(pos < line->len && line->buf[pos] != ' ') pos++;
+    return pos;
+}
+
+static void editListCandidates(const EditLine *line, const Completion *c)
+{
+    size_t widest = 0;
+    int shown = c->count < COMPLETE_MAX_LIST ? c->count : COMPLETE_MAX_LIST;
+
+    for(int i = 0; i < shown; i++)
+    {
+        size_t len = strlen(c->items[i]);
+        if(len > widest) widest = len;
+    }
+
+    int columns = editView.cols / (widest + 2);
+    if(columns < 1) columns = 1;
+
+    editMoveTo(editView.promptWidth + editColumns(line->buf, line->len)); //below the whole line
+    editEmit("\r\n", 2);
+
+    char cell[PATH_MAX + 16];
+    for(int i = 0; i < shown; i++)
+    {
+        bool endOfRow = (i + 1) % columns == 0 || i + 1 == shown;
+        if(endOfRow) editEmit(cell, snprintf(cell, sizeof(cell), "%s\r\n", c->items[i]));
+        else editEmit(cell, snprintf(cell, sizeof(cell), "%-*s", (int) (widest + 2), c->items[i]));
+    }
+    if(shown < c->count)
+    {
+        editEmit(cell, snprintf(cell, sizeof(cell), "... and %d more\r\n", c->count - shown));
+    }
+
+    editRedrawAll(line); //listing, prompt and line in the same write
+}
+
+static void editComplete(EditLine *line)
+{
+    size_t start = line->cursor;
+    while(start > 0 && line->buf[start - 1] != ' ' && !strchr("|<>&", line->buf[start - 1])) start--;
+
+    size_t before = start; //a command name is completed at the start of a line or after a |
+    while(before > 0 && line->buf[before - 1] == ' ') before--;
+    bool command = before == 0 || line->buf[before - 1] == '|' || line->buf[before - 1] == '&';
+
+    char word[line->cursor - start + 1];
+    memcpy(word, line->buf + start, line->cursor - start);
+    word[line->cursor - start] = '\0';
+
+    completeWord(word, command, &editCompletion);
+    Completion *c = &editCompletion;
+
+    if(c->count == 0)
+    {
+        editEmit("\a", 1);
+        return;
+    }
+
+    size_t typed = strlen(word) - c->replaceFrom; //part of the candidates already on the line
+    size_t common = strlen(c->items[0]);
+    for(int i = 1; i < c->count && common > typed; i++) //longest prefix every candidate shares
+    {
+        size_t k = typed;
+        while(k < common && c->items[i][k] == c->items[0][k]) k++;
+        common = k;
+    }
+
+    if(common > typed)
+    {
+        editInsert(line, c->items[0] + typed, common - typed);
+    }
+
+    if(c->count == 1)
+    {
+        if(c->items[0][common - 1] != '/') editInsert(line, " ", 1); //a finished word, ready for the next
+    }
+    else if(common == typed) //nothing to add: show what the choices are
+    {
+        editListCandidates(line, c);
+    }
+}
+
+static void editHistory(EditLine *line, unsigned long *num, char **saved, bool older) //step through history, the line being typed is kept aside
+{
+    unsigned long n = *num;
+    const char *text = NULL;
+
+    while(true) //entries erased by erasedups are skipped
+    {
+        if(older && n <= hist.total - hist.size + 1) return;
+        if(!older && n > hist.total) return;
+        n = older ? n - 1 : n + 1;
+        if(n == hist.total + 1) break;
+        if((text = historyEntry(&hist, n)) != NULL) break;
+    }
+
+    if(*num == hist.total + 1) //leaving the new line: keep it for coming back
+    {
+        free(*saved);
+        *saved = strndup(line->buf, line->len);
+    }
+
+    *num = n;
+    if(n == hist.total + 1) text = *saved ? *saved : "";
+    editSetText(line, text, strlen(text));
+}
+
+static void editSearchDraw(const char *pattern, const char *match) //the search line in place of prompt and line
+{
+    const char *label = !match && *pattern ? "(failed reverse-i-search)`" : "(reverse-i-search)`";
+    size_t width = strlen(label) + editColumns(pattern, strlen(pattern)) + 3 + (match ? editColumns(match, strlen(match)) : 0);
+
+    editMoveTo(0);
+    editEmit("\033[J", 3);
+    editEmit(label, strlen(label));
+    editEmit(pattern, strlen(pattern));
+    editEmit("': ", 3);
+    if(match) editEmit(match, strlen(match));
+
+    editView.cursor = width;
+    if(width % editView.cols == 0) editEmit("\r\n", 2);
+    editFlush();
+}
+
+static bool editSearch(EditLine *line) //^R: search history as the pattern is typed, true to run the match at once
+{
+    char pattern[256];
+    size_t patLen = 0;
+    unsigned long match = 0;
+    bool run = false;
+
+    pattern[0] = '\0';
+    editSearchDraw(pattern, NULL);
+
+    while(true)
+    {
+        int key = editGetKey();
+        unsigned long found = 0;
+
+        if(key == 18) //^R again: the next older match
+        {
+            found = patLen ? historySearch(&hist, pattern, match ? match : hist.total + 1) : 0;
+            if(found) match = found;
+        }
+        else if(key == 127 || key == 8)
+        {
+            if(patLen > 0) pattern[--patLen] = '\0';
+            match = patLen ? historySearch(&hist, pattern, hist.total + 1) : 0;
+        }
+        else if(key >= 32 && key < 256 && patLen + 1 < sizeof(pattern))
+        {
+            pattern[patLen++] = key;
+            pattern[patLen] = '\0';
+            found = historySearch(&hist, pattern, match ? match + 1 : hist.total + 1); //the current match may still do
+            if(found) match = found;
+        }
+        else if(key == 7 || key == 3 || key < 0) //^G or ^C: back to the line as it was
+        {
+            match = 0;
+            break;
+        }
+        else //Enter runs the match, anything else keeps it for editing
+        {
+            run = key == '\r' || key == '\n';
+            break;
+        }
+
+        if(editInPos < editInLen) continue; //more was typed already: draw once it is all handled
+
+        const char *text = historyEntry(&hist, match);
+        editSearchDraw(pattern, text && strstr(text, pattern) ? text : NULL);
+    }
+
+    const char *text = historyEntry(&hist, match);
+    if(text && strstr(text, pattern))
+    {
+        editSetText(line, text, strlen(text));
+    }
+
+    editMoveTo(0); //the search line goes, prompt and line come back
+    editEmit("\033[J", 3);
+    editRedrawAll(line);
+    return run;
+}
+
+char *lineEditRead(void) //read a line with editing, history and completion, NULL at end of input
+{
+    EditLine line = { NULL, 0, 0, 0 };
+    unsigned long histNum = hist.total + 1; //entry on the line, total + 1 for the new line
+    char *saved = NULL; //the new line while history is shown
+    bool done = false;
+
+    if(!editRawOn())
+    {
+        errno = ENOTTY; //tells lshReadLine to fall back to a plain read
+        return NULL;
+    }
+
+    editSetText(&line, "", 0);
+    editViewReset(); //lshLoop printed the prompt already
+
+    while(!done)
+    {
+        int key = editGetKey();
+
+        if(key < 0 || (key == 4 && line.len == 0)) //^D on an empty line ends the session
+        {
+            editRawOff();
+            free(line.buf);
+            free(saved);
+            return NULL;
+        }
+
+        switch(key)
+        {
+            case '\r': case '\n':
+                line.cursor = line.len;
+                editRender(&line);
+                editEmit("\r\n", 2);
+                done = true;
+                break;
+            case '\t': editComplete(&line); break;
+            case 18: //^R
+                if(editSearch(&line))
+                {
+                    editEmit("\r\n", 2);
+                    done = true;
+                }
+                break;
+            case 1: case KEY_HOME: line.cursor = 0; break; //^A
+            case 5: case KEY_END: line.cursor = line.len; break; //^E
+            case 2: case KEY_LEFT: line.cursor = editPrevChar(&line, line.cursor); break; //^B
+            case 6: case KEY_RIGHT: line.cursor = editNextChar(&line, line.cursor); break; //^F
+            case KEY_WORD_LEFT: line.cursor = editWordStart(&line, line.cursor); break;
+            case KEY_WORD_RIGHT: line.cursor = editWordEnd(&line, line.cursor); break;
+            case 16: case KEY_UP: editHistory(&line, &histNum, &saved, true); break; //^P
+            case 14: case KEY_DOWN: editHistory(&line, &histNum, &saved, false); break; //^N
+            case 127: case 8: //backspace, a whole UTF-8 sequence at a time
+                editDelete(&line, editPrevChar(&line, line.cursor), line.cursor);
+                break;
+            case 4: case KEY_DELETE: //^D on a non-empty line deletes under the cursor
+                editDelete(&line, line.cursor, editNextChar(&line, line.cursor));
+                break;
+            case 23: editDelete(&line, editWordStart(&line, line.cursor), line.cursor); break; //^W
+            case 21: editDelete(&line, 0, line.cursor); break; //^U
+            case 11: editDelete(&line, line.cursor, line.len); break; //^K
+            case 3: //^C drops the line
+                line.cursor = line.len;
+                editRender(&line);
+                editEmit("^C\r\n", 4);
+                editSetText(&line, "", 0);
+                histNum = hist.total + 1;
+                editRedrawAll(&line);
+                break;
+            case 12: //^L
+                editEmit("\033[H\033[2J", 7);
+                editRedrawAll(&line);
+                break;
+            default:
+                if(key >= 32 && key < 256) //printable, and the bytes of UTF-8 sequences
+                {
+                    char c = key;
+                    editInsert(&line, &c, 1);
+                }
+                break;
+        }
+
+        if(!done && editInPos == editInLen) //nothing else typed yet: show the result
+        {
+            editRender(&line);
+        }
+        if(done || editInPos == editInLen) editFlush();
+    }
+
+    editRawOff();
+    free(saved);
+    return line.buf;
+}
+
+void lineEditFree(void)
+{
+    free(editCompletion.items);
+    memset(&editCompletion, 0, sizeof(editCompletion));
+    free(editView.text);
+    free(editOut.buf);
+    memset(&editView, 0, sizeof(editView));
+    memset(&editOut, 0, sizeof(editOut));
+}
@@ -1,67 +1,242 @@
 #include "commands.c"
+#include "pathcache.c"
+#include "launch.c"
+#include "redirect.c"
+#include "scan.c"
+#include "prompt.c"
+#include "input.c"
+#include "histfile.c"
+#include "jobs.c"
+#include "timing.c"
+#include "audit.c"
+#include "copy.c"
+#include "parallel.c"
+#include "complete.c"
+#include "lineedit.c"
+#include "heredoc.c"
+#include "subst.c"
+#include "glob.c"
+#include "vars.c"
+#include "alias.c"
+#include "ast.c"
+#include "fsops.c"
+#include "history.c"
 #include "lsh.h"
 
+#ifndef LSH_NO_MAIN //the benchmarks include this file and bring their own main
 int main(int argc, char **argv)
 {
-    //Print banner
-    lshBanner();
+    varInit(); //shell variables start as a copy of the environment
+    varSetArg0(argc > 1 ? argv[1] : argv[0]);
+    if (argc > 2)
+    {
+        char **params = argv + 2; //lsh script args...: $1...
+        int count = argc - 2;
+        varSwapArgs(&params, &count);
+    }
+
+    //Pick the input: a script argument, or stdin
+    if (argc > 1)
+    {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            fprintf(stderr, "lsh: %s: %s\n", argv[1], strerror(errno));
+            return 127;
+        }
+        lineSourceInit(&lshInput, fd, false);
+    }
+    else
+    {
+        lineSourceInit(&lshInput, STDIN_FILENO, isatty(STDIN_FILENO)); //piped or redirected stdin runs as a script
+    }
+
+    if (lshInput.interactive)
+    {
+        //Print banner
+        lshBanner();
+        //Initialize the prompt and job control
+        promptInit();
+        jobsInitShell();
+    }
     //Initialize history
     historyInit(&hist);
+    if (lshInput.interactive)
+    {
+        char path[PATH_MAX];
+        const char *file = varGet("HISTFILE");
+        const char *home = varGet("HOME");
+
+        if (!file && home && snprintf(path, sizeof(path), "%s/.lsh_history", home) < (int) sizeof(path))
+        {
+            file = path;
+        }
+        if (file && *file)
+        {
+            histFileOpen(&histFile, file); //share history with other sessions
+            histFileLoad(&histFile, &hist);
+        }
+    }
     //Run command loop
     lshLoop();
 
     //Shutdown and Cleanup
     historyFree(&hist);
+    histFileClose(&histFile);
+    jobsFree();
+    pathCacheFree();
+    promptFree();
+    completeFree();
+    lineEditFree();
+    astFreeAll();
+    substFree();
+    globFree();
+    auditClose(); //writes out the records still in the ring
+    varFree();
+    aliasFree();
+    fsFree();
+    lineSourceClose(&lshInput);
     return EXIT_SUCCESS;
 }
+#endif
 
 //functions
 void lshLoop(void)
 {
     //declare variables
     char *line;
-    char **args;
-    int status;
+    char **args = malloc(LSH_TOK_BUFSIZE * sizeof(char*)); //token array reused for every line
+    int capacity = LSH_TOK_BUFSIZE;
+    int status = 1;
+
+    if (!args)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
 
     do
     {
-        printCustomPrompt(); //prompt
+        jobsReap(lshInput.interactive); //collect finished background jobs, one poll() when there are any
+
+        if (lshInput.interactive)
+        {
+            auditFlush(); //the last command's record goes out while the user types
+            printCustomPrompt(); //prompt
+        }
 
-        line = lshReadLine(); //call a function to read a line
-        historyAdd(&hist, line); //add the line to history
-        args = lshSplitLine(line); //split the line into arguments
-        status = lshExecute(args); //execute the arguments
+        line = lshNextLine(&lshInput); //read a line, straight out of the script buffer when not interactive
+        if (!line)
+        {
+            break; //end of input (Ctrl+D or end of script)
+        }
 
-        //free memory
-        free(line);
-        free(args);
+        if (!isComment(line))
+        {
+            if (lshInput.interactive)
+            {
+                historyAdd(&hist, line); //add the line to history
+            }
+            uint64_t parseStart = timingNow();
+            args = lshTokenize(line, &args, &capacity); //split the line into arguments
+            lshTiming.parseNs = timingNow() - parseStart;
+            lshInterrupted = 0;
+            args = aliasExpand(&args, &capacity); //one probe when the command word is no alias
+            bool globbing = lshTokGlob; //substitutions tokenize their own commands and reset it
+            if (astNeeded(args))
+            {
+                status = astRunTokens(args, &lshInput); //lists and compound commands, parsed whole and expanded as they run
+            }
+            else
+            {
+                if (lshTokSubst)
+                {
+                    args = substExpand(&args, &capacity); //run $(...) and `...` and put their output in place
+                }
+                if (globbing)
+                {
+                    args = globExpand(&args, &capacity); //replace *, ? and [...] words with the paths they match
+                }
+                status = lshExecute(args); //execute the arguments
+            }
+        }
+
+        lineSourceRelease(&lshInput); //done with this line's memory
+        substRelease();
+        globRelease();
+        aliasRelease();
     } while(status);
 
+    free(args);
 }
 
 char *lshReadLine(void)
 {
+    if (isatty(STDIN_FILENO))
+    {
+        errno = 0;
+        char *edited = lineEditRead(); //echo and TAB completion done by the shell
+        if (edited || errno != ENOTTY)
+        {
+            return edited;
+        }
+    }
+
     char *line = NULL;
-    ssize_t bufsize = 0; //getline allocated a buffer
+    size_t bufsize = 0; //getline allocated a buffer
+    ssize_t len = getline(&line, &bufsize, stdin); //getline dynamically allocates memory if *line is NULL
 
-    if (getline(&line, &bufsize, stdin) == -1) //getline dynamically allocates memory if *line is NULL
+    if (len == -1)
     {
-        if (feof(stdin)) 
+        free(line);
+        if (!feof(stdin)) 
         {
-            exit(EXIT_SUCCESS);  //recieved an EOF(Ctrl+D)
-        } else  {
             perror("readline");
-            exit(EXIT_FAILURE);
         }
+        return NULL; //recieved an EOF(Ctrl+D)
+    }
+
+    if (len > 0 && line[len - 1] == '\n')
+    {
+        line[len - 1] = '\0'; //callers get the line without its newline
     }
 
     return line;
 
 }
 
-char **lshSplitLine(char *line) 
-{ 
-    int bufferSize = LSH_TOK_BUFSIZE, position = 0; //initial capacity for tokens array and current index
+int isComment(const char *s) //a line whose first non-blank character is '#'
+{
+    while (*s == ' ' || *s == '\t') s++;
+    return *s == '#';
+}
+
+char lshOperatorText[TOK_NUM_KINDS][5] = { "", "|", "<", ">", "&", "<<", "<<<", ";", "&&", "||", "<<", ">>", "2>", "2>&1" }; //indexed by TokenKind
+
+static void lshPushToken(char ***tokens, int *position, int *bufferSize, char *token)
+{
+    if(*position + 1 >= *bufferSize) //keep room for the token and the final NULL
+    {
+        *bufferSize *= 2;
+        char **temp = realloc(*tokens, *bufferSize * sizeof(**tokens));
+
+        if(!temp) //if realloc fails, tokens will still point to the old block
+        {
+            free(*tokens);
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        *tokens = temp;
+    }
+
+    (*tokens)[(*position)++] = token;
+}
+
+char **lshSplitLine(char *line)
+{
+    int bufferSize = LSH_TOK_BUFSIZE; //initial capacity for tokens array
     char **tokens = malloc(bufferSize * sizeof(*tokens)); //each entry will point to a token string
 
     if(!tokens) //if malloc fails, print the error
@@ -70,143 +245,364 @@ char **lshSplitLine(char *line)
         exit(EXIT_FAILURE);
     }
 
-    char *current = malloc(strlen(line) + 1); //temporary buffer to hold one token at a time
-    int curPos = 0; //current position
-    bool inQuote = false;
-    char quoteChar = '\0'; //remembers which type of qoute (' or ")
+    return lshTokenize(line, &tokens, &bufferSize);
+}
+
+static char *lshSubstClose(char *p, char *end) //the ) that closes a $( whose text starts at p, NULL if there is none
+{
+    int depth = 1;
 
-    for(int i = 0; line[i] != '\0'; i++) //iterate through every character in line
+    for(; p < end; p++)
     {
-        char c = line[i];
+        if(*p == '\'' || *p == '"') //parentheses inside quotes do not count
+        {
+            char *close = memchr(p + 1, *p, end - p - 1);
+            if(!close) return NULL;
+            p = close;
+        }
+        else if(*p == '(') depth++;
+        else if(*p == ')' && --depth == 0) return p;
+    }
+    return NULL;
+}
+
+static char *lshTokVarEnd; //just past an unbraced $NAME, where a quote needs a LSH_SUBST_CLOSE to keep what follows out of the name
+
+static char *lshTokenizeVar(char open, char **rp, char *w) //$NAME, ${NAME}, $?, $$, $1 and the like, the $ was read just before *rp
+{
+    //The marker takes the place of the $ and the name follows as typed. An unbraced name
+    //ends at the first byte that cannot be part of one, so it needs no closing byte unless
+    //a quote comes next; ${NAME} always gets one, in the room the braces leave.
+    char *r = *rp;
+    bool braced = *r == '{';
+    char *name = r + braced;
+    size_t len = varRefLen(name);
+
+    if(len == 0 || (braced && name[len] != '}')) //a lone $ is plain text
+    {
+        *w++ = '$';
+        return w;
+    }
+
+    *w++ = open;
+    memmove(w, name, len);
+    w += len;
+    if(braced) *w++ = LSH_SUBST_CLOSE;
+    else lshTokVarEnd = w;
+
+    *rp = name + len + braced;
+    lshTokSubst = true;
+    return w;
+}
+
+static char *lshTokenizeSubst(char c, char open, char **rp, char *end, char *w) //c was read just before *rp, returns the new write position
+{
+    //The command text is kept as is between two marker bytes, each taking the place of
+    //at least one byte of syntax, so w still never gets ahead of the read position.
+    char *r = *rp;
+    char *close = NULL;
+
+    if(c == '$' && *r != '(') //a variable, the line is NUL terminated so looking ahead is safe
+    {
+        return lshTokenizeVar(open == LSH_SUBST_OPEN ? LSH_VAR_OPEN : LSH_VAR_OPEN_QUOTED, rp, w);
+    }
+    if(c == '$')
+    {
+        close = lshSubstClose(++r, end);
+    }
+    else if(c == '`')
+    {
+        close = memchr(r, '`', end - r);
+    }
 
-        if(inQuote)
+    if(!close) //a lone $ or an unterminated substitution is plain text
+    {
+        *w++ = c;
+        return w;
+    }
+
+    size_t len = close - r;
+    *w++ = open;
+    memmove(w, r, len);
+    w += len;
+    *w++ = LSH_SUBST_CLOSE;
+
+    *rp = close + 1;
+    lshTokSubst = true;
+    return w;
+}
+
+char **lshTokenize(char *line, char ***tokensPtr, int *capacity) //split line into *tokensPtr, growing it as needed
+{ 
+    //Tokens are slices of line itself: quotes are squeezed out in place and each token
+    //is NUL terminated where its delimiter was, so nothing is copied or allocated per token.
+    static ScanSet unquoted, dquoted;
+
+    if(unquoted.count == 0)
+    {
+        scanSetInit(&unquoted, " \t\n\"'|<>&;$`*?[");
+        scanSetInit(&dquoted, "\"$`");
+    }
+    lshTokSubst = false;
+    lshTokGlob = false;
+    lshTokVarEnd = NULL;
+
+    int bufferSize = *capacity, position = 0; //capacity of the tokens array and current index
+    char **tokens = *tokensPtr;
+
+    char *end = line + strlen(line);
+    char *r = line; //read position
+    char *w = line; //write position, never ahead of r
+    char *token = NULL; //start of the token being built, NULL between tokens
+
+    while(r < end)
+    {
+        char *stop = (char *) scanFind(r, end, &unquoted); //next delimiter, operator or quote
+        size_t len = stop - r;
+
+        if(len > 0)
+        {
+            if(!token) token = w;
+            if(w != r) memmove(w, r, len); //only needed once a quote has been squeezed out
+            w += len;
+        }
+
+        if(stop == end) break;
+
+        char c = *stop;
+        r = stop + 1;
+
+        if(c == '$' || c == '`')
+        {
+            if(!token) token = w;
+            w = lshTokenizeSubst(c, LSH_SUBST_OPEN, &r, end, w);
+        }
+        else if(c == '*' || c == '?' || c == '[') //a wildcard, marked so globExpand() can tell it from a quoted one
+        {
+            if(!token) token = w;
+            *w++ = c == '*' ? LSH_GLOB_STAR : c == '?' ? LSH_GLOB_QMARK : LSH_GLOB_BRACKET;
+            lshTokGlob = true;
+        }
+        else if(c == '"') //copy up to the matching quote, $( and ` still start substitutions in here
         {
-            if(c == quoteChar) //if in a qoute and 'c' matches (' or ")
+            bool closed = false;
+
+            if(!token) token = w;
+            if(lshTokVarEnd == w) *w++ = LSH_SUBST_CLOSE; //$NAME"..." the quote took a byte, so there is room
+            while(r < end)
             {
-                current[curPos] = '\0'; //null terminate the token
-                tokens[position++] = strdup(current); // makes a copy with strdup
-                curPos = 0;
-                inQuote = false;
+                char *q = (char *) scanFind(r, end, &dquoted);
+                len = q - r;
+                memmove(w, r, len);
+                w += len;
+                r = q;
+
+                if(q == end) break; //an unterminated quote runs to the end of the line
+                r = q + 1;
+                if(*q == '"')
+                {
+                    closed = true;
+                    break;
+                }
+                w = lshTokenizeSubst(*q, LSH_SUBST_OPEN_QUOTED, &r, end, w);
             }
-            else // we keep adding character to current
+
+            if(!closed) break;
+
+            *w++ = '\0'; //a closing quote always ends a token, even an empty one
+            lshPushToken(&tokens, &position, &bufferSize, token);
+            token = NULL;
+        }
+        else if(c == '\'') //copy up to the matching quote
+        {
+            if(lshTokVarEnd == w) *w++ = LSH_SUBST_CLOSE;
+
+            char *close = memchr(r, c, end - r);
+            char *qend = close ? close : end; //an unterminated quote runs to the end of the line
+            len = qend - r;
+
+            if(len > 0)
             {
-                current[curPos++] = c;
+                if(!token) token = w;
+                memmove(w, r, len);
+                w += len;
             }
+
+            if(!close) break;
+
+            if(!token) token = w; //a closing quote always ends a token, even an empty one
+            *w++ = '\0';
+            lshPushToken(&tokens, &position, &bufferSize, token);
+            token = NULL;
+            r = close + 1;
         }
-        else // if not inside a qoute
+        else 
         {
-            if(c == '"' || c == '\'')  //if 'c' is ['] or ["], it is qouted
+            bool errRedir = c == '>' && token && w - token == 1 && token[0] == '2'; //2> and 2>&1 take the 2 with them
+            if(errRedir)
             {
-                inQuote = true;
-                quoteChar = c;
+                w = token;
+                token = NULL;
             }
-            else if (c == ' ' || c == '\t' || c == '\n') // partial token will be finished and stored
+
+            if(token) // partial token will be finished and stored
             {
-                if(curPos > 0)
-                {
-                    current[curPos] = '\0';
-                    tokens[position++] = strdup(current);
-                    curPos = 0;
-                }
+                *w++ = '\0';
+                lshPushToken(&tokens, &position, &bufferSize, token);
+                token = NULL;
             }
-            else if (c == '|' || c == '<' || c == '>') // store operator as its own token
+
+            //store operator as its own token, pointing at lshOperatorText so its kind travels with it
+            if(c == '|' && r[0] == '|') //line is NUL terminated, so looking ahead is safe
             {
-                if(curPos > 0)
-                {
-                    current[curPos] = '\0';
-                    tokens[position++] = strdup(current);
-                    curPos = 0;
-                }
-                tokens[position++] = strndup(&line[i], 1); //duplicate just one character into a new string
+                lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_OR]);
+                r += 1;
             }
-            else
+            else if(c == '|') lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_PIPE]);
+            else if(c == '<' && r[0] == '<' && r[1] == '<')
             {
-                current[curPos++] = c; //append to current if normal character
+                lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_HERESTR]);
+                r += 2;
             }
-        }
-
-        if(position >= bufferSize) //if next position exceeds bufferSize, reallocate
-        {
-            bufferSize *= 2;
-            char **temp = realloc(tokens, bufferSize * sizeof(*tokens)); 
-
-            if(!temp) //if realloc fails, tokens will still point to the old block
+            else if(c == '<' && r[0] == '<')
+            {
+                lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_HEREDOC]);
+                r += 1;
+            }
+            else if(c == '<') lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_IN]);
+            else if(errRedir && r[0] == '&' && r[1] == '1')
             {
-                free(tokens);
-                fprintf(stderr, "lsh: Allocation Error!\n");
-                exit(EXIT_FAILURE);
+                lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_ERROUT]);
+                r += 2;
             }
-            
-            tokens = temp;
-        
+            else if(errRedir) lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_ERR]);
+            else if(c == '>' && r[0] == '>')
+            {
+                lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_APPEND]);
+                r += 1;
+            }
+            else if(c == '>') lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_OUT]);
+            else if(c == '&' && r[0] == '&')
+            {
+                lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_AND]);
+                r += 1;
+            }
+            else if(c == '&') lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_BG]);
+            else if(c == ';') lshPushToken(&tokens, &position, &bufferSize, lshOperatorText[TOK_SEMI]);
         }
-
     }
 
-    if(curPos > 0) // finish building the token
+    if(token) // finish building the token
     {
-        current[curPos] = '\0';
-        tokens[position++] = strdup(current);
+        *w = '\0';
+        lshPushToken(&tokens, &position, &bufferSize, token);
     }
 
     tokens[position] = NULL; //add the final NULL to the array
-    free(current);
+    *tokensPtr = tokens;
+    *capacity = bufferSize;
 
     return tokens; //return the array of tokens
 }
 
-int lshLaunch(char **args, bool background)
+int lshLaunch(char **args, int builtin, bool background, char **envp) //builtin is -1 for an external command, envp NULL for the shell's environment
 {
-    //Fork and launch the process
-    pid_t pid, wpid;
-    int status;
+    //Spawn the process as a new job
+    Job *job = jobCreate(&args, 1, background);
+    AstFunc *fn = builtin < 0 ? astFindFunc(args[0]) : NULL; //a function after &
+    LaunchIO io;
+    pid_t pid;
+
+    launchIOInit(&io);
+    io.envp = envp;
+    if (lshJobControl)
+    {
+        io.pgid = 0; //a process group of its own
+        io.foreground = !background;
+    }
 
-    pid = fork(); //create a new process
+    pid = builtin >= 0 ? lshSpawnBuiltin(builtin, args, &io) : fn ? astSpawnFunc(fn, args, &io) : lshSpawn(args, &io); //create a new process running args
 
-    if (pid == 0)
+    if (pid < 0) //if it returns -1 it means there was an error
     {
-        // Child process
-        if (execvp(args[0], args) == -1)  
-        {
-            perror("lsh");
-        }
-        exit(EXIT_FAILURE); // execvp only returns on error
-    } 
-    else if (pid < 0) //if it returns -1 it means there was an error
+        jobRemove(job); // lshSpawn already reported it
+        lshLastStatus = 127;
+        return 1;
+    }
+
+    jobAddProcess(job, pid);
+
+    if (background)
     {
-        // Error forking
-        perror("lsh");
+        printf("[%d] %d\n", job->id, pid);
+        lshLastStatus = 0;
+        if (auditOn) auditJob(job);
     } 
     else 
     {
-        // Parent process
-        if (background)
-        {
-            printf("[pid %d] running in the background\n", pid);
-        } 
-        else 
-        {
-            do
-            {
-                wpid = waitpid(pid, &status, WUNTRACED); //wait for child process to change state
-            } while (!WIFEXITED(status) && !WIFSIGNALED(status)); //keep waiting if the child hasn't exited or been killed
-        }
+        jobForeground(job, false); //wait for it to exit or stop
     }
 
     return 1; //return 1 to continue the shell loop
 }
 
-int lshExecute(char **args)
+static int lshExecuteArgs(char **args);
+
+int lshExecute(char **args) //run a command, and log it when LSH_AUDIT_LOG is set
+{
+    if (!auditOn || args[0] == NULL)
+    {
+        return lshExecuteArgs(args);
+    }
+
+    auditBegin(args); //copies the words, the command takes them apart
+    int status = lshExecuteArgs(args);
+    auditEnd();
+    return status;
+}
+
+static int lshExecuteArgs(char **args)
 {
     if (args[0] == NULL) 
     {
         return 1; // An empty command was entered.
     }
 
+    if (strcmp(args[0], "time") == 0) //a keyword rather than a builtin, so it can wrap a whole pipeline
+    {
+        return lshTime(args);
+    }
+
+    //Handle background processes for external commands and pipelines
+    bool background = false;
+    int last = 0;
+
+    while(args[last] != NULL) last++; //find the last argument
+
+    if (lshTokKind(args[last-1]) == TOK_BG) //if last argument is '&' it becomes a background process
+    {
+        background = true;
+        args[last-1] = NULL;
+        if (last == 1) return 1;
+    }
+
+    int numAssign = 0;
+    while (args[numAssign] && varIsAssignment(args[numAssign])) numAssign++;
+
+    if (args[numAssign] == NULL) //only NAME=value words: set shell variables
+    {
+        for (int i = 0; i < numAssign; i++)
+        {
+            varAssign(args[i], false);
+        }
+        lshLastStatus = 0;
+        return 1;
+    }
+
     int numPipes = 0; //count number of pipes in args
     for(int i = 0; args[i]; i++)
     {
-        if(strcmp(args[i], "|") == 0) numPipes++; //increment for each pipe found
+        if(lshTokKind(args[i]) == TOK_PIPE) numPipes++; //increment for each pipe found
     }
 
     if(numPipes > 0)
@@ -217,7 +613,7 @@ int lshExecute(char **args)
 
         for(int i = 0; ; i++)//iterate through the args
         {
-            if(args[i] == NULL || strcmp(args[i], "|") == 0) //if end of args or pipe is found
+            if(args[i] == NULL || lshTokKind(args[i]) == TOK_PIPE) //if end of args or pipe is found
             {
                 int len = i - start;
                 cmds[cmdIndex] = malloc((len + 1) * sizeof(char*)); //allocate space for this command
@@ -236,7 +632,7 @@ int lshExecute(char **args)
             }
         }
 
-        int status = lshExecutePiped(cmds, numCmds); //execute the piped commands
+        int status = lshExecutePiped(cmds, numCmds, background); //execute the piped commands
 
         for(int i = 0; i < numCmds; i++) //free each command array
         {
@@ -250,115 +646,65 @@ int lshExecute(char **args)
 
 
 
-    //File descriptors for redirection all are in invalid states and will be changed once they are used
-    int saved_stdin = -1; 
-    int saved_stdout = -1; 
-    int in_fd = -1;
-    int out_fd = -1; 
-    char *inputFile = NULL;
-    char *outputFile = NULL;
+    int here_fd = heredocTake(args); //<<EOF and <<< bodies, read and staged before anything runs
+    Redirs redirs;
 
-    //Scan for redirections and setup file descriptors
-    for (int i = 0; args[i] != NULL; i++) 
+    if (here_fd == -2)
     {
-        
-        if (strcmp(args[i], "<") == 0) //input redirection
-        {
-            if (args[i+1] == NULL) //no file specified after '<'
-            {
-                fprintf(stderr, "lsh: syntax error near unexpected token `<'\n");
-                return 1;
-            }
-
-            inputFile = args[i+1];
-            args[i] = NULL; //Remove redirection operator and filename from args
-            args[i+1] = NULL;
-            i++; //Skip the filename in the next iteration
-        } 
-        else if (strcmp(args[i], ">") == 0) //output redirection
-        {
-            if (args[i+1] == NULL) {
-                fprintf(stderr, "lsh: syntax error near unexpected token `>'\n");
-                return 1;
-            }
-
-            outputFile = args[i+1];
-            args[i] = NULL; //Remove redirection operator and filename from args
-            args[i+1] = NULL;
-            i++; //Skip the filename in the next iteration
-        }
+        return 1;
     }
-
-    //Apply the redirections 
-    if (inputFile) 
+    if (redirTake(args, &redirs) < 0) //<, >, >>, 2> and 2>&1, opened in order
     {
-        in_fd = open(inputFile, O_RDONLY); //Open file for reading
-
-        if (in_fd < 0) //if an error occurs when opening file
-        {
-            perror("lsh: open");
-            return 1;
-        }
-
-        saved_stdin = dup(STDIN_FILENO); //Save original stdin
-        dup2(in_fd, STDIN_FILENO); //Redirect stdin
+        if (here_fd >= 0) close(here_fd);
+        lshLastStatus = 1;
+        return 1;
     }
-    if (outputFile) 
+
+    //Apply the redirections, the shell's own fds are put back once the command is done
+    int saved[3] = { -1, -1, -1 };
+    if (here_fd >= 0)
     {
-        out_fd = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0644); //Open file for writing, create if it doesn't exist, truncate if it does
-        if (out_fd < 0) //if an error occurs when opening file
-        {
-            perror("lsh: open");
-            return 1;
-        }
+        saved[STDIN_FILENO] = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10); //Save original stdin
+        dup2(here_fd, STDIN_FILENO); //Redirect stdin to the staged body, a later < replaces it
+        close(here_fd);
+    }
+    redirApply(&redirs, saved);
+    redirClose(&redirs);
 
-        saved_stdout = dup(STDOUT_FILENO); //Save original stdout
-        dup2(out_fd, STDOUT_FILENO); //Redirect stdout
+    if (args[0] == NULL) //only redirections, the files are created and that is all
+    {
+        redirRestore(saved);
+        lshLastStatus = 0;
+        return 1;
     }
 
     //Execute the command or builtins
+    char **envp = numAssign > 0 ? varTakeAssignments(args) : NULL; //VAR=value cmd: only cmd's environment has them
     int status = 1;
     bool is_builtin = false;
-    for (int i = 0; i < lshNumBuiltIns(); i++) 
-    {
-        if (strcmp(args[0], builtInStr[i]) == 0) //check if the command matches a built-in
-        {
-            status = (*builtInFunction[i])(args); //call the built-in function
-            is_builtin = true;
-            break;
-        }
-    }
+    AstFunc *fn = astFindFunc(args[0]); //a function shadows a builtin or command of the same name
+    int builtin = fn ? -1 : lshFindBuiltin(args[0]); //check if the command matches a built-in
 
-    if (!is_builtin) //not a built-in command
+    if (fn && !background)
     {
-        //Handle background processes for external commands
-        bool background = false;
-        int last = 0;
-
-        while(args[last] != NULL) last++; //find the last argument
-
-        if (last > 0 && strcmp(args[last-1], "&") == 0) //if last argument is '&' it becomes a background process
-        {
-            background = true;
-            args[last-1] = NULL;
-        }
-
-        status = lshLaunch(args, background); //launch the external command
+        status = astCall(fn, args); //VAR=value in front of a function is not passed on
+        is_builtin = true;
     }
-    
-    //Restore stdin and stdout & close files
-    if (saved_stdin != -1) 
+    else if (builtin >= 0 && !((lshBuiltins[builtin].flags & LSH_BI_CHILD) && (lshJobControl || background)))
     {
-        dup2(saved_stdin, STDIN_FILENO);
-        close(saved_stdin);
-        close(in_fd);
+        lshLastStatus = 0; //builtins that fail set it themselves
+        status = lshBuiltins[builtin].func(args); //call the built-in function
+        is_builtin = true;
     }
-    if (saved_stdout != -1) 
+
+    if (!is_builtin) //not a built-in command, or one that runs as a job of its own
     {
-        dup2(saved_stdout, STDOUT_FILENO); 
-        close(saved_stdout);
-        close(out_fd);
+        status = lshLaunch(args, builtin, background, envp); //launch the external command
     }
+    free(envp);
+    
+    //Restore stdin, stdout and stderr
+    redirRestore(saved);
 
     return status;
 }
@@ -366,101 +712,14 @@ int lshExecute(char **args)
 //misc built-ins
 void printCustomPrompt()
 {
-    char cwd[PATH_MAX]; //buffer for current working directory
-    char host[HOST_NAME_MAX]; //buffer for hostname
-    char *home = getenv("HOME"); //store hostname
-    char *user = getenv("USER");//store user
-
-    if(getcwd(cwd, sizeof(cwd)) == NULL) //print error if getcwd fails
-    {
-        perror("getcwd");
-        return;
-    }
-
-    if(gethostname(host, sizeof(host)) != 0) //print error if gethostname fails
-    {
-        perror("gethostname");
-        return;
-    }
-
-    const char *shortPath = cwd; 
-    if (home && strncmp(cwd, home, strlen(home)) == 0) //if cwd starts with "home"
-    {
-        shortPath = cwd + strlen(home); //skip over "home" part
-        printf(COLOR_RED "%s" COLOR_GREEN "@%s" COLOR_YELLOW ":" COLOR_BLUE "%s" COLOR_RESET ">> ", user, host, shortPath); //print prompt with '~' for home directory
-    } else 
-    {
-        printf(COLOR_RED "%s" COLOR_GREEN "@%s" COLOR_YELLOW ":" COLOR_BLUE "%s" COLOR_RESET ">> " , user, host, cwd); //print full path if not in home directory
-    }
-
-}
-
-void historyInit(History *h)
-{
-    h->entries = calloc(HISTORY_CAPACITY, sizeof(char*)); //allocate memory for history entries
-    h->capacity = HISTORY_CAPACITY;
-    h->size = 0;
-    h->start = 0;
-    h->total = 0;
-}
-
-int isAllWhiteSpace(const char *s)
-{
-    while(*s)
-    {
-        if(!isspace((unsigned char) *s)) return 0; //return if a non-whitespace character is found
-        s++;
-    }
-    return 1;
-}
-
-void historyAdd(History *h, const char *line)
-{
-    if(!line || isAllWhiteSpace(line)) //ignore empty or whitespace-only commands
-    {
-        return;
-    }
-
-    char* temp = strdup(line); //duplicate the command string
-    if (!temp) 
-    {
-        fprintf(stderr, "lsh: history allocation error\n");
-        return;
-    }
-
-    if(h->size < h->capacity) //there is still space in history
-    {
-        h->entries[(h->start + h->size) % h->capacity] = temp; //add new entry at the end
-        h->size++; //increase size
-    }
-    else
-    {
-        free(h->entries[h->start]); //free the oldest entry
-        h->entries[h->start] = temp; //replace it with the new entry
-        h->start = (h->start + 1) % h->capacity;//move start to the next oldest entry
-    }
-    h->total++; //increment total commands added
-}
-
-void historyPrint(const History *h)
-{
-    unsigned long firstNum = h->total - h->size + 1; //the number of the first command in history
-
-    for(size_t i = 0; i < h->size; i++) //print each entry in order
+    if(prompt.dirty) //only re-render after cd or a watched variable changed
     {
-        size_t index = (h->start + i) % h->capacity; //calculate the correct index in the circular buffer
-        printf(COLOR_GREEN"%lu" COLOR_YELLOW":" COLOR_RESET"%s\n", firstNum + i, h->entries[index]); //print command number and entry
+        promptRender(&prompt);
     }
-}
 
-void historyFree(History *h)
-{
-    for(size_t i = 0; i < h->size; i++) 
+    fflush(stdout); //anything a builtin printed must come out before the prompt
+    if(write(STDOUT_FILENO, prompt.buf, prompt.len) < 0) //the whole prompt in one syscall
     {
-        free(h->entries[(h->start + i) % h->capacity]); //free each entry
+        perror("lsh: prompt");
     }
-    free(h->entries); //free the entries array
 }
-
-
-
@@ -1,6 +1,10 @@
 #ifndef LSH_H
 #define LSH_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE //for strchrnul() and other GNU extensions
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,45 +17,695 @@
 #include <bits/local_lim.h> //for HOST_NAME_MAX
 #include <fcntl.h> //for file control options
 #include <sys/types.h>//for data types
+#include <spawn.h> //for posix_spawn()
+#include <stdint.h> //for uintptr_t
+#include <errno.h> //for errno
+#include <sys/mman.h> //for mmap()
+#include <sys/uio.h> //for writev()
+#include <sys/syscall.h> //for SYS_pidfd_open
+#include <signal.h> //for kill() and signal()
+#include <poll.h> //for poll()
+#include <sys/sendfile.h> //for sendfile()
+#include <dirent.h> //for opendir()
+#include <termios.h> //for raw mode in the line editor
+#include <sys/ioctl.h> //for the terminal width
+#include <time.h> //for clock_gettime()
+#include <sys/time.h> //for timeradd()
+#include <sys/resource.h> //for struct rusage
+#include <linux/io_uring.h> //for the io_uring ring layout and opcodes
+#include <pthread.h> //for the filesystem thread pool and the audit log writer
 
 //Macros
 #define LSH_RL_BUFSIZE 1024 //1kb of buffer size
+#define LSH_INPUT_BLOCK (256 * 1024) //bytes read at a time from non-interactive stdin
 #define LSH_TOK_BUFSIZE 62 //token size of 64bytes
 #define LSH_TOK_DELIM " \t\r\n\a" //delimiters for tokenizing, passed into strtok to tell which separate tokens
-#define HISTORY_CAPACITY 500 //max number of commands to store in history
+#define HISTORY_CAPACITY 10000 //commands kept in history unless $HISTSIZE says otherwise
+#define HISTORY_MAX (1 << 24) //largest $HISTSIZE honoured
+#define HIST_ARENA_INITIAL (64 * 1024) //first size of the history text arena
+#define HIST_GRAM_BITS 16 //trigrams are hashed into 2^HIST_GRAM_BITS posting lists
+#define HIST_GRAM_BUCKETS (1 << HIST_GRAM_BITS)
+#define HIST_ERASED 1 //history entry flag: a later repeat replaced it (erasedups)
+#define HIST_RECORD_MAGIC 0x4848534cU //"LSHH", starts every record in the history file
+#define HIST_MAX_OWN 64 //own records remembered for history -n to skip
+#define PATH_CACHE_INITIAL 64 //initial number of slots in the command path cache
+#define LSH_SCAN_MAX 16 //max characters in a tokenizer scan set
+#define LSH_COPY_CHUNK (1 << 30) //bytes asked of copy_file_range/splice/sendfile per call
+#define LSH_COPY_BUFSIZE (128 * 1024) //read()/write() fallback buffer
+#define LSH_SCAN_SHORT 64 //ranges shorter than this are scanned without SIMD
+#define PIPE_SIZE_MIN (64 * 1024) //the kernel's default pipe capacity
+#define PIPE_SIZE_DEFAULT_MAX (1024 * 1024) //pipe-max-size when /proc cannot be read
+#define PARALLEL_READ_SIZE (64 * 1024) //bytes read from a job's output pipe at a time
+#define COMPLETE_DIR_CACHE 8 //directory listings kept for path completion
+#define EDIT_READ_SIZE 4096 //bytes of keys read from the terminal at a time, a paste comes in few reads
+#define COMPLETE_MAX_LIST 200 //candidates shown when TAB cannot narrow the word
+#define AST_FUNC_INITIAL 16 //slots in the function table once the first function is defined
+#define AST_CACHE_MAX 16 //sourced scripts kept parsed
+#define HEREDOC_PIPE_MAX (1024 * 1024) //bodies up to this size go through a pipe, larger ones through a memfd
+#define SUBST_READ_SIZE (64 * 1024) //bytes read from a command substitution's pipe at a time
+#define LSH_SUBST_OPEN '\x01' //marks where an unquoted $( or ` was, its command text follows
+#define LSH_SUBST_OPEN_QUOTED '\x03' //the same inside double quotes, where the output is not split
+#define LSH_SUBST_CLOSE '\x02' //end of the command text
+#define LSH_VAR_OPEN '\x07' //marks where an unquoted $NAME or ${NAME} was, the name follows
+#define LSH_VAR_OPEN_QUOTED '\x08' //the same inside double quotes
+#define LSH_SUBST_MARKS "\x01\x03\x07\x08"
+#define LSH_GLOB_STAR '\x04' //an unquoted *, the tokenizer swaps each wildcard for one byte
+#define LSH_GLOB_QMARK '\x05' //an unquoted ?
+#define LSH_GLOB_BRACKET '\x06' //an unquoted [
+#define GLOB_DENTS_SIZE (256 * 1024) //bytes of directory entries read per getdents64() call
+#define JOBS_POLL_MAX 256 //pidfds polled at once when reaping jobs
+#define LAUNCH_MAX_DUPS 16 //max fd redirections applied to one child
+#define REDIR_MAX 8 //<, >, >>, 2> and 2>&1 on one command
+#ifndef LSH_USE_POSIX_SPAWN
+#define LSH_USE_POSIX_SPAWN 1 //default launch backend: 1 for posix_spawn(), 0 for fork()+exec
+#endif
 #define COLOR_RESET "\033[0m" //ANSI escape code to reset color
 #define COLOR_GREEN "\033[1;32m" //ANSI escape code for green text
 #define COLOR_BLUE "\033[1;34m" //ANSI escape code for blue text
 #define COLOR_RED "\033[1;31m" //ANSI escape code for red text
 #define COLOR_YELLOW "\033[1;33m" //ANSI escape code for yellow text
+#define LSH_DEFAULT_PS1 "\\[" COLOR_RED "\\]\\u\\[" COLOR_GREEN "\\]@\\H\\[" COLOR_YELLOW "\\]:\\[" COLOR_BLUE "\\]\\w\\[" COLOR_RESET "\\]>> " //prompt used when $PS1 is unset
+#define PROMPT_CWD 1 //prompt flag: working directory changed
+#define PROMPT_VARS 2 //prompt flag: $HOME, $USER or the host name may have changed
+#define PROMPT_ALL (PROMPT_CWD | PROMPT_VARS)
 
 //Data structures
+typedef enum { //what $HISTCONTROL asks for
+    HIST_KEEPDUPS,
+    HIST_IGNOREDUPS, //skip a command that repeats the previous one
+    HIST_ERASEDUPS //drop the older copy of a repeated command
+} HistDedup;
+
+typedef struct { //one history entry, its text lives in History.text
+    uint32_t off; //offset of the NUL terminated text
+    uint32_t len;
+    uint32_t hash;
+    uint32_t flags; //HIST_ERASED
+} HistEntry;
+
+typedef struct { //numbers of the entries containing one trigram, oldest first
+    uint32_t *nums;
+    uint32_t head; //entries before this are known to be evicted
+    uint32_t len;
+    uint32_t cap;
+} HistPosting;
+
 typedef struct { //way to store History
-    char **entries;
+    HistEntry *entries; //ring of capacity entries
     size_t capacity;
     size_t size;
     size_t start;
-    unsigned long total;
+    unsigned long total; //entries ever added, the number of the newest one
+    char *text; //arena the entry texts are packed into
+    size_t textStart; //bytes before this belong to evicted entries
+    size_t textLen;
+    size_t textCap;
+    uint32_t *dedup; //set of entries by text: ring slot + 1, 0 for an empty slot
+    size_t dedupCap;
+    HistDedup dedupMode;
+    HistPosting *grams; //trigram index, HIST_GRAM_BUCKETS lists, NULL until the first search
 } History;
 
 History hist; //global history variable
 
+typedef struct { //header of one entry in the history file, followed by len bytes of text
+    uint32_t magic;
+    uint32_t len;
+} HistRecord;
+
+typedef struct { //an append-only history file and its offset index
+    int dataFd;
+    int indexFd;
+    uint64_t seen; //data file offset read up to
+    uint64_t own[HIST_MAX_OWN]; //records this session wrote past seen
+    size_t numOwn;
+} HistFile;
+
+extern HistFile histFile;
+
+typedef struct { //one resolved command in the path cache
+    char *name;
+    char *path;
+    unsigned long hits;
+    bool pinned; //set by hash -p, survives $PATH changes
+} PathCacheEntry;
+
+typedef struct { //open addressing hash table from command name to absolute path
+    PathCacheEntry *entries;
+    size_t capacity;
+    size_t size;
+    char *pathValue; //$PATH the entries were resolved against
+} PathCache;
+
+
+#define VAR_TABLE_INITIAL 256 //slots in the variable table, a power of two
+#define VAR_ENV_INITIAL 128 //entries in the exported environment before it grows
+
+typedef struct { //a shell variable
+    char *entry; //"NAME=value", NULL for an empty slot
+    size_t nameLen;
+    int envIndex; //position in the exported environment, -1 when not exported
+} Var;
+
+typedef struct { //every shell variable, and the exported ones as an envp
+    Var *slots;
+    size_t capacity; //a power of two
+    size_t size;
+    char **envp; //NULL terminated, what environ points at
+    int envCount;
+    int envCap;
+} VarTable;
+
+#define ALIAS_TABLE_INITIAL 32 //slots in the alias table, a power of two
+
+typedef struct { //an alias, its value tokenized once
+    char *name; //NULL for an empty slot
+    char *value; //as it was given, for listing
+    char *text; //copy of value the tokens point into
+    char **toks; //value's tokens, NULL terminated
+    char **expansion; //what the name finally expands to, following the chain of first words
+    int expansionLen;
+    unsigned long generation; //table generation expansion was worked out for
+    unsigned long visit; //last chain walk that went through this alias
+    bool subst; //expansion holds substitutions or variables
+    bool glob; //expansion holds wildcards
+} Alias;
+
+typedef struct { //open addressing table of aliases
+    Alias *slots;
+    size_t capacity; //a power of two
+    size_t size;
+    unsigned long generation; //bumped by every alias and unalias, older expansions are stale
+    unsigned long walks; //chain walks so far, for spotting a loop
+} AliasTable;
+
+#define FS_RING_ENTRIES 256 //io_uring submission queue size, also the most operations in flight
+#define FS_POOL_MAX 8 //threads in the fallback pool
+#define FS_DENTS_SIZE (256 * 1024) //bytes of directory entries read per getdents64() call by rm -r
+#define FS_OPEN_MAX 256 //directories rm -r has open at once
+#define FS_BATCH_MAX 4096 //unlinks rm -r queues before running them
+#define FS_PENDING INT_MIN //FsOp result before the operation has run
+
+typedef enum {
+    FS_MKDIR,
+    FS_UNLINK,
+    FS_RMDIR,
+    FS_OPENDIR,
+    FS_OPENSUBDIR //FS_OPENDIR that fails on a symlink, for rm -r
+} FsOpKind;
+
+typedef struct { //one filesystem operation of a batch
+    FsOpKind kind;
+    int dirfd; //name is relative to this, or AT_FDCWD
+    const char *name;
+    mode_t mode;
+    int node; //caller's index, the FsNode it is for in mkdir -p, the FsDir in rm -r
+    int result; //what the system call returned, or -errno
+} FsOp;
+
+typedef struct {
+    FsOp *ops;
+    int count;
+    int capacity;
+} FsOpList;
+
+typedef struct { //a directory in the tree mkdir -p builds from its arguments
+    const char *name; //one path component
+    const char *path; //the argument it came from, for errors
+    int parent;
+    int firstChild; //children are a linked list of siblings
+    int nextSibling;
+    int depth;
+    int fd; //open while its children are being created
+    bool failed;
+} FsNode;
+
+typedef struct { //an io_uring instance, mapped without liburing
+    int fd;
+    void *sq, *cq;
+    size_t sqSize, cqSize, sqesSize;
+    unsigned *sqHead, *sqTail, *sqArray;
+    unsigned *cqHead, *cqTail;
+    unsigned sqMask, cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+} FsRing;
+
+typedef struct { //worker threads for when there is no io_uring
+    pthread_t threads[FS_POOL_MAX];
+    int numThreads;
+    bool started;
+    pthread_mutex_t lock;
+    pthread_cond_t work; //a new batch, generation went up
+    pthread_cond_t done; //every thread finished the batch
+    unsigned long generation;
+    int finished;
+    FsOp *ops; //the current batch
+    int n;
+    int next; //next op to take, shared by the threads
+} FsPool;
+
+typedef struct { //fd setup applied in a child before it execs
+    int dupFrom[LAUNCH_MAX_DUPS];
+    int dupTo[LAUNCH_MAX_DUPS];
+    int numDups;
+    const int *closeFds;
+    int numClose;
+    pid_t pgid; //process group to join, 0 for a new one led by the child, -1 to stay in the shell's
+    bool foreground; //give the child's group the terminal before it execs
+    char **envp; //environment for exec, NULL for the shell's exported variables
+} LaunchIO;
+
+typedef struct { //a command's <, >, >>, 2> and 2>&1, in the order they were written
+    int fd[REDIR_MAX]; //the opened file, -1 for 2>&1
+    int target[REDIR_MAX]; //the fd it replaces
+    int count;
+} Redirs;
+
+typedef enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+typedef struct { //one process of a job
+    pid_t pid;
+    int pidfd; //readable once the process exits, -1 for foreground jobs or old kernels
+    int status; //wait status once done
+    bool done;
+    bool stopped;
+    struct rusage usage; //from wait4() once done in the foreground
+} JobProcess;
+
+typedef struct { //a command or pipeline started by the shell
+    int id;
+    pid_t pgid;
+    JobProcess *procs;
+    int numProcs;
+    int capProcs;
+    int numLive; //processes not yet reaped
+    JobState state;
+    bool background;
+    char *command; //text shown by jobs
+} Job;
+
+typedef struct {
+    Job **jobs; //oldest first, the last one is the current job
+    int numJobs;
+    int capJobs;
+} JobTable;
+
+extern JobTable jobTable;
+extern bool lshJobControl;
+extern pid_t lshShellPgid;
+extern int lshLastStatus;
+
+typedef enum { //pieces a compiled prompt is made of
+    SEG_TEXT,
+    SEG_USER, // \u
+    SEG_HOST, // \h
+    SEG_HOST_FULL, // \H
+    SEG_CWD, // \w
+    SEG_CWD_BASE, // \W
+    SEG_DOLLAR, // \$
+    SEG_NONPRINT_BEGIN, // \[
+    SEG_NONPRINT_END // \]
+} PromptSegKind;
+
+typedef struct {
+    PromptSegKind kind;
+    char *text; //literal text for SEG_TEXT
+    size_t len;
+} PromptSeg;
+
+typedef struct { //compiled prompt format and its last rendering
+    PromptSeg *segs;
+    int numSegs;
+    int capSegs;
+    char *buf; //rendered prompt, written as is
+    size_t len;
+    size_t cap;
+    size_t width; //printing characters in buf
+    unsigned dirty; //PROMPT_* flags that need re-reading before the next render
+    char cwd[PATH_MAX];
+    char host[HOST_NAME_MAX + 1];
+    char *home;
+    char *user;
+} Prompt;
+
+typedef struct { //where command lines are read from
+    int fd;
+    bool interactive; //prompt and read a line at a time
+    bool mapped; //buf is an mmap() of the whole script
+    bool eof;
+    char *buf;
+    size_t len; //bytes of input in buf
+    size_t cap; //size of buf when it is a read buffer
+    size_t pos; //start of the next line
+    size_t scanned; //bytes from pos already searched for a newline
+    bool lent; //a line handed out since the last lineSourceRelease() points into buf
+    unsigned long lineNumber;
+    char **retired; //blocks still referenced by the current command
+    int numRetired;
+    int capRetired;
+} LineSource;
+
+extern LineSource lshInput;
+extern volatile sig_atomic_t lshInterrupted;
+
+typedef enum { //what an AstNode is
+    AST_CMD, //a command line between list operators, run by lshExecute()
+    AST_AND, //a && b
+    AST_OR, //a || b
+    AST_NOT, //! a
+    AST_GROUP, //{ a; }, and a whole sourced script
+    AST_IF, //if a; then b; else c; fi, an elif is another AST_IF in c
+    AST_WHILE, //while a; do b; done
+    AST_UNTIL, //until a; do b; done
+    AST_FOR, //for name in words; do b; done
+    AST_FUNC //name() a, defines the function each time it runs
+} AstKind;
+
+typedef struct AstNode { //a parsed command, built once and run any number of times
+    AstKind kind;
+    int refs; //a function body is held by its definition and by the function table
+    struct AstNode *a, *b, *c; //children, see AstKind
+    struct AstNode *next; //next command of the same list
+    char **words; //AST_CMD tokens or AST_FOR words, NULL terminated; NULL for a for without in
+    char *name; //AST_FOR variable or AST_FUNC name
+    bool subst; //some word holds substitutions or variables, expanded on every run
+    bool glob; //some word holds wildcards
+} AstNode;
+
+typedef struct { //a function defined with name() or function name
+    char *name; //NULL for an empty slot
+    AstNode *body;
+} AstFunc;
+
+typedef struct { //open addressing table of functions
+    AstFunc *slots;
+    size_t capacity; //a power of two
+    size_t size;
+} AstFuncTable;
+
+typedef struct { //a sourced script, parsed once for as long as the file is unchanged
+    char *path; //NULL for an unused entry
+    struct timespec mtime;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    AstNode *tree; //AST_GROUP holding the whole script
+    unsigned long lastUse;
+} AstCacheEntry;
+
+typedef struct { //where the parser takes its tokens from
+    LineSource *src; //more lines for an unfinished command, NULL when there are none
+    char **toks; //tokens of the current line
+    int pos;
+    char **buf; //token array for the lines the parser reads itself
+    int cap;
+    char **spliced; //tokens with an alias expanded, what toks points at after one was
+    bool aliased; //the caller expanded the first command's alias already
+    bool error; //reported already, the whole command is dropped
+} AstParser;
+
+typedef enum { //a jump out of the commands that are running
+    AST_FLOW_NONE,
+    AST_FLOW_BREAK,
+    AST_FLOW_CONTINUE,
+    AST_FLOW_RETURN
+} AstFlow;
+
+typedef struct { //where the shell's time goes, accumulated for the time keyword
+    uint64_t parseNs; //tokenizing the current line
+    uint64_t lookupNs; //resolving commands through the path cache
+    uint64_t spawnNs; //creating processes
+    uint64_t waitNs; //blocked waiting for foreground processes
+    struct timeval childUser; //rusage of every process reaped by jobWait()
+    struct timeval childSys;
+    long childMaxRss; //KiB, largest of those processes
+} LshTiming;
+
+extern LshTiming lshTiming;
+
+#define AUDIT_RING_SIZE (1024 * 1024) //bytes of records waiting for the writer thread
+#define AUDIT_FLUSH_AT (64 * 1024) //the writer starts on a batch this big without waiting for the prompt
+#define AUDIT_CMD_MAX 1024 //bytes of a command's words kept in its record
+#define AUDIT_STAGES_MAX 16 //processes listed in one record
+#define AUDIT_DEPTH_MAX 8 //commands running inside each other that are logged
+#define AUDIT_RECORD_MAX (AUDIT_CMD_MAX * 6 + AUDIT_STAGES_MAX * 160 + 256) //a record with every byte of the command escaped
+
+typedef struct { //one process an audited command started
+    pid_t pid;
+    int status; //wait status
+    bool done; //status and usage are known
+    struct rusage usage;
+} AuditStage;
+
+typedef struct { //a command lshExecute() is running, logged when it returns
+    struct timespec start; //wall clock
+    uint64_t startNs; //monotonic, for the duration
+    AuditStage stages[AUDIT_STAGES_MAX];
+    int numStages;
+    bool background;
+    char cmd[AUDIT_CMD_MAX]; //the command's words, cut at AUDIT_CMD_MAX
+    size_t cmdLen;
+} AuditEvent;
+
+typedef struct { //the log file and the ring its records wait in
+    int fd; //-1 while logging is off
+    char *ring;
+    size_t head; //bytes ever added, the next one goes at head % AUDIT_RING_SIZE
+    size_t tail; //bytes ever written out
+    unsigned long dropped; //records lost to a full ring and not reported yet
+    bool flush; //write what is waiting even below AUDIT_FLUSH_AT
+    bool stop; //write what is waiting and exit
+    pthread_t writer;
+    pthread_mutex_t lock; //head, tail, dropped, flush and stop
+    pthread_cond_t work;
+    AuditEvent events[AUDIT_DEPTH_MAX]; //a function's commands run inside its call
+    int depth;
+} AuditLog;
+
+extern bool auditOn;
+
+typedef struct { //sorted set of names packed into one buffer
+    char *text; //the names, NUL separated
+    size_t textLen;
+    size_t textCap;
+    uint32_t *offsets; //start of each name in text, sorted by name
+    int count;
+    int capacity;
+} NameList;
+
+static inline const char *nameListAt(const NameList *list, int i)
+{
+    return list->text + list->offsets[i];
+}
+
+struct lshDirent64 { //what getdents64() fills its buffer with
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct { //a directory rm -r has open
+    const char *name; //in its parent's subdirs, NULL for the top
+    int fd;
+    NameList subdirs; //emptied and removed once it is read
+} FsDir;
+
+typedef struct { //one rm -r operand being taken apart
+    const char *top; //the operand, for errors
+    char *path; //from top to the directories being read, each with a leading /, for errors only
+    size_t pathLen;
+    size_t pathCap;
+    char *dents; //getdents64() buffer
+    FsOpList batch; //unlinks waiting to run, across the directories being read
+    NameList names; //their names, batch.ops[k] unlinks the k-th
+    int numOpen; //directories open below the top
+    int failures;
+} FsTree;
+
+typedef struct { //a pathname expansion match and the 8 bytes of it being sorted on
+    uint64_t key;
+    char *name;
+} GlobKey;
+
+typedef struct { //every executable on $PATH, for command name completion
+    NameList names;
+    char *path; //$PATH the index was built from
+    struct timespec *mtimes; //of each $PATH directory, a change means a rebuild
+    int numDirs;
+    bool built;
+} CommandIndex;
+
+typedef struct { //cached listing of one directory for path completion
+    char *dir; //NULL for an unused entry
+    struct timespec mtime;
+    NameList names; //subdirectories carry a trailing /
+    unsigned long lastUse;
+} DirListing;
+
+typedef struct { //candidates for the word under the cursor
+    const char **items; //point into a NameList, valid until the next completion
+    int count;
+    int capacity;
+    size_t replaceFrom; //offset in the word where the candidates start
+} Completion;
+
+typedef struct { //one running job of the parallel builtin
+    pid_t pid; //0 when the slot is free
+    int pidfd; //readable once the child exits, -1 without pidfd support
+    int fds[2]; //read ends of the child's stdout and stderr pipes, -1 at EOF
+    char *buf[2]; //captured stdout and stderr, written out when the job is done
+    size_t len[2];
+    size_t cap[2];
+    bool exited;
+    int status;
+} ParallelSlot;
+
+typedef struct { //set of bytes searched for by scanFind()
+    char chars[LSH_SCAN_MAX];
+    int count;
+    unsigned char table[256]; //lookup table for the scalar path
+} ScanSet;
+
+typedef enum { //what a token is, operators are tagged by the tokenizer
+    TOK_WORD,
+    TOK_PIPE, // |
+    TOK_IN, // <
+    TOK_OUT, // >
+    TOK_BG, // &
+    TOK_HEREDOC, // <<
+    TOK_HERESTR, // <<<
+    TOK_SEMI, // ;
+    TOK_AND, // &&
+    TOK_OR, // ||
+    TOK_HEREBODY, // a here-document whose body was read when it was parsed, the body is the next word
+    TOK_APPEND, // >>
+    TOK_ERR, // 2>
+    TOK_ERROUT, // 2>&1
+    TOK_NUM_KINDS
+} TokenKind;
+
+extern char lshOperatorText[TOK_NUM_KINDS][5]; //the shared strings operator tokens point at
+extern bool lshTokSubst; //set by lshTokenize() when a word holds a command substitution or a variable
+extern bool lshTokGlob; //set by lshTokenize() when a word holds an unquoted wildcard
+
+static inline TokenKind lshTokKind(const char *tok) //operator tokens are identified by address, never by comparing text
+{
+    uintptr_t p = (uintptr_t) tok, base = (uintptr_t) lshOperatorText;
+
+    if(p - base < sizeof(lshOperatorText)) //unsigned wrap makes this one comparison
+    {
+        return (TokenKind) ((p - base) / sizeof(lshOperatorText[0]));
+    }
+    return TOK_WORD;
+}
+
+#define LSH_BI_INPROC 1 //builtin flag: safe to run inside the shell as a pipeline stage
+#define LSH_BI_CHILD 2 //builtin flag: run in a forked job when job control is on or it is backgrounded
+
+typedef struct { //a builtin command
+    const char *name;
+    int (*func)(char **);
+    int flags; //LSH_BI_* flags
+} Builtin;
+
+extern const Builtin lshBuiltins[];
+
+typedef struct { //a shell option toggled with set -o / set +o
+    const char *name;
+    int *value;
+} LshOption;
+
+extern char **environ;
+extern int lshUsePosixSpawn;
+extern int lshUseIoUring;
+extern int lshBigPipes;
+
 
 //Function Declarations
 void lshLoop(void);
 char *lshReadLine(void);
 char **lshSplitLine(char *line);
+char **lshTokenize(char *line, char ***tokensPtr, int *capacity);
+int isComment(const char *s);
 int lshExecute(char **args);
-int lshLaunch(char **args, bool background);
+int lshLaunch(char **args, int builtin, bool background, char **envp);
+
+int lshFindBuiltin(const char *name);
 
 //misc built-ins
 void printCustomPrompt();
 void historyInit(History *h);
 int isAllWhiteSpace(const char *s);
 void historyAdd(History *h, const char *line);
+void historyStore(History *h, const char *line, size_t len);
+const char *historyEntry(const History *h, unsigned long num);
+unsigned long historySearch(History *h, const char *pattern, unsigned long before);
 void historyPrint(const History *h);
+void historyPrintMatches(History *h, const char *pattern);
 void historyFree(History *h);
 
+//jobs
+void jobsInitShell(void);
+Job *jobCreate(char ***cmds, int n, bool background);
+void jobAddProcess(Job *j, pid_t pid);
+void jobRemove(Job *j);
+int jobWait(Job *j);
+int jobForeground(Job *j, bool resume);
+void jobsReap(bool notify);
+Job *jobFind(const char *spec);
+int jobWaitAny(void);
+void jobsFree(void);
+
+//history file
+void histFileOpen(HistFile *hf, const char *path);
+void histFileLoad(HistFile *hf, History *h);
+void histFileAppend(HistFile *hf, const char *line);
+void histFileReadNew(HistFile *hf, History *h);
+void histFileClose(HistFile *hf);
+
+//command path cache
+const char *pathCacheLookup(const char *name);
+void pathCacheClear(void);
+void pathCachePin(const char *name, const char *path);
+void pathCachePrint(void);
+void pathCacheFree(void);
+
+//input
+void lineSourceInit(LineSource *src, int fd, bool interactive);
+char *lshNextLine(LineSource *src);
+void lineSourceRelease(LineSource *src);
+void lineSourceClose(LineSource *src);
+
+//prompt
+void promptInit(void);
+void promptCompile(Prompt *p, const char *format);
+void promptInvalidate(unsigned what);
+void promptFree(void);
+
+//tokenizer scanning
+void scanSetInit(ScanSet *set, const char *chars);
+const char *scanFind(const char *p, const char *end, const ScanSet *set);
+
+//process launching
+void launchIOInit(LaunchIO *io);
+void launchIODup(LaunchIO *io, int from, int to);
+pid_t lshSpawn(char **args, const LaunchIO *io);
+pid_t lshSpawnBuiltin(int builtin, char **args, const LaunchIO *io);
+pid_t launchFork(const LaunchIO *io);
+int redirTake(char **args, Redirs *r);
+void redirChild(const Redirs *r, LaunchIO *io);
+void redirApply(const Redirs *r, int saved[3]);
+void redirRestore(int saved[3]);
+void redirClose(Redirs *r);
+
 //commands
 int lshCd(char **args);
 int lshHelp(char **args);
@@ -61,8 +715,96 @@ int lshEcho(char **args);
 int lshClear(char **args);
 int lshHistory(char **args);
 int lshMkdir(char **args);
+int lshRmdir(char **args);
+int lshRm(char **args);
+void fsBatchRun(FsOp *ops, int n);
+void fsFree(void);
+int lshHash(char **args);
+int lshSet(char **args);
+int lshJobs(char **args);
+int lshFg(char **args);
+int lshBg(char **args);
+int lshWait(char **args);
+int lshCat(char **args);
+int lshCp(char **args);
+int lshParallel(char **args);
 void lshBanner(); 
-int lshExecutePiped(char ***cmds, int n);
+int lshExecutePiped(char ***cmds, int n, bool background);
+
+int copyFd(int in, int out);
+char *heredocReadBody(LineSource *src, const char *delim, size_t *lenOut);
+int heredocTake(char **args);
+char **substExpand(char ***tokensPtr, int *capacity);
+int substMark(void);
+void substReleaseTo(int mark);
+void substRelease(void);
+void substFree(void);
+char **globExpand(char ***tokensPtr, int *capacity);
+int globMark(void);
+void globReleaseTo(int mark);
+void globRelease(void);
+void globFree(void);
+
+void varInit(void);
+size_t varNameLen(const char *s);
+size_t varRefLen(const char *s);
+bool varIsAssignment(const char *word);
+const char *varLookup(const char *name, size_t len);
+const char *varGet(const char *name);
+void varSet(const char *name, const char *value, bool export);
+void varAssign(const char *word, bool export);
+void varUnset(const char *name);
+char **varEnviron(void);
+char **varTakeAssignments(char **args);
+void varSetArg0(const char *arg0);
+char **varPositional(int *count);
+void varSwapArgs(char ***args, int *count);
+int lshExport(char **args);
+int lshUnset(char **args);
+void varFree(void);
+
+Alias *aliasFind(const char *word);
+char **aliasExpansion(Alias *a, int *len);
+char **aliasExpand(char ***tokensPtr, int *capacity);
+int lshAlias(char **args);
+int lshUnalias(char **args);
+void aliasRelease(void);
+void aliasFree(void);
+
+bool astNeeded(char **tokens);
+int astRunTokens(char **tokens, LineSource *src);
+AstFunc *astFindFunc(const char *name);
+int astCall(AstFunc *fn, char **args);
+pid_t astSpawnFunc(AstFunc *fn, char **args, const LaunchIO *io);
+int lshTrue(char **args);
+int lshFalse(char **args);
+int lshSource(char **args);
+int lshDot(char **args);
+int lshReturn(char **args);
+int lshBreak(char **args);
+int lshContinue(char **args);
+void astFree(AstNode *n);
+void astFreeAll(void);
+
+void nameListAdd(NameList *list, const char *name, size_t len);
+void nameListSort(NameList *list);
+int nameListFind(const NameList *list, const char *prefix);
+void nameListFree(NameList *list);
+void completeWord(const char *word, bool command, Completion *c);
+void completeFree(void);
+char *lineEditRead(void);
+void lineEditFree(void);
+int pidfdOpen(pid_t pid);
+
+uint64_t timingNow(void);
+void timingAddChild(const struct rusage *ru);
+int lshTime(char **args);
+void auditOpen(const char *path);
+void auditClose(void);
+void auditFlush(void);
+void auditBegin(char **args);
+void auditJob(const Job *j);
+void auditEnd(void);
 
 
 
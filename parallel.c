@@ -0,0 +1,371 @@
+#include "lsh.h"
+
+//parallel [-j N] [-v] command [arg...] [::: input...]
+//Runs command once per input, with the input in place of {} or appended, keeping
+//N children running. Inputs come after ::: or, without it, one per line of stdin,
+//read only as slots free up. A pidfd per child is polled together with its output
+//pipes, so a finished job is replaced as soon as the kernel reports its exit.
+//Each job's stdout and stderr are captured and written out in one piece when it is
+//done, so output from different jobs never interleaves.
+
+static void parallelAppend(ParallelSlot *slot, int which, const char *data, size_t len)
+{
+    if(slot->len[which] + len > slot->cap[which])
+    {
+        size_t capacity = slot->cap[which] ? slot->cap[which] : PARALLEL_READ_SIZE;
+        while(capacity < slot->len[which] + len) capacity *= 2;
+
+        char *grown = realloc(slot->buf[which], capacity);
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        slot->buf[which] = grown;
+        slot->cap[which] = capacity;
+    }
+
+    memcpy(slot->buf[which] + slot->len[which], data, len);
+    slot->len[which] += len;
+}
+
+static void parallelWriteAll(int fd, const char *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return; //reader went away, the output is dropped
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static char *parallelNextInput(char **inputs, int *next, char **line, size_t *lineCap) //next input, or NULL when there are no more
+{
+    if(inputs)
+    {
+        return inputs[*next] ? inputs[(*next)++] : NULL;
+    }
+
+    ssize_t len;
+    while((len = getline(line, lineCap, stdin)) != -1) //one input per line, read lazily
+    {
+        if(len > 0 && (*line)[len - 1] == '\n') (*line)[--len] = '\0';
+        if(len > 0) return *line;
+    }
+    return NULL;
+}
+
+static char *parallelSubstitute(const char *word, const char *input) //word with every {} replaced by input
+{
+    size_t inputLen = strlen(input), len = 0;
+    const char *p;
+
+    for(p = word; *p; p++)
+    {
+        len += (p[0] == '{' && p[1] == '}') ? (p++, inputLen) : 1;
+    }
+
+    char *out = malloc(len + 1), *w = out;
+    if(!out)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(p = word; *p; p++)
+    {
+        if(p[0] == '{' && p[1] == '}')
+        {
+            memcpy(w, input, inputLen);
+            w += inputLen;
+            p++;
+        }
+        else
+        {
+            *w++ = *p;
+        }
+    }
+    *w = '\0';
+    return out;
+}
+
+static bool parallelSpawn(ParallelSlot *slot, char **argv) //start argv with its stdout and stderr captured
+{
+    int pipes[2][2];
+
+    if(pipe2(pipes[0], O_CLOEXEC) < 0)
+    {
+        perror("lsh: parallel");
+        return false;
+    }
+    if(pipe2(pipes[1], O_CLOEXEC) < 0)
+    {
+        perror("lsh: parallel");
+        close(pipes[0][0]);
+        close(pipes[0][1]);
+        return false;
+    }
+
+    LaunchIO io;
+    launchIOInit(&io);
+    launchIODup(&io, pipes[0][1], STDOUT_FILENO); //dup2 clears close-on-exec on the copy only
+    launchIODup(&io, pipes[1][1], STDERR_FILENO);
+
+    pid_t pid = lshSpawn(argv, &io);
+
+    close(pipes[0][1]);
+    close(pipes[1][1]);
+
+    if(pid <= 0)
+    {
+        close(pipes[0][0]);
+        close(pipes[1][0]);
+        return false;
+    }
+
+    slot->pid = pid;
+    slot->pidfd = pidfdOpen(pid);
+    slot->fds[0] = pipes[0][0];
+    slot->fds[1] = pipes[1][0];
+    slot->len[0] = slot->len[1] = 0;
+    slot->exited = false;
+    slot->status = 0;
+    return true;
+}
+
+static bool parallelStart(ParallelSlot *slot, char **command, int commandLen, char *input)
+{
+    char *argv[commandLen + 2];
+    bool substituted[commandLen];
+    bool any = false;
+
+    for(int i = 0; i < commandLen; i++)
+    {
+        substituted[i] = strstr(command[i], "{}") != NULL;
+        argv[i] = substituted[i] ? parallelSubstitute(command[i], input) : command[i];
+        any |= substituted[i];
+    }
+    argv[commandLen] = any ? NULL : input; //no {} anywhere: the input is the last argument
+    argv[commandLen + 1] = NULL;
+
+    bool ok = parallelSpawn(slot, argv);
+
+    for(int i = 0; i < commandLen; i++) //the child has its own copy by now
+    {
+        if(substituted[i]) free(argv[i]);
+    }
+    return ok;
+}
+
+static void parallelCollect(ParallelSlot *slot, bool block) //reap the slot's child
+{
+    int status;
+    pid_t r;
+
+    do
+    {
+        r = waitpid(slot->pid, &status, block ? 0 : WNOHANG);
+    } while(r < 0 && errno == EINTR);
+
+    if(r == slot->pid)
+    {
+        slot->exited = true;
+        slot->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    else if(r < 0) //nothing to wait for, treat it as gone
+    {
+        slot->exited = true;
+        slot->status = 127;
+    }
+}
+
+int lshParallel(char **args)
+{
+    long numSlots = sysconf(_SC_NPROCESSORS_ONLN);
+    bool verbose = false;
+    int i = 1;
+
+    for(; args[i] && args[i][0] == '-'; i++)
+    {
+        if(strcmp(args[i], "-v") == 0)
+        {
+            verbose = true;
+        }
+        else if(strncmp(args[i], "-j", 2) == 0)
+        {
+            const char *count = args[i][2] ? args[i] + 2 : args[++i];
+            numSlots = count ? strtol(count, NULL, 10) : 0;
+            if(numSlots <= 0)
+            {
+                fprintf(stderr, "parallel: -j needs a positive number\n");
+                lshLastStatus = 2;
+                return 1;
+            }
+        }
+        else
+        {
+            break; //a command that starts with -
+        }
+    }
+
+    char **command = args + i;
+    int commandLen = 0;
+    char **inputs = NULL;
+
+    while(command[commandLen] && strcmp(command[commandLen], ":::") != 0) commandLen++;
+    if(command[commandLen])
+    {
+        inputs = command + commandLen + 1;
+    }
+
+    if(commandLen == 0)
+    {
+        fprintf(stderr, "parallel: usage: parallel [-j N] [-v] command [arg...] [::: input...]\n");
+        lshLastStatus = 2;
+        return 1;
+    }
+    if(numSlots < 1) numSlots = 1;
+
+    ParallelSlot *slots = calloc(numSlots, sizeof(ParallelSlot));
+    struct pollfd *pfds = malloc(numSlots * 3 * sizeof(struct pollfd));
+    int *pfdSlot = malloc(numSlots * 3 * sizeof(int)); //slot each pollfd belongs to
+    if(!slots || !pfds || !pfdSlot)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *line = NULL;
+    size_t lineCap = 0;
+    int nextInput = 0;
+    bool more = true;
+    long active = 0, started = 0, failed = 0;
+    uint64_t startTime = timingNow();
+    char chunk[PARALLEL_READ_SIZE];
+
+    fflush(stdout);
+
+    while(true)
+    {
+        for(long s = 0; s < numSlots && more; s++) //keep every slot busy
+        {
+            if(slots[s].pid != 0) continue;
+
+            char *input = parallelNextInput(inputs, &nextInput, &line, &lineCap);
+            if(!input)
+            {
+                more = false;
+                break;
+            }
+
+            started++;
+            if(parallelStart(&slots[s], command, commandLen, input))
+            {
+                active++;
+            }
+            else
+            {
+                failed++;
+                s--; //try the next input in the same slot
+            }
+        }
+
+        if(active == 0) break;
+
+        int numPfds = 0;
+        for(long s = 0; s < numSlots; s++)
+        {
+            ParallelSlot *slot = &slots[s];
+            if(slot->pid == 0) continue;
+
+            if(slot->pidfd >= 0 && !slot->exited)
+            {
+                pfds[numPfds] = (struct pollfd) { .fd = slot->pidfd, .events = POLLIN };
+                pfdSlot[numPfds++] = s;
+            }
+            for(int w = 0; w < 2; w++)
+            {
+                if(slot->fds[w] >= 0)
+                {
+                    pfds[numPfds] = (struct pollfd) { .fd = slot->fds[w], .events = POLLIN };
+                    pfdSlot[numPfds++] = s;
+                }
+            }
+        }
+
+        if(numPfds > 0 && poll(pfds, numPfds, -1) < 0 && errno != EINTR)
+        {
+            perror("lsh: parallel");
+            break;
+        }
+
+        for(int p = 0; p < numPfds; p++)
+        {
+            ParallelSlot *slot = &slots[pfdSlot[p]];
+            if(!pfds[p].revents) continue;
+
+            if(pfds[p].fd == slot->pidfd)
+            {
+                parallelCollect(slot, false);
+                continue;
+            }
+
+            int w = pfds[p].fd == slot->fds[0] ? 0 : 1;
+            ssize_t n = read(slot->fds[w], chunk, sizeof(chunk));
+            if(n > 0)
+            {
+                parallelAppend(slot, w, chunk, n);
+            }
+            else if(n == 0 || errno != EINTR)
+            {
+                close(slot->fds[w]);
+                slot->fds[w] = -1;
+            }
+        }
+
+        for(long s = 0; s < numSlots; s++) //finished jobs: output out in one piece, slot freed
+        {
+            ParallelSlot *slot = &slots[s];
+            if(slot->pid == 0 || slot->fds[0] >= 0 || slot->fds[1] >= 0) continue;
+
+            if(!slot->exited)
+            {
+                if(slot->pidfd >= 0) continue; //output closed early, the pidfd says when it exits
+                parallelCollect(slot, true);
+            }
+
+            parallelWriteAll(STDOUT_FILENO, slot->buf[0], slot->len[0]);
+            parallelWriteAll(STDERR_FILENO, slot->buf[1], slot->len[1]);
+
+            if(slot->status != 0) failed++;
+            if(slot->pidfd >= 0) close(slot->pidfd);
+            slot->pid = 0;
+            active--;
+        }
+    }
+
+    double seconds = (timingNow() - startTime) / 1e9;
+    if(verbose)
+    {
+        fprintf(stderr, "parallel: %ld jobs, %ld failed, %ld slots, %.3fs, %.1f jobs/s\n",
+                started, failed, numSlots, seconds, seconds > 0 ? started / seconds : 0.0);
+    }
+
+    for(long s = 0; s < numSlots; s++)
+    {
+        free(slots[s].buf[0]);
+        free(slots[s].buf[1]);
+    }
+    free(slots);
+    free(pfds);
+    free(pfdSlot);
+    free(line);
+
+    lshLastStatus = failed > 100 ? 101 : failed; //like GNU parallel: the number of failed jobs
+    return 1;
+}
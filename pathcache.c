@@ -0,0 +1,234 @@
+#include "lsh.h"
+
+//Resolved command path cache, filled on first use so children can execv() the
+//absolute path instead of having execvp() walk every $PATH directory again.
+
+PathCache pathCache; //global command path cache
+
+static unsigned long pathCacheHash(const char *s) //FNV-1a string hash
+{
+    unsigned long h = 1469598103934665603UL;
+
+    while(*s)
+    {
+        h ^= (unsigned char) *s++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static PathCacheEntry *pathCacheSlot(PathCache *c, const char *name) //find the slot holding name, or the empty slot where it belongs
+{
+    size_t mask = c->capacity - 1;
+    size_t i = pathCacheHash(name) & mask;
+
+    while(c->entries[i].name && strcmp(c->entries[i].name, name) != 0) //linear probing
+    {
+        i = (i + 1) & mask;
+    }
+    return &c->entries[i];
+}
+
+static void pathCacheGrow(PathCache *c)
+{
+    PathCache bigger = *c;
+    bigger.capacity = c->capacity ? c->capacity * 2 : PATH_CACHE_INITIAL;
+    bigger.entries = calloc(bigger.capacity, sizeof(PathCacheEntry));
+    bigger.size = 0;
+
+    if(!bigger.entries)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < c->capacity; i++) //rehash every live entry into the new table
+    {
+        if(c->entries[i].name)
+        {
+            *pathCacheSlot(&bigger, c->entries[i].name) = c->entries[i];
+            bigger.size++;
+        }
+    }
+
+    free(c->entries);
+    *c = bigger;
+}
+
+static PathCacheEntry *pathCacheInsert(PathCache *c, const char *name, const char *path, bool pinned)
+{
+    if((c->size + 1) * 4 > c->capacity * 3) //keep the load factor under 3/4
+    {
+        pathCacheGrow(c);
+    }
+
+    PathCacheEntry *e = pathCacheSlot(c, name);
+
+    if(e->name) //replacing an existing entry
+    {
+        free(e->path);
+    }
+    else
+    {
+        e->name = strdup(name);
+        e->hits = 0;
+        c->size++;
+    }
+    e->path = strdup(path);
+    e->pinned = pinned;
+
+    return e;
+}
+
+static void pathCacheRemoveAll(PathCache *c, bool keepPinned) //clear the table, optionally keeping entries pinned with hash -p
+{
+    PathCacheEntry *old = c->entries;
+    size_t oldCapacity = c->capacity;
+
+    c->entries = calloc(oldCapacity ? oldCapacity : PATH_CACHE_INITIAL, sizeof(PathCacheEntry));
+    c->capacity = oldCapacity ? oldCapacity : PATH_CACHE_INITIAL;
+    c->size = 0;
+
+    for(size_t i = 0; i < oldCapacity; i++)
+    {
+        if(!old[i].name) continue;
+
+        if(keepPinned && old[i].pinned)
+        {
+            *pathCacheSlot(c, old[i].name) = old[i]; //move the entry over as is
+            c->size++;
+        }
+        else
+        {
+            free(old[i].name);
+            free(old[i].path);
+        }
+    }
+    free(old);
+}
+
+static void pathCacheCheckPath(PathCache *c) //drop PATH-derived entries if $PATH changed since they were resolved
+{
+    const char *path = varGet("PATH");
+
+    if(path == c->pathValue || (path && c->pathValue && strcmp(path, c->pathValue) == 0))
+    {
+        return;
+    }
+
+    pathCacheRemoveAll(c, true);
+    free(c->pathValue);
+    c->pathValue = path ? strdup(path) : NULL;
+}
+
+static bool pathIsExecutable(const char *file)
+{
+    struct stat st;
+    return stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0;
+}
+
+static bool pathSearch(const char *name, char *out, size_t outSize) //walk $PATH once, the way execvp() would
+{
+    const char *path = varGet("PATH");
+    size_t nameLen = strlen(name);
+
+    if(!path) path = "/usr/local/bin:/usr/bin:/bin"; //same fallback as execvp()
+
+    while(true)
+    {
+        const char *end = strchrnul(path, ':');
+        size_t dirLen = end - path;
+
+        if(dirLen == 0) //an empty entry means the current directory
+        {
+            if(nameLen + 3 <= outSize)
+            {
+                snprintf(out, outSize, "./%s", name);
+                if(pathIsExecutable(out)) return true;
+            }
+        }
+        else if(dirLen + nameLen + 2 <= outSize)
+        {
+            memcpy(out, path, dirLen);
+            out[dirLen] = '/';
+            memcpy(out + dirLen + 1, name, nameLen + 1);
+            if(pathIsExecutable(out)) return true;
+        }
+
+        if(*end == '\0') break;
+        path = end + 1;
+    }
+
+    return false;
+}
+
+const char *pathCacheLookup(const char *name)
+{
+    if(!name || name[0] == '\0' || strchr(name, '/')) //explicit paths are never searched
+    {
+        return NULL;
+    }
+
+    PathCache *c = &pathCache;
+    pathCacheCheckPath(c);
+
+    if(c->capacity)
+    {
+        PathCacheEntry *e = pathCacheSlot(c, name);
+        if(e->name)
+        {
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    char resolved[PATH_MAX];
+    if(!pathSearch(name, resolved, sizeof(resolved))) //not found, leave it to exec to report the error
+    {
+        return NULL;
+    }
+
+    PathCacheEntry *e = pathCacheInsert(c, name, resolved, false);
+    e->hits++;
+    return e->path;
+}
+
+void pathCacheClear(void)
+{
+    pathCacheRemoveAll(&pathCache, false);
+}
+
+void pathCachePin(const char *name, const char *path)
+{
+    pathCacheCheckPath(&pathCache);
+    pathCacheInsert(&pathCache, name, path, true);
+}
+
+void pathCacheFree(void)
+{
+    pathCacheRemoveAll(&pathCache, false);
+    free(pathCache.entries);
+    free(pathCache.pathValue);
+    memset(&pathCache, 0, sizeof(pathCache));
+}
+
+void pathCachePrint(void)
+{
+    PathCache *c = &pathCache;
+    pathCacheCheckPath(c);
+
+    if(c->size == 0)
+    {
+        printf("hash: hash table empty\n");
+        return;
+    }
+
+    printf("hits\tcommand\n");
+    for(size_t i = 0; i < c->capacity; i++)
+    {
+        if(c->entries[i].name)
+        {
+            printf("%4lu%s\t%s\n", c->entries[i].hits, c->entries[i].pinned ? "*" : "", c->entries[i].path);
+        }
+    }
+}
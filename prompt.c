@@ -0,0 +1,213 @@
+#include "lsh.h"
+
+//Pre-rendered prompt. The format string is compiled once into segments and the
+//rendered text is kept until the directory or a watched variable changes, so an
+//ordinary command costs one write() for its prompt and no getcwd().
+
+Prompt prompt; //global prompt state
+
+static void promptAddSegment(Prompt *p, PromptSegKind kind, const char *text, size_t len)
+{
+    if(kind == SEG_TEXT && p->numSegs > 0 && p->segs[p->numSegs - 1].kind == SEG_TEXT) //merge runs of literal text
+    {
+        PromptSeg *last = &p->segs[p->numSegs - 1];
+        char *grown = realloc(last->text, last->len + len + 1);
+        if(!grown) return;
+
+        memcpy(grown + last->len, text, len);
+        last->len += len;
+        grown[last->len] = '\0';
+        last->text = grown;
+        return;
+    }
+
+    if(p->numSegs == p->capSegs)
+    {
+        int capacity = p->capSegs ? p->capSegs * 2 : 16;
+        PromptSeg *grown = realloc(p->segs, capacity * sizeof(PromptSeg));
+        if(!grown) return;
+
+        p->segs = grown;
+        p->capSegs = capacity;
+    }
+
+    PromptSeg *seg = &p->segs[p->numSegs++];
+    seg->kind = kind;
+    seg->text = kind == SEG_TEXT ? strndup(text, len) : NULL;
+    seg->len = len;
+}
+
+void promptCompile(Prompt *p, const char *format) //turn a PS1 style format into segments
+{
+    for(int i = 0; i < p->numSegs; i++)
+    {
+        free(p->segs[i].text);
+    }
+    p->numSegs = 0;
+
+    for(const char *f = format; *f; f++)
+    {
+        if(*f != '\\' || f[1] == '\0')
+        {
+            const char *run = f;
+            while(f[1] && f[1] != '\\') f++; //take the whole literal run at once
+            promptAddSegment(p, SEG_TEXT, run, f - run + 1);
+            continue;
+        }
+
+        switch(*++f)
+        {
+            case 'u': promptAddSegment(p, SEG_USER, NULL, 0); break; //user name
+            case 'h': promptAddSegment(p, SEG_HOST, NULL, 0); break; //host name up to the first '.'
+            case 'H': promptAddSegment(p, SEG_HOST_FULL, NULL, 0); break; //full host name
+            case 'w': promptAddSegment(p, SEG_CWD, NULL, 0); break; //working directory, $HOME shown as ~
+            case 'W': promptAddSegment(p, SEG_CWD_BASE, NULL, 0); break; //last component of the working directory
+            case '$': promptAddSegment(p, SEG_DOLLAR, NULL, 0); break; //# for root, $ otherwise
+            case '[': promptAddSegment(p, SEG_NONPRINT_BEGIN, NULL, 0); break; //start of escape codes that take no space
+            case ']': promptAddSegment(p, SEG_NONPRINT_END, NULL, 0); break;
+            case 'e': promptAddSegment(p, SEG_TEXT, "\033", 1); break;
+            case 'a': promptAddSegment(p, SEG_TEXT, "\a", 1); break;
+            case 'n': promptAddSegment(p, SEG_TEXT, "\n", 1); break;
+            case '\\': promptAddSegment(p, SEG_TEXT, "\\", 1); break;
+            default: promptAddSegment(p, SEG_TEXT, f - 1, 2); break; //unknown escapes are printed as written
+        }
+    }
+
+    p->dirty |= PROMPT_ALL;
+}
+
+static void promptAppend(Prompt *p, const char *s, size_t len, bool printing)
+{
+    if(p->len + len + 1 > p->cap)
+    {
+        size_t capacity = p->cap ? p->cap : 256;
+        while(capacity < p->len + len + 1) capacity *= 2;
+
+        char *grown = realloc(p->buf, capacity);
+        if(!grown) return;
+
+        p->buf = grown;
+        p->cap = capacity;
+    }
+
+    memcpy(p->buf + p->len, s, len);
+    p->len += len;
+    p->buf[p->len] = '\0';
+
+    if(printing) p->width += len;
+}
+
+static void promptRefresh(Prompt *p) //re-read whatever was invalidated
+{
+    if(p->dirty & PROMPT_CWD)
+    {
+        if(getcwd(p->cwd, sizeof(p->cwd)) == NULL) //the directory may have been removed under us
+        {
+            strcpy(p->cwd, "?");
+        }
+    }
+
+    if(p->dirty & PROMPT_VARS)
+    {
+        const char *home = varGet("HOME");
+        const char *user = varGet("USER");
+
+        free(p->home);
+        free(p->user);
+        p->home = home ? strdup(home) : NULL;
+        p->user = strdup(user ? user : "");
+
+        if(gethostname(p->host, sizeof(p->host)) != 0)
+        {
+            strcpy(p->host, "?");
+        }
+        p->host[sizeof(p->host) - 1] = '\0';
+    }
+}
+
+static void promptRender(Prompt *p)
+{
+    bool printing = true;
+
+    promptRefresh(p);
+    p->len = 0;
+    p->width = 0;
+
+    for(int i = 0; i < p->numSegs; i++)
+    {
+        PromptSeg *seg = &p->segs[i];
+
+        switch(seg->kind)
+        {
+            case SEG_TEXT:
+                promptAppend(p, seg->text, seg->len, printing);
+                break;
+            case SEG_USER:
+                promptAppend(p, p->user, strlen(p->user), printing);
+                break;
+            case SEG_HOST:
+                promptAppend(p, p->host, strcspn(p->host, "."), printing);
+                break;
+            case SEG_HOST_FULL:
+                promptAppend(p, p->host, strlen(p->host), printing);
+                break;
+            case SEG_CWD:
+            {
+                size_t homeLen = p->home ? strlen(p->home) : 0;
+
+                if(homeLen > 1 && strncmp(p->cwd, p->home, homeLen) == 0 && (p->cwd[homeLen] == '/' || p->cwd[homeLen] == '\0')) //if cwd starts with "home"
+                {
+                    promptAppend(p, "~", 1, printing);
+                    promptAppend(p, p->cwd + homeLen, strlen(p->cwd + homeLen), printing); //skip over "home" part
+                }
+                else
+                {
+                    promptAppend(p, p->cwd, strlen(p->cwd), printing);
+                }
+                break;
+            }
+            case SEG_CWD_BASE:
+            {
+                const char *base = strrchr(p->cwd, '/');
+                base = (base && base[1]) ? base + 1 : p->cwd;
+                promptAppend(p, base, strlen(base), printing);
+                break;
+            }
+            case SEG_DOLLAR:
+                promptAppend(p, geteuid() == 0 ? "#" : "$", 1, printing);
+                break;
+            case SEG_NONPRINT_BEGIN:
+                printing = false;
+                break;
+            case SEG_NONPRINT_END:
+                printing = true;
+                break;
+        }
+    }
+
+    p->dirty = 0;
+}
+
+void promptInit(void)
+{
+    const char *ps1 = varGet("PS1");
+    promptCompile(&prompt, ps1 ? ps1 : LSH_DEFAULT_PS1);
+}
+
+void promptInvalidate(unsigned what) //mark parts of the prompt as stale, they are re-read on the next prompt
+{
+    prompt.dirty |= what;
+}
+
+void promptFree(void)
+{
+    for(int i = 0; i < prompt.numSegs; i++)
+    {
+        free(prompt.segs[i].text);
+    }
+    free(prompt.segs);
+    free(prompt.buf);
+    free(prompt.home);
+    free(prompt.user);
+    memset(&prompt, 0, sizeof(prompt));
+}
@@ -0,0 +1,115 @@
+#include "lsh.h"
+
+//File redirections: <, >, >>, 2> and 2>&1. They are taken out of a command's words
+//and their files opened up front, then applied in the order they were written, so
+//cmd > f 2>&1 sends both streams to f while cmd 2>&1 > f keeps stderr where stdout
+//was. A pipeline stage gets them as dups in its LaunchIO, after the pipe ones; a
+//command the shell runs itself gets them on its own fds until it is done.
+
+void redirClose(Redirs *r) //the files, once the fds they were duplicated onto hold them
+{
+    for(int i = 0; i < r->count; i++)
+    {
+        if(r->fd[i] >= 0) close(r->fd[i]);
+    }
+    r->count = 0;
+}
+
+int redirTake(char **args, Redirs *r) //open and remove the redirections in args, 0 or -1 once the error is reported
+{
+    int w = 0;
+
+    r->count = 0;
+    for(int i = 0; args[i] != NULL; i++)
+    {
+        TokenKind kind = lshTokKind(args[i]);
+        int flags;
+
+        switch(kind)
+        {
+            case TOK_IN: flags = O_RDONLY; break;
+            case TOK_OUT: case TOK_ERR: flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+            case TOK_APPEND: flags = O_WRONLY | O_CREAT | O_APPEND; break;
+            case TOK_ERROUT: flags = 0; break;
+            default:
+                args[w++] = args[i];
+                continue;
+        }
+
+        if(r->count == REDIR_MAX)
+        {
+            fprintf(stderr, "lsh: too many redirections\n");
+            redirClose(r);
+            return -1;
+        }
+
+        if(kind == TOK_ERROUT) //no file, stderr becomes whatever stdout is by then
+        {
+            r->fd[r->count] = -1;
+            r->target[r->count++] = STDERR_FILENO;
+            continue;
+        }
+
+        if(args[i+1] == NULL || lshTokKind(args[i+1]) != TOK_WORD)
+        {
+            fprintf(stderr, "lsh: syntax error near unexpected token `%s'\n", args[i]);
+            redirClose(r);
+            return -1;
+        }
+
+        int fd = open(args[i+1], flags | O_CLOEXEC, 0644);
+        if(fd < 0)
+        {
+            fprintf(stderr, "lsh: %s: %s\n", args[i+1], strerror(errno));
+            redirClose(r);
+            return -1;
+        }
+
+        r->fd[r->count] = fd;
+        r->target[r->count++] = kind == TOK_IN ? STDIN_FILENO : kind == TOK_ERR ? STDERR_FILENO : STDOUT_FILENO;
+        i++; //the file name
+    }
+    args[w] = NULL;
+    return 0;
+}
+
+void redirChild(const Redirs *r, LaunchIO *io) //have the child apply them, after the dups already in io
+{
+    for(int i = 0; i < r->count; i++)
+    {
+        launchIODup(io, r->fd[i] >= 0 ? r->fd[i] : STDOUT_FILENO, r->target[i]);
+    }
+}
+
+void redirApply(const Redirs *r, int saved[3]) //point the shell's own fds at them, saved gets what they were
+{
+    if(r->count == 0) return;
+
+    fflush(stdout); //earlier output must not end up in the file
+    fflush(stderr);
+    for(int i = 0; i < r->count; i++)
+    {
+        int target = r->target[i];
+        if(saved[target] < 0)
+        {
+            saved[target] = fcntl(target, F_DUPFD_CLOEXEC, 10); //out of the way of the low fds, and of children
+        }
+        dup2(r->fd[i] >= 0 ? r->fd[i] : STDOUT_FILENO, target);
+    }
+}
+
+void redirRestore(int saved[3]) //undo redirApply()
+{
+    fflush(stdout); //builtin output is still in stdio's buffer and belongs in the redirected file
+    fflush(stderr);
+    for(int fd = 0; fd < 3; fd++)
+    {
+        if(saved[fd] >= 0)
+        {
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+            saved[fd] = -1;
+        }
+    }
+}
+
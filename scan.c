@@ -0,0 +1,118 @@
+#include "lsh.h"
+
+//Vectorized search for the first byte of a small character set, used by the
+//tokenizer to jump straight to the next delimiter or quote instead of looking
+//at the line one byte at a time.
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define LSH_SCAN_X86 1
+#endif
+
+void scanSetInit(ScanSet *set, const char *chars)
+{
+    memset(set->table, 0, sizeof(set->table));
+    set->count = 0;
+
+    for(const char *c = chars; *c && set->count < LSH_SCAN_MAX; c++)
+    {
+        set->chars[set->count++] = *c;
+        set->table[(unsigned char) *c] = 1;
+    }
+}
+
+static const char *scanScalar(const char *p, const char *end, const ScanSet *set)
+{
+    while(p < end && !set->table[(unsigned char) *p]) //one table lookup per byte
+    {
+        p++;
+    }
+    return p;
+}
+
+#ifdef LSH_SCAN_X86
+static const char *scanSSE2(const char *p, const char *end, const ScanSet *set)
+{
+    __m128i needles[LSH_SCAN_MAX];
+    for(int k = 0; k < set->count; k++)
+    {
+        needles[k] = _mm_set1_epi8(set->chars[k]);
+    }
+
+    while(end - p >= 16) //compare 16 bytes against every needle at once
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i hit = _mm_cmpeq_epi8(v, needles[0]);
+
+        for(int k = 1; k < set->count; k++)
+        {
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, needles[k]));
+        }
+
+        int mask = _mm_movemask_epi8(hit);
+        if(mask)
+        {
+            return p + __builtin_ctz(mask); //lowest set bit is the first match
+        }
+        p += 16;
+    }
+
+    return scanScalar(p, end, set); //fewer than 16 bytes left
+}
+
+__attribute__((target("avx2")))
+static const char *scanAVX2(const char *p, const char *end, const ScanSet *set)
+{
+    __m256i needles[LSH_SCAN_MAX];
+    for(int k = 0; k < set->count; k++)
+    {
+        needles[k] = _mm256_set1_epi8(set->chars[k]);
+    }
+
+    while(end - p >= 32) //same as the SSE2 loop, 32 bytes at a time
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i hit = _mm256_cmpeq_epi8(v, needles[0]);
+
+        for(int k = 1; k < set->count; k++)
+        {
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, needles[k]));
+        }
+
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(hit);
+        if(mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+
+    //GCC leaves out vzeroupper on this tail call, and legacy SSE code running with
+    //dirty upper halves pays an AVX-SSE transition penalty on every instruction.
+    _mm256_zeroupper();
+    return scanSSE2(p, end, set); //finish the tail with 16-byte compares
+}
+#endif
+
+static const char *scanPick(const char *p, const char *end, const ScanSet *set);
+static const char *(*scanImpl)(const char *, const char *, const ScanSet *) = scanPick;
+
+static const char *scanPick(const char *p, const char *end, const ScanSet *set) //choose the widest implementation the CPU supports on first use
+{
+#ifdef LSH_SCAN_X86
+    __builtin_cpu_init();
+    scanImpl = __builtin_cpu_supports("avx2") ? scanAVX2 : scanSSE2;
+#else
+    scanImpl = scanScalar;
+#endif
+    return scanImpl(p, end, set);
+}
+
+const char *scanFind(const char *p, const char *end, const ScanSet *set)
+{
+    if(end - p < LSH_SCAN_SHORT) //setting up the vector needles costs more than a short scalar walk
+    {
+        return scanScalar(p, end, set);
+    }
+    return scanImpl(p, end, set);
+}
@@ -0,0 +1,376 @@
+#include "lsh.h"
+
+//Command substitution, $(command) and `command`, and variable expansion. The
+//tokenizer leaves the command text in the word between LSH_SUBST_OPEN and
+//LSH_SUBST_CLOSE bytes and a variable's name after LSH_VAR_OPEN; substExpand() puts
+//the command's output, minus trailing newlines, or the variable's value in place.
+//Whatever the command itself holds is expanded first, in the shell. A builtin that
+//can run inside the shell writes into a memory stream without any fork, an external
+//command is spawned with stdout on a pipe, and anything else (pipelines, cd) runs in
+//a forked copy of the shell.
+
+bool lshTokSubst; //the last lshTokenize() call left substitutions or variables to expand
+
+static char **substWords; //expanded words, owned here until the command has run
+static int substNumWords, substCapWords;
+
+static void substAppend(char **buf, size_t *len, size_t *cap, const char *s, size_t n)
+{
+    if(*len + n + 1 > *cap)
+    {
+        size_t capacity = *cap ? *cap : 256;
+        while(capacity < *len + n + 1) capacity *= 2;
+
+        char *grown = realloc(*buf, capacity);
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        *buf = grown;
+        *cap = capacity;
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+}
+
+static char *substKeep(const char *s, size_t len) //copy of s that lives until substRelease()
+{
+    if(substNumWords == substCapWords)
+    {
+        int capacity = substCapWords ? substCapWords * 2 : 16;
+        char **grown = realloc(substWords, capacity * sizeof(char*));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        substWords = grown;
+        substCapWords = capacity;
+    }
+
+    char *word = strndup(s, len);
+    if(!word)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    substWords[substNumWords++] = word;
+    return word;
+}
+
+static void substPush(char ***tokens, int *count, int *capacity, char *token)
+{
+    if(*count + 1 >= *capacity) //keep room for the final NULL
+    {
+        *capacity *= 2;
+        char **grown = realloc(*tokens, *capacity * sizeof(char*));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        *tokens = grown;
+    }
+    (*tokens)[(*count)++] = token;
+}
+
+static void substReadAll(int fd, char **buf, size_t *len, size_t *cap) //everything written to fd until EOF
+{
+    while(true)
+    {
+        if(*cap - *len < SUBST_READ_SIZE + 1) //read straight into the buffer, SUBST_READ_SIZE at a time
+        {
+            size_t capacity = *cap ? *cap : SUBST_READ_SIZE + 1;
+            while(capacity - *len < SUBST_READ_SIZE + 1) capacity *= 2;
+
+            char *grown = realloc(*buf, capacity);
+            if(!grown)
+            {
+                fprintf(stderr, "lsh: Allocation Error!\n");
+                exit(EXIT_FAILURE);
+            }
+            *buf = grown;
+            *cap = capacity;
+        }
+
+        ssize_t n = read(fd, *buf + *len, SUBST_READ_SIZE);
+        if(n > 0)
+        {
+            *len += n;
+        }
+        else if(n == 0 || errno != EINTR)
+        {
+            break;
+        }
+    }
+    if(*buf) (*buf)[*len] = '\0';
+}
+
+static int substCaptureBuiltin(int builtin, char **args, char **out, size_t *len) //run builtin in the shell, stdout into memory
+{
+    FILE *mem = open_memstream(out, len);
+    if(!mem)
+    {
+        perror("lsh: open_memstream");
+        return -1;
+    }
+
+    FILE *realStdout = stdout;
+    fflush(stdout);
+    stdout = mem; //builtins print through stdout, so they write into the stream unchanged
+
+    lshLastStatus = 0;
+    lshBuiltins[builtin].func(args);
+
+    stdout = realStdout;
+    fclose(mem); //sets *out and *len
+    return 0;
+}
+
+static int substCapturePipe(char **args, int builtin, bool simple, bool compound, char **out, size_t *len) //run args with stdout on a pipe and read it all
+{
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) < 0)
+    {
+        perror("lsh: pipe");
+        return -1;
+    }
+
+    LaunchIO io;
+    launchIOInit(&io);
+    launchIODup(&io, fds[1], STDOUT_FILENO);
+    if(lshJobControl) //^C reaches the command, not the shell
+    {
+        io.pgid = 0;
+        io.foreground = true;
+    }
+
+    pid_t pid;
+    if(simple && builtin < 0)
+    {
+        pid = lshSpawn(args, &io);
+    }
+    else
+    {
+        pid = launchFork(&io); //a copy of the shell runs the whole line
+        if(pid == 0)
+        {
+            lshJobControl = false; //the copy belongs to the substitution's process group
+            if(compound) astRunTokens(args, NULL); //lists and compound commands expand each command as it runs
+            else lshExecute(args);
+            fflush(stdout);
+            _exit(lshLastStatus); //exit only ends the subshell
+        }
+    }
+    close(fds[1]);
+
+    if(pid < 0)
+    {
+        close(fds[0]);
+        lshLastStatus = 127;
+        return -1;
+    }
+
+    size_t cap = 0;
+    substReadAll(fds[0], out, len, &cap);
+    close(fds[0]);
+
+    int status;
+    uint64_t start = timingNow();
+    while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    lshTiming.waitNs += timingNow() - start;
+
+    if(lshJobControl)
+    {
+        tcsetpgrp(STDIN_FILENO, lshShellPgid); //take the terminal back
+    }
+    lshLastStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return 0;
+}
+
+static char *substRun(const char *text, size_t textLen, size_t *outLen) //output of the command in text, trailing newlines dropped
+{
+    char *line = strndup(text, textLen);
+    int capacity = LSH_TOK_BUFSIZE;
+    char **args = malloc(capacity * sizeof(char*));
+    if(!line || !args)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    args = lshTokenize(line, &args, &capacity);
+    args = aliasExpand(&args, &capacity);
+
+    bool compound = astNeeded(args);
+    bool globbing = lshTokGlob; //expanding resets it
+    if(lshTokSubst && !compound) args = substExpand(&args, &capacity); //variables and nested substitutions, right here in the shell
+    if(globbing && !compound) args = globExpand(&args, &capacity);
+
+    bool simple = !compound; //one plain command, no operators
+    for(int i = 0; args[i] && simple; i++)
+    {
+        simple = lshTokKind(args[i]) == TOK_WORD;
+    }
+
+    char *out = NULL;
+    size_t len = 0;
+
+    if(args[0])
+    {
+        int builtin = lshFindBuiltin(args[0]);
+
+        if(simple && builtin >= 0 && (lshBuiltins[builtin].flags & LSH_BI_INPROC))
+        {
+            substCaptureBuiltin(builtin, args, &out, &len);
+        }
+        else
+        {
+            substCapturePipe(args, builtin, simple && !astFindFunc(args[0]), compound, &out, &len); //a function runs in the forked copy
+        }
+    }
+
+    while(len > 0 && out[len - 1] == '\n') len--;
+
+    free(args);
+    free(line);
+    *outLen = len;
+    return out;
+}
+
+char **substExpand(char ***tokensPtr, int *capacity) //replace every substitution in *tokensPtr with its output
+{
+    char **in = *tokensPtr;
+    int numIn = 0;
+    while(in[numIn]) numIn++;
+
+    int outCap = numIn + 2 > LSH_TOK_BUFSIZE ? numIn + 2 : LSH_TOK_BUFSIZE, numOut = 0;
+    char **out = malloc(outCap * sizeof(char*));
+    if(!out)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool commandStart = true; //still in the NAME=value words in front of a command
+
+    for(int i = 0; i < numIn; i++)
+    {
+        char *word = in[i];
+        TokenKind kind = lshTokKind(word);
+        bool assignment = commandStart && kind == TOK_WORD && varIsAssignment(word); //its value is never split
+
+        commandStart = kind == TOK_PIPE || kind == TOK_BG || assignment;
+        if(kind != TOK_WORD || !strpbrk(word, LSH_SUBST_MARKS))
+        {
+            substPush(&out, &numOut, &outCap, word);
+            continue;
+        }
+
+        //Unquoted output is split into fields at blanks and newlines, the first joining
+        //the text before it and the last the text after it; quoted output stays whole.
+        char *buf = NULL;
+        size_t len = 0, cap = 0;
+        bool inWord = false; //something, even an empty "$(...)", belongs to the current word
+
+        for(char *p = word; *p; )
+        {
+            char *mark = strpbrk(p, LSH_SUBST_MARKS);
+            size_t literal = mark ? (size_t) (mark - p) : strlen(p);
+
+            if(literal > 0)
+            {
+                substAppend(&buf, &len, &cap, p, literal);
+                inWord = true;
+            }
+            if(!mark) break;
+
+            char *close;
+            const char *output;
+            char *owned = NULL;
+            size_t outputLen;
+            bool quoted = *mark == LSH_SUBST_OPEN_QUOTED || *mark == LSH_VAR_OPEN_QUOTED || assignment;
+
+            if(*mark == LSH_VAR_OPEN || *mark == LSH_VAR_OPEN_QUOTED)
+            {
+                size_t nameLen = varRefLen(mark + 1);
+                output = varLookup(mark + 1, nameLen);
+                outputLen = output ? strlen(output) : 0;
+                close = mark + nameLen; //the name ends itself, a LSH_SUBST_CLOSE after it is only a separator
+                if(close[1] == LSH_SUBST_CLOSE) close++;
+            }
+            else
+            {
+                close = strchr(mark + 1, LSH_SUBST_CLOSE);
+                output = owned = substRun(mark + 1, close - mark - 1, &outputLen);
+            }
+
+            if(quoted)
+            {
+                substAppend(&buf, &len, &cap, output ? output : "", outputLen);
+                inWord = true;
+            }
+            for(size_t o = 0; !quoted && o < outputLen; )
+            {
+                size_t run = 0; //characters up to the next blank go in as one piece
+                while(o + run < outputLen && !strchr(" \t\n", output[o + run])) run++;
+
+                if(run > 0)
+                {
+                    substAppend(&buf, &len, &cap, output + o, run);
+                    inWord = true;
+                    o += run;
+                    continue;
+                }
+                if(inWord) //a blank ends the word
+                {
+                    substPush(&out, &numOut, &outCap, substKeep(buf, len));
+                    len = 0;
+                    inWord = false;
+                }
+                o++;
+            }
+            free(owned);
+            p = close + 1;
+        }
+
+        if(inWord) substPush(&out, &numOut, &outCap, substKeep(buf ? buf : "", len));
+        free(buf);
+    }
+    out[numOut] = NULL;
+
+    free(in);
+    *tokensPtr = out;
+    *capacity = outCap;
+    lshTokSubst = false;
+    return out;
+}
+
+int substMark(void) //where the words of the next command start, for substReleaseTo()
+{
+    return substNumWords;
+}
+
+void substReleaseTo(int mark) //done with the words expanded since mark, the ones before it are still in use
+{
+    for(int i = mark; i < substNumWords; i++)
+    {
+        free(substWords[i]);
+    }
+    substNumWords = mark;
+}
+
+void substRelease(void) //done with the command the words were expanded for
+{
+    substReleaseTo(0);
+}
+
+void substFree(void)
+{
+    substRelease();
+    free(substWords);
+    substWords = NULL;
+    substCapWords = 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Golden tests: each tests/NAME.lsh is run as a script from an empty scratch
+# directory and its stdout and stderr must match tests/NAME.out exactly.
+#   LSH=./lsh sh tests/run.sh [NAME...]
+
+LSH=$(cd "$(dirname "${LSH:-./lsh}")" && pwd)/$(basename "${LSH:-./lsh}")
+DIR=$(cd "$(dirname "$0")" && pwd)
+pass=0
+fail=0
+
+if [ $# -eq 0 ]; then
+    set -- "$DIR"/*.lsh
+fi
+
+for script in "$@"; do
+    name=$(basename "$script" .lsh)
+    work=$(mktemp -d)
+    (cd "$work" && HOME="$work" "$LSH" "$DIR/$name.lsh" > "$work/.actual" 2>&1)
+
+    if cmp -s "$DIR/$name.out" "$work/.actual"; then
+        pass=$((pass + 1))
+    else
+        fail=$((fail + 1))
+        echo "FAIL: $name"
+        diff -u "$DIR/$name.out" "$work/.actual" | head -40
+    fi
+    rm -rf "$work"
+done
+
+echo "$pass passed, $fail failed"
+[ "$fail" -eq 0 ]
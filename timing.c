@@ -0,0 +1,67 @@
+#include "lsh.h"
+
+//The time keyword. The shell keeps running totals of the phases it spends time
+//in (parse, path lookup, spawn, wait) and of the rusage wait4() returns for its
+//foreground children; time clears them, runs its command and reports the split.
+
+LshTiming lshTiming; //global phase accounting
+
+uint64_t timingNow(void) //monotonic clock in nanoseconds
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void timingAddChild(const struct rusage *ru) //account for a reaped foreground process
+{
+    timeradd(&lshTiming.childUser, &ru->ru_utime, &lshTiming.childUser);
+    timeradd(&lshTiming.childSys, &ru->ru_stime, &lshTiming.childSys);
+    if(ru->ru_maxrss > lshTiming.childMaxRss) lshTiming.childMaxRss = ru->ru_maxrss;
+}
+
+static double tvSeconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void timingPrintSeconds(const char *label, double seconds) //same layout as bash's time
+{
+    fprintf(stderr, "%-7s %dm%.3fs\n", label, (int) (seconds / 60), seconds - (int) (seconds / 60) * 60);
+}
+
+int lshTime(char **args) //time command...: run a command or pipeline and report where its time went
+{
+    if(args[1] == NULL)
+    {
+        return 1; //nothing to time
+    }
+
+    uint64_t parseNs = lshTiming.parseNs; //the line holding this command was already tokenized
+    struct rusage selfBefore, selfAfter;
+
+    memset(&lshTiming, 0, sizeof(lshTiming));
+    getrusage(RUSAGE_SELF, &selfBefore);
+    uint64_t start = timingNow();
+
+    int status = lshExecute(args + 1);
+
+    uint64_t wall = timingNow() - start;
+    getrusage(RUSAGE_SELF, &selfAfter);
+
+    struct timeval selfUser, selfSys; //the shell's own share, in-process builtins included
+    timersub(&selfAfter.ru_utime, &selfBefore.ru_utime, &selfUser);
+    timersub(&selfAfter.ru_stime, &selfBefore.ru_stime, &selfSys);
+
+    fflush(stdout); //the report comes after the command's own output
+    fprintf(stderr, "\n");
+    timingPrintSeconds("real", wall / 1e9);
+    timingPrintSeconds("user", tvSeconds(lshTiming.childUser) + tvSeconds(selfUser));
+    timingPrintSeconds("sys", tvSeconds(lshTiming.childSys) + tvSeconds(selfSys));
+    fprintf(stderr, "%-7s %ld KiB\n", "maxrss", lshTiming.childMaxRss);
+    fprintf(stderr, "%-7s parse %.3fms  lookup %.3fms  spawn %.3fms  wait %.3fms  cpu %.3fms\n", "shell",
+            parseNs / 1e6, lshTiming.lookupNs / 1e6, lshTiming.spawnNs / 1e6, lshTiming.waitNs / 1e6,
+            (tvSeconds(selfUser) + tvSeconds(selfSys)) * 1e3);
+
+    return status;
+}
@@ -0,0 +1,438 @@
+#include "lsh.h"
+
+//Shell variables. Each one is a single "NAME=value" string in an open addressing
+//table, so an exported variable is already in the form exec wants: the environment
+//is kept as a ready-made envp array pointing at those strings, patched in place when
+//an exported variable is set, exported or unset, and every spawn passes it as is.
+//environ points at the same array, so the C library sees what children see.
+
+static VarTable vars; //global variable table
+static char varSpecial[24]; //value of $?, $$ or $#, valid until the next lookup
+static const char *varArg0 = "lsh"; //$0
+static char **varArgs; //$1, $2, ... of the running function or script
+static int varNumArgs;
+static char *varJoined; //$@ and $*, valid until the next lookup
+static size_t varJoinedCap;
+
+static unsigned long varHash(const char *name, size_t len) //FNV-1a over the name
+{
+    unsigned long h = 1469598103934665603UL;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char) name[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static Var *varSlot(VarTable *t, const char *name, size_t len) //the slot holding name, or the empty slot where it belongs
+{
+    size_t mask = t->capacity - 1;
+    size_t i = varHash(name, len) & mask;
+
+    while(t->slots[i].entry && (t->slots[i].nameLen != len || memcmp(t->slots[i].entry, name, len) != 0)) //linear probing
+    {
+        i = (i + 1) & mask;
+    }
+    return &t->slots[i];
+}
+
+static void varGrow(VarTable *t)
+{
+    VarTable bigger = *t;
+    bigger.capacity = t->capacity ? t->capacity * 2 : VAR_TABLE_INITIAL;
+    bigger.slots = calloc(bigger.capacity, sizeof(Var));
+
+    if(!bigger.slots)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < t->capacity; i++) //rehash every live entry into the new table
+    {
+        if(t->slots[i].entry)
+        {
+            *varSlot(&bigger, t->slots[i].entry, t->slots[i].nameLen) = t->slots[i];
+        }
+    }
+
+    free(t->slots);
+    *t = bigger;
+}
+
+size_t varNameLen(const char *s) //length of the variable name s starts with, 0 if it does not start with one
+{
+    size_t len = 0;
+
+    if(!isalpha((unsigned char) s[0]) && s[0] != '_') return 0;
+    while(isalnum((unsigned char) s[len]) || s[len] == '_') len++;
+    return len;
+}
+
+size_t varRefLen(const char *s) //length of the name a $ reference starts with, special parameters included
+{
+    if(s[0] && strchr("?$#@*", s[0])) return 1;
+    if(isdigit((unsigned char) s[0])) return 1; //$10 is $1 followed by 0
+    return varNameLen(s);
+}
+
+bool varIsAssignment(const char *word) //NAME=value
+{
+    size_t len = varNameLen(word);
+    return len > 0 && word[len] == '=';
+}
+
+static void varEnvAdd(Var *v) //append v to the exported environment
+{
+    if(vars.envCount + 1 >= vars.envCap) //keep room for the final NULL
+    {
+        int capacity = vars.envCap * 2;
+        char **grown = realloc(vars.envp, capacity * sizeof(char*));
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        vars.envp = grown;
+        vars.envCap = capacity;
+        environ = vars.envp;
+    }
+    v->envIndex = vars.envCount;
+    vars.envp[vars.envCount++] = v->entry;
+    vars.envp[vars.envCount] = NULL;
+}
+
+static void varEnvRemove(Var *v) //take v out of the exported environment, the last entry fills the gap
+{
+    int last = --vars.envCount;
+
+    if(v->envIndex != last)
+    {
+        char *moved = vars.envp[last];
+        Var *m = varSlot(&vars, moved, strchr(moved, '=') - moved);
+        vars.envp[v->envIndex] = moved;
+        m->envIndex = v->envIndex;
+    }
+    vars.envp[last] = NULL;
+    v->envIndex = -1;
+}
+
+static void varChanged(const char *name, size_t len) //variables the shell itself watches
+{
+    if(len == 3 && memcmp(name, "PS1", 3) == 0)
+    {
+        if(lshInput.interactive) promptInit(); //recompile the prompt format
+    }
+    else if(len == 4 && (memcmp(name, "HOME", 4) == 0 || memcmp(name, "USER", 4) == 0))
+    {
+        promptInvalidate(PROMPT_VARS);
+    }
+    else if(len == 13 && memcmp(name, "LSH_AUDIT_LOG", 13) == 0)
+    {
+        auditOpen(varGet("LSH_AUDIT_LOG")); //NULL once it is unset, which closes the log
+    }
+}
+
+static Var *varPut(const char *name, size_t nameLen, const char *value, size_t valueLen) //set name, keeping its export flag
+{
+    if((vars.size + 1) * 4 > vars.capacity * 3) //keep the load factor under 3/4
+    {
+        varGrow(&vars);
+    }
+
+    char *entry = malloc(nameLen + valueLen + 2);
+    if(!entry)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(entry, name, nameLen);
+    entry[nameLen] = '=';
+    memcpy(entry + nameLen + 1, value, valueLen);
+    entry[nameLen + 1 + valueLen] = '\0';
+
+    Var *v = varSlot(&vars, name, nameLen);
+    if(v->entry)
+    {
+        if(v->envIndex >= 0) vars.envp[v->envIndex] = entry; //the same place in envp, nothing is rebuilt
+        free(v->entry);
+    }
+    else
+    {
+        v->nameLen = nameLen;
+        v->envIndex = -1;
+        vars.size++;
+    }
+    v->entry = entry;
+
+    varChanged(name, nameLen);
+    return v;
+}
+
+void varInit(void) //import the environment the shell was started with, all of it exported
+{
+    char **env = environ;
+
+    varGrow(&vars);
+    vars.envCap = VAR_ENV_INITIAL;
+    vars.envp = malloc(vars.envCap * sizeof(char*));
+    if(!vars.envp)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    vars.envp[0] = NULL;
+
+    for(int i = 0; env && env[i]; i++)
+    {
+        const char *eq = strchr(env[i], '=');
+        if(!eq || eq == env[i]) continue;
+
+        Var *v = varPut(env[i], eq - env[i], eq + 1, strlen(eq + 1));
+        if(v->envIndex < 0) varEnvAdd(v);
+    }
+    environ = vars.envp;
+}
+
+static const char *varJoinArgs(void) //$@ and $*: the positional parameters separated by spaces
+{
+    size_t len = 0;
+
+    for(int i = 0; i < varNumArgs; i++)
+    {
+        len += strlen(varArgs[i]) + 1;
+    }
+    if(len + 1 > varJoinedCap)
+    {
+        char *grown = realloc(varJoined, len + 1);
+        if(!grown)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        varJoined = grown;
+        varJoinedCap = len + 1;
+    }
+
+    char *w = varJoined;
+    for(int i = 0; i < varNumArgs; i++)
+    {
+        size_t n = strlen(varArgs[i]);
+        if(i > 0) *w++ = ' ';
+        memcpy(w, varArgs[i], n);
+        w += n;
+    }
+    *w = '\0';
+    return varJoined;
+}
+
+const char *varLookup(const char *name, size_t len) //value of name, NULL if it is unset
+{
+    if(len == 1 && !isalpha((unsigned char) name[0]) && name[0] != '_') //a special parameter
+    {
+        if(isdigit((unsigned char) name[0]))
+        {
+            int n = name[0] - '0';
+            return n == 0 ? varArg0 : n <= varNumArgs ? varArgs[n - 1] : NULL;
+        }
+        if(name[0] == '@' || name[0] == '*') return varJoinArgs();
+
+        int value = name[0] == '?' ? lshLastStatus : name[0] == '#' ? varNumArgs : (int) getpid();
+        snprintf(varSpecial, sizeof(varSpecial), "%d", value);
+        return varSpecial;
+    }
+    if(vars.capacity == 0) return NULL;
+
+    Var *v = varSlot(&vars, name, len);
+    return v->entry ? v->entry + len + 1 : NULL;
+}
+
+const char *varGet(const char *name)
+{
+    return varLookup(name, strlen(name));
+}
+
+void varSet(const char *name, const char *value, bool export)
+{
+    Var *v = varPut(name, strlen(name), value, strlen(value));
+    if(export && v->envIndex < 0) varEnvAdd(v);
+}
+
+void varAssign(const char *word, bool export) //NAME=value as one word
+{
+    size_t len = varNameLen(word);
+    Var *v = varPut(word, len, word + len + 1, strlen(word + len + 1));
+    if(export && v->envIndex < 0) varEnvAdd(v);
+}
+
+void varUnset(const char *name)
+{
+    size_t len = strlen(name);
+    if(vars.capacity == 0) return;
+
+    Var *v = varSlot(&vars, name, len);
+    if(!v->entry) return;
+
+    if(v->envIndex >= 0) varEnvRemove(v);
+    free(v->entry);
+    v->entry = NULL;
+    vars.size--;
+
+    size_t mask = vars.capacity - 1; //backward shift deletion keeps every probe chain unbroken
+    size_t hole = v - vars.slots;
+    for(size_t i = (hole + 1) & mask; vars.slots[i].entry; i = (i + 1) & mask)
+    {
+        size_t home = varHash(vars.slots[i].entry, vars.slots[i].nameLen) & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask))
+        {
+            vars.slots[hole] = vars.slots[i];
+            vars.slots[i].entry = NULL;
+            hole = i;
+        }
+    }
+
+    varChanged(name, len);
+}
+
+void varSetArg0(const char *arg0) //$0, the script being run or the shell
+{
+    varArg0 = arg0;
+}
+
+char **varPositional(int *count) //$1, $2, ... as an array
+{
+    *count = varNumArgs;
+    return varArgs;
+}
+
+void varSwapArgs(char ***args, int *count) //install new positional parameters, the old ones come back in *args and *count
+{
+    char **oldArgs = varArgs;
+    int oldCount = varNumArgs;
+
+    varArgs = *args;
+    varNumArgs = *count;
+    *args = oldArgs;
+    *count = oldCount;
+}
+
+char **varEnviron(void) //the exported environment, ready to pass to exec
+{
+    return vars.envp ? vars.envp : environ;
+}
+
+char **varTakeAssignments(char **args) //VAR=value cmd: moves the assignments out of args into an environment for cmd alone
+{
+    int n = 0;
+    while(args[n] && varIsAssignment(args[n])) n++;
+    if(n == 0 || !args[n]) return NULL; //no assignments, or nothing else to run
+
+    char **envp = malloc((vars.envCount + n + 1) * sizeof(char*));
+    if(!envp)
+    {
+        fprintf(stderr, "lsh: Allocation Error!\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(envp, vars.envp, vars.envCount * sizeof(char*));
+    int count = vars.envCount;
+
+    for(int i = 0; i < n; i++) //the words are NAME=value already, so they go in as they are
+    {
+        size_t len = varNameLen(args[i]);
+        Var *v = varSlot(&vars, args[i], len);
+        int at = v->entry && v->envIndex >= 0 ? v->envIndex : -1;
+
+        for(int j = vars.envCount; j < count && at < 0; j++) //an earlier prefix of the same name
+        {
+            if(strncmp(envp[j], args[i], len + 1) == 0) at = j;
+        }
+        if(at >= 0) envp[at] = args[i];
+        else envp[count++] = args[i];
+    }
+    envp[count] = NULL;
+
+    int rest = 0;
+    while(args[n + rest]) rest++;
+    memmove(args, args + n, (rest + 1) * sizeof(char*)); //the command moves to the front
+    return envp;
+}
+
+static int varCompare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int lshExport(char **args)
+{
+    if(!args[1]) //list the environment, sorted
+    {
+        char **sorted = malloc((vars.envCount + 1) * sizeof(char*));
+        if(!sorted)
+        {
+            fprintf(stderr, "lsh: Allocation Error!\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(sorted, vars.envp, vars.envCount * sizeof(char*));
+        qsort(sorted, vars.envCount, sizeof(char*), varCompare);
+
+        for(int i = 0; i < vars.envCount; i++)
+        {
+            printf("export %s\n", sorted[i]);
+        }
+        free(sorted);
+        return 1;
+    }
+
+    for(int i = 1; args[i]; i++)
+    {
+        size_t len = varNameLen(args[i]);
+
+        if(len > 0 && args[i][len] == '=')
+        {
+            varAssign(args[i], true);
+        }
+        else if(len > 0 && args[i][len] == '\0')
+        {
+            Var *v = varSlot(&vars, args[i], len);
+            if(v->entry && v->envIndex < 0) varEnvAdd(v); //a variable that is not set yet has nothing to export
+        }
+        else
+        {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", args[i]);
+            lshLastStatus = 1;
+        }
+    }
+    return 1;
+}
+
+int lshUnset(char **args)
+{
+    for(int i = 1; args[i]; i++)
+    {
+        if(varNameLen(args[i]) != strlen(args[i]))
+        {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", args[i]);
+            lshLastStatus = 1;
+            continue;
+        }
+        varUnset(args[i]);
+    }
+    return 1;
+}
+
+void varFree(void)
+{
+    for(size_t i = 0; i < vars.capacity; i++)
+    {
+        free(vars.slots[i].entry);
+    }
+    free(vars.slots);
+    free(vars.envp);
+    free(varJoined);
+    varJoined = NULL;
+    varJoinedCap = 0;
+    memset(&vars, 0, sizeof(vars));
+    environ = NULL;
+}